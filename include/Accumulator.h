@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Quad.h"
+#include "RenderTarget.h"
+#include "Settings.h"
+#include "Shader.h"
+
+#include <chrono>
+#include <vector>
+
+// Progressive rendering, jittered samples are summed into a floating point
+// target while the view is static. Alpha sums the squared luminance so the
+// noise left in the mean can be estimated per tile, the normal, depth and
+// albedo guides of the denoiser are summed alongside. Adaptive sampling spends
+// the samples of a frame on the noisiest tiles once every tile has its base
+// samples.
+class Accumulator {
+public:
+  Accumulator() = default;
+
+  void init(int width, int height);
+  // Drops all samples, e.g. after any change
+  void reset(int width, int height);
+
+  // Picks the tiles sampled this frame, returns the passes over them, 0 once
+  // every tile converged
+  int beginFrame(const Settings &settings);
+  // Draws in between add a sample to every picked tile
+  void beginPass();
+  void endPass();
+  // Averages the sums for presenting and estimates the tile noise
+  void resolve(Shader &resolveShader, Quad &quad, const Settings &settings);
+
+  // Samples per tile in red, whether the pass samples it in green
+  void bindTileSamples(int unit);
+  // Resolved means padded to whole tiles, color then the denoiser guides
+  void readResolved(std::vector<float> &color, std::vector<float> &normalDepth,
+                    std::vector<float> &albedo, int &width, int &height);
+  // Presented instead of the resolved color until the next reset
+  void setDenoised(const std::vector<float> &pixels);
+  void bindTexture(int unit);
+  void setFilter(UpscaleFilter filter);
+  void clean();
+
+  const int getWidth() const { return mSums.getWidth(); }
+  const int getHeight() const { return mSums.getHeight(); }
+  const bool isConverged() const { return mConverged; }
+  const float getAverageSamples() const;
+  const int getActiveTiles() const { return mActiveTiles.size(); }
+  const int getTileCount() const { return mTilesX * mTilesY; }
+  // Largest standard error of the mean luminance, 1/255 steps
+  const float getMaxNoise() const { return mMaxNoise; }
+  // Seconds since the last reset, frozen once converged
+  const double getElapsed() const;
+  const double getSamplesPerSecond() const;
+
+private:
+  void uploadTiles(bool picked);
+  int tilePixels(int tile) const;
+
+private:
+  RenderTarget mSums;
+  RenderTarget mResolved;
+  RenderTarget mDenoised;
+  bool mHasDenoised = false;
+  unsigned int mTileTexture = 0;
+  int mTilesX = 0;
+  int mTilesY = 0;
+  std::vector<int> mTileSamples;
+  std::vector<float> mTileNoise;
+  std::vector<int> mActiveTiles;
+  float mMaxNoise = 0.0f;
+  int mMaxSamples = 1;
+  double mPixelSamples = 0.0;
+  int mResolvesSinceNoise = 0;
+  bool mConverged = false;
+  std::chrono::time_point<std::chrono::high_resolution_clock> mStart, mEnd;
+};
@@ -1,8 +1,21 @@
 #pragma once
 
+#include "Accumulator.h"
+#include "CPURenderer.h"
+#include "ComputeTracer.h"
+#include "Denoiser.h"
+#include "FeedbackBuffer.h"
+#include "GPUTimer.h"
+#include "Interleaver.h"
 #include "Quad.h"
+#include "ResolutionController.h"
+#include "RenderTarget.h"
+#include "RegionTracker.h"
+#include "Reprojector.h"
 #include "SceneEditor.h"
 #include "Shader.h"
+#include "TileScheduler.h"
+#include "Stats.h"
 #include "UBO.h"
 
 #include <GLFW/glfw3.h>
@@ -10,9 +23,20 @@
 #include <chrono>
 #include <memory>
 
+// What a trace pass of the ray tracing shader does
+enum TraceMode {
+  FullTrace = 0,
+  AccumulateTrace, // jittered sample of the active tiles
+  ReprojectTrace,  // reuses the splatted previous frame
+  CornerTrace,     // vis ids at block corners only
+  InterpolateTrace // per pixel, reusing agreeing block corners
+};
+
 class Application {
 public:
-  Application(unsigned int width, unsigned int height);
+  Application(unsigned int width, unsigned int height,
+              const std::vector<std::string> &models,
+              const std::string &bvhFile, bool computeBackend = false);
   ~Application();
 
   void run();
@@ -23,6 +47,54 @@ private:
   void setupImGui();
   void processInput();
   void saveImage(const std::string &filename, int width, int height);
+  void compareWithCPU();
+  // Corner sampled image against a per pixel trace of the same view
+  void compareCornerSampling();
+  // Frame time of both backends on the current view, with --compute
+  void compareBackends();
+  void loadShader();
+  void renderFrame();
+  // Camera or scene changed, the image is traced again
+  // Camera floats only, the whole buffer when the hierarchy followed it
+  void uploadCamera();
+  void markChanged();
+  // Material or light edit, shaded again from the last vis buffer
+  void requestReshade();
+  // Model edit, only its old and new screen bounds are traced again
+  void requestRegionTrace();
+  void setTraceUniforms(Shader &shader, TraceMode mode);
+  void traceImage(TraceMode mode = TraceMode::FullTrace);
+  // Primary trace of rect (x, y, width, height) of target, a compute
+  // dispatch over it or the fragment pass under a scissor
+  void tracePrimary(RenderTarget &target, const glm::ivec4 &rect,
+                    bool compute);
+  // Corner pass ahead of an interpolated trace of a width x height target
+  void traceCorners(int width, int height);
+  const TraceMode primaryTraceMode() const;
+  void reshadeImage();
+  // Lights moved, changed type or count since the shadow mask was traced
+  bool shadowsChanged() const;
+  void accumulateFrame();
+  void denoiseImage();
+  // Progressive samples are still being added
+  bool isAccumulating() const;
+  // Plain traces are interleaved and reconstructed
+  bool isInterleaving() const;
+  // Tiles of a time sliced image are still left
+  bool isSlicing() const;
+  void traceTiles(int width, int height);
+  void updateBVH();
+  void rebuildBVH();
+  bool updateStreamedChunks();
+  // Visible chunks, then off screen shadow casters when shadows are on
+  std::vector<int> streamedChunks();
+  bool expandLazyBVH();
+  // Builds the given unbuilt lazy nodes and uploads the changed ranges, false
+  // when none was
+  bool expandNodes(const std::vector<int> &nodeIDs);
+  // Warns once per deeper hierarchy the trace shader's stack cannot hold
+  void checkStackSize();
+  void updateStats();
 
   static void framebuffer_size_callback(GLFWwindow *window, int width,
                                         int height);
@@ -33,14 +105,65 @@ private:
   std::shared_ptr<Camera> mCamera;
   std::unique_ptr<Data> mData;
   std::unique_ptr<UBO> mDataUBO;
+  std::unique_ptr<FeedbackBuffer> mFeedback;
   std::unique_ptr<Quad> mQuad;
   std::unique_ptr<Shader> mShader;
+  std::unique_ptr<Shader> mPresentShader;
+  std::unique_ptr<Shader> mResolveShader;
+  std::unique_ptr<Shader> mReprojectShader;
+  std::unique_ptr<Shader> mReconstructShader;
+  std::unique_ptr<RenderTarget> mRenderTarget;
+  std::unique_ptr<RenderTarget> mSliceTarget;
+  std::unique_ptr<RenderTarget> mReshadeTarget;
+  std::unique_ptr<RenderTarget> mCornerTarget;
+  std::unique_ptr<FeedbackBuffer> mCornerCounter;
+  std::unique_ptr<Accumulator> mAccumulator;
+  std::unique_ptr<Reprojector> mReprojector;
+  std::unique_ptr<Interleaver> mInterleaver;
+  // Compute backend of primary traces, picked at startup
+  std::unique_ptr<ComputeTracer> mComputeTracer;
+  std::unique_ptr<GPUTimer> mTraceTimer;
+  std::unique_ptr<ResolutionController> mResolutionController;
+  std::unique_ptr<TileScheduler> mTileScheduler;
+  std::unique_ptr<RegionTracker> mRegionTracker;
   std::shared_ptr<Scene> mScene;
   std::shared_ptr<SceneEditor> mSceneEditor;
   std::shared_ptr<Settings> mSettings;
+  std::shared_ptr<Stats> mStats;
+  std::unique_ptr<ChunkCache> mChunkCache;
+  std::unique_ptr<CPURenderer> mCPURenderer;
+  std::unique_ptr<Denoiser> mDenoiser;
+  std::vector<int> mVisibleChunks;
+  int mCasterChunks = 0;
+  std::string mBVHFile;
   float mTimeStep;
   std::chrono::time_point<std::chrono::high_resolution_clock> mFrameStart,
       mFrameEnd;
   bool mShowEditor = true;
   double mEditorToggleTimer = 0.0;
+  bool mCompareRequested = false;
+  bool mCornerCompareRequested = false;
+  bool mBackendCompareRequested = false;
+  double mCompareTimer = 0.0;
+  double mLastChangeTime = 0.0;
+  bool mTraceDirty = true;
+  bool mReshadeDirty = false;
+  bool mShowReshaded = false;
+  bool mRegionDirty = false;
+  // Records outside the last region point into the BVH before the edit
+  bool mVisStale = false;
+  // Slices go to mSliceTarget while mRenderTarget, traced at mTargetFactor,
+  // is shown
+  bool mSlicingBack = false;
+  float mTargetFactor = 1.0f;
+  // The last trace drew a dragged model as its proxy box
+  bool mProxyTraced = false;
+  // Pixels interpolated since the last corner pass, the counter is read a
+  // frame late
+  int mCornerPixels = 0;
+  bool mCornerReadPending = false;
+  glm::ivec4 mTraceRegion = glm::ivec4(0);
+  int mWarnedStackSize = 0;
+  std::vector<Light> mShadowLights;
+  float mDenoisedSamples = 0.0f;
 };
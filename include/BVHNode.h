@@ -8,10 +8,29 @@ public:
   ~BVHNode();
   void clean();
 
+  // Nodes reaching lazyDepth stay unbuilt leaves until expanded
   static BVHNode *buildBVH(const std::vector<Triangle> &triangles,
                            const int maxDepth, const int maxTrianglesInLeaf,
-                           int depth);
-  static BVHNode *createLeafNode(const std::vector<Triangle> &triangles);
+                           int depth, int lazyDepth = -1);
+  // Splits indices [begin, end) of triangles in place, only leaves copy
+  // their triangles and unbuilt nodes keep their index range
+  static BVHNode *buildBVH(const std::vector<Triangle> &triangles,
+                           std::vector<int> &indices, int begin, int end,
+                           const int maxDepth, const int maxTrianglesInLeaf,
+                           int depth, int lazyDepth);
+  static BVHNode *createLeafNode(const std::vector<Triangle> &triangles,
+                                 const std::vector<int> &indices, int begin,
+                                 int end);
+
+  // Lazy build from the triangles and indices the node was built from
+  void expand(const std::vector<Triangle> &triangles,
+              std::vector<int> &indices, const int maxDepth,
+              const int maxTrianglesInLeaf, const int lazyLevels);
+  static void assignIDs(BVHNode *node);
+  // Numbers the descendants of an expanded node from nextID, ids of the
+  // rest of the tree stay
+  static void assignChildIDs(BVHNode *node, int &nextID);
+  static void collectNodes(BVHNode *node, std::vector<BVHNode *> &nodes);
 
   // Node size
   static std::vector<int> calculateNodeSizes(const BVHNode *node);
@@ -22,6 +41,9 @@ public:
   const int getLeftID() const { return mLeftID; }
   const int getRightID() const { return mRightID; }
 
+  // Split axis, the left child holds the lower half
+  const int getSplitAxis() const { return mSplitAxis; }
+
   // Node*
   BVHNode *getLeft() { return mLeft; }
   BVHNode *getRight() { return mRight; }
@@ -30,15 +52,18 @@ public:
   const glm::vec3 &getMaxVert() const { return mMaxVert; }
   const glm::vec3 &getMinVert() const { return mMinVert; }
 
-  // Triangles
+  // Triangles of built leaves
   const std::vector<Triangle> &getTriangles() const { return mTriangles; }
   const int getTriangleCount() const { return mTriangles.size(); }
 
   // Leaf
   const bool isLeaf() const { return mIsLeaf; }
+  const bool isBuilt() const { return mIsBuilt; }
 
 private:
-  void computeBoundingBox();
+  void computeBoundingBox(const std::vector<Triangle> &triangles,
+                          const std::vector<int> &indices, int begin,
+                          int end);
 
 public:
   static int mIdCounter;
@@ -47,10 +72,16 @@ private:
   int mID;
   int mLeftID;
   int mRightID;
+  int mSplitAxis = 0;
   BVHNode *mLeft;
   BVHNode *mRight;
   glm::vec3 mMaxVert;
   glm::vec3 mMinVert;
   std::vector<Triangle> mTriangles;
+  // Index range of an unbuilt node
+  int mBegin = 0;
+  int mEnd = 0;
   bool mIsLeaf;
+  bool mIsBuilt = true;
+  int mDepth = 0;
 };
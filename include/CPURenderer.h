@@ -0,0 +1,179 @@
+#pragma once
+
+#include "Data.h"
+#include "Settings.h"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+struct Float8;
+
+#define CPU_TILE_SIZE 32
+
+// Camera rays per packet, 4x2 pixels
+#define PACKET_SIZE 8
+#define PACKET_WIDTH 4
+#define PACKET_HEIGHT 2
+
+struct CPURenderStats {
+  long long mRays = 0;
+  double mRenderTime = 0.0; // seconds
+  double mRaysPerSecond = 0.0;
+  int mThreads = 0;
+  bool mPacketMode = false;
+  bool mGroupMode = false;
+  bool mOrderedMode = false;
+  long long mNodeVisits = 0;
+};
+
+// Leaf triangles in SoA form for the SIMD kernel, unused lanes hold
+// degenerate triangles that never hit
+struct TriangleGroup {
+  float mVertex0[3][TRIANGLE_GROUP_SIZE];
+  float mEdge1[3][TRIANGLE_GROUP_SIZE];
+  float mEdge2[3][TRIANGLE_GROUP_SIZE];
+  int mRecords[TRIANGLE_GROUP_SIZE]; // leaf record offsets, -1 for padding
+};
+
+struct ImageDifference {
+  float mMeanError = 0.0f; // per channel, 0-255
+  int mMaxError = 0;
+  float mPixelsOverTolerance = 0.0f; // fraction
+};
+
+// Traces the data buffer on the CPU the same way shader.frag does, so it
+// needs no window or GL context. Images are RGBA8, bottom row first like
+// glReadPixels.
+class CPURenderer {
+public:
+  CPURenderer(int threads = 0);
+
+  void render(const Data &data, int width, int height,
+              std::vector<unsigned char> &pixels);
+  void setData(const Data &data);
+  glm::vec3 tracePixel(const glm::vec2 &fragCoord) const;
+
+  static bool saveImage(const std::string &filename, int width, int height,
+                        const std::vector<unsigned char> &pixels);
+  static ImageDifference compare(const std::vector<unsigned char> &a,
+                                 const std::vector<unsigned char> &b,
+                                 int tolerance);
+
+  const CPURenderStats &getStats() const { return mStats; }
+  // Unbuilt lazy nodes rays reached in the last render, by node index. They
+  // are traced as plain leaves, the caller expands them and renders again.
+  std::vector<int> getReachedUnbuilt() const;
+
+  // Camera rays are traced in packets of eight when enabled
+  void setPacketMode(bool packetMode) { mPacketMode = packetMode; }
+  const bool getPacketMode() const { return mPacketMode; }
+
+  // Single rays test leaves a triangle group at a time when enabled
+  void setGroupMode(bool groupMode) { mGroupMode = groupMode; }
+  const bool getGroupMode() const { return mGroupMode; }
+
+  // Near child first and nodes behind the closest hit skipped when enabled
+  void setOrderedMode(bool orderedMode) { mOrderedMode = orderedMode; }
+  const bool getOrderedMode() const { return mOrderedMode; }
+
+public:
+  struct Ray {
+    glm::vec3 mOrigin;
+    glm::vec3 mDirection;
+  };
+
+  struct Hit {
+    bool mHit = false;
+    float mT = 1e30f;
+    int mModelIndex;
+    int mMeshIndex;
+    int mIndices[3];
+    glm::vec3 mVertices[3];
+    glm::vec3 mNormal;
+    glm::vec3 mWorldPosition;
+    int mNodeVisits = 0;
+  };
+
+  // Defined with Float8 in CPURenderer.cpp, the only file built for the
+  // packet ISA
+  struct RayPacket;
+
+private:
+  // Mirrors shader.frag
+  Ray cameraRay(const glm::vec2 &fragCoord) const;
+  glm::vec3 rayTrace(const Ray &ray) const;
+  glm::vec3 shade(const Hit &hit) const;
+  Hit traverseBVH(const Ray &ray) const;
+  void intersectGlobalPrimitives(const Ray &ray, Hit &hit) const;
+  bool intersectLeafRecord(const Ray &ray, int &offset, Hit &hit) const;
+  void intersectLeafGroups(const Ray &ray, int nodeIndex, Hit &hit) const;
+  void readLeafRecord(int offset, float t, Hit &hit) const;
+  // Shadow rays, any hit before maxT
+  bool occluded(const Ray &ray, float maxT) const;
+  bool intersectLeafAny(const Ray &ray, int nodeIndex, int offset,
+                        float maxT) const;
+  bool intersectPrimitive(const Ray &ray, int index, float &outT,
+                          glm::vec3 &outNormal, int &outModelIndex) const;
+
+  // Packets
+  void tracePacket(const glm::vec2 *fragCoords, int activeMask,
+                   glm::vec3 *colors, long long &nodeVisits) const;
+  void setupPacket(RayPacket &packet) const;
+  void traversePacket(const RayPacket &packet, Hit *hits) const;
+  bool intersectPacketInterval(const RayPacket &packet,
+                               const glm::vec3 &maxVert,
+                               const glm::vec3 &minVert,
+                               float maxClosest) const;
+  void intersectPacketLeafRecord(const RayPacket &packet, Float8 mask,
+                                 int &offset, Float8 &closest,
+                                 Hit *hits) const;
+
+  // Triangle groups
+  void buildTriangleGroups();
+  void addLeafGroups(int nodeIndex);
+
+  void markReached(int nodeIndex, float leafFlag) const;
+  void pushChildren(int *stack, int &stackPointer, int leftIndex,
+                    int rightIndex, float direction) const;
+
+  // Buffer readers
+  float getFloat(int &offset) const { return mData[offset++]; }
+  int getInt(int &offset) const { return (int)mData[offset++]; }
+  glm::vec3 getVec3(int &offset) const;
+  glm::mat3 getMat3(int &offset) const;
+
+private:
+  int mThreads;
+  bool mPacketMode = false;
+  bool mGroupMode = true;
+  bool mOrderedMode = true;
+  const float *mData = nullptr;
+  int mStackSize = 0; // from the hierarchy depth, never overflows
+  CPURenderStats mStats;
+  // Flags per node, set by any worker thread
+  mutable std::vector<std::atomic<char>> mReached;
+
+  // Groups of each leaf by node index, primitives stay records
+  struct LeafGroups {
+    int mFirstGroup = 0;
+    int mGroupCount = 0;
+    int mFirstPrimitive = 0;
+    int mPrimitiveCount = 0;
+  };
+  std::vector<TriangleGroup> mGroups;
+  std::vector<int> mPrimitiveRecords;
+  std::vector<LeafGroups> mLeafGroups;
+};
+
+namespace CPUIntersect {
+bool rayAABB(const CPURenderer::Ray &ray, const glm::vec3 &maxVert,
+             const glm::vec3 &minVert, float &outTNear);
+bool rayTriangle(const CPURenderer::Ray &ray, const glm::vec3 &v0,
+                 const glm::vec3 &v1, const glm::vec3 &v2, float &outT);
+// Closest lane of the group hit before maxT, -1 on a miss
+int rayTriangleGroup(const CPURenderer::Ray &ray, const TriangleGroup &group,
+                     float maxT, float &outT);
+} // namespace CPUIntersect
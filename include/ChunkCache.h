@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Camera.h"
+#include "Light.h"
+#include "Mesh.h"
+#include "Model.h"
+
+#include <glm/glm.hpp>
+
+#include <fstream>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Chunk {
+  int mIndex;
+  int mModelIndex; // scene index, triangles are in its object space
+  int mTriangleCount;
+  long long mFileOffset;
+  // Scene bounds of the placed model
+  glm::vec3 mMaxVert;
+  glm::vec3 mMinVert;
+  glm::vec3 mLocalMaxVert;
+  glm::vec3 mLocalMinVert;
+};
+
+// Spatially clustered triangle chunks paged from disk. Each model is split
+// in its object space once, moving it only moves the chunk bounds. Chunk
+// bounds stay resident, chunk triangles are loaded on demand and evicted
+// least recently used first once the memory budget is exceeded.
+class ChunkCache {
+public:
+  ChunkCache(const std::string &path);
+  ~ChunkCache();
+
+  // Writes the chunk file again only when models were added, removed or
+  // changed detail level, or the chunk size changed. False when it is kept.
+  bool build(const std::vector<Model> &models, int chunkSize);
+  // Scene bounds of the chunks after models moved
+  void place(const std::vector<Model> &models);
+  // Triangles in the object space of the chunk's model
+  const std::vector<Triangle> &acquire(int chunkIndex);
+
+  // Chunks touched by camera rays, nearest first
+  std::vector<int> visibleChunks(const Camera &camera) const;
+  // Chunks outside the visible ones that may shadow them, those between the
+  // visible bounds and a light, nearest first
+  std::vector<int> shadowCasters(const std::vector<int> &visible,
+                                 const std::vector<Light> &lights,
+                                 const Camera &camera) const;
+
+  // Budget
+  void setBudget(size_t bytes);
+  const size_t getBudget() const { return mBudget; }
+
+  // Chunks
+  const std::vector<Chunk> &getChunks() const { return mChunks; }
+  const int getChunkCount() const { return mChunks.size(); }
+
+  // Residency
+  const int getResidentCount() const { return mResident.size(); }
+  const size_t getResidentBytes() const { return mResidentBytes; }
+  const float getHitRate() const;
+  void resetStats();
+
+private:
+  // Partitions pointers to the model's triangles, the triangles are only
+  // read
+  void split(std::vector<const Triangle *> &triangles, int begin, int end,
+             int modelIndex, int chunkSize, std::ofstream &file);
+  void evict();
+  void clear();
+
+private:
+  struct Resident {
+    std::vector<Triangle> mTriangles;
+    std::list<int>::iterator mLRUPosition;
+  };
+
+  std::string mPath;
+  std::vector<Chunk> mChunks;
+  // Model id, detail level and triangle count of each chunked model
+  std::vector<glm::ivec3> mBuiltModels;
+  int mBuiltChunkSize = 0;
+  std::unordered_map<int, Resident> mResident;
+  std::list<int> mLRU;
+  size_t mBudget = 256u << 20;
+  size_t mResidentBytes = 0;
+  long long mHits = 0;
+  long long mMisses = 0;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "RenderTarget.h"
+#include "Shader.h"
+
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Compute shader backend of the primary trace. shader.frag is compiled as a
+// compute stage, one invocation per pixel of a rectangle of the target with
+// its BVH traversal stack in shared memory. The work group size is picked
+// for the driver and shrunk until the stacks fit its shared memory.
+class ComputeTracer {
+public:
+  ComputeTracer() = default;
+
+  // Picks the group size, needs a current context. False when even single
+  // invocation groups leave too short a stack.
+  bool init();
+  // Compiled again with the trace shader's defines
+  void load(const char *shaderPath, const std::vector<std::string> &defines);
+  // The shader is in use with its uniforms set, rect is x, y, width, height
+  // of the color, vis and shadow mask attachments of a floating point target
+  void dispatch(RenderTarget &target, const glm::ivec4 &rect);
+
+  Shader &getShader() { return *mShader; }
+  const glm::ivec2 getLocalSize() const { return mLocalSize; }
+  const int getStackSize() const { return mStackSize; }
+
+private:
+  std::unique_ptr<Shader> mShader;
+  glm::ivec2 mLocalSize = glm::ivec2(8, 8);
+  int mStackSize = 100;
+};
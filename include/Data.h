@@ -2,21 +2,74 @@
 
 #include "BVHNode.h"
 #include "Camera.h"
+#include "ChunkCache.h"
 #include "Scene.h"
 #include "Settings.h"
 
+#include <memory>
+
+#define DATA_SIZE 10000000
+
+#define BVH_OFFSET 0
+#define MATERIAL_OFFSET 1
+#define PRIMITIVE_OFFSET 2
+#define SKIP_OFFSET 3
+
+#define REAL_SETTINGS_OFFSET 10
+#define REAL_CAMERA_OFFSET 20
+#define REAL_LIGHTS_OFFSET 40
+#define REAL_VERTICES_OFFSET 140
+
+// Leaf flag of a lazy node whose subtree is not built yet
+#define UNBUILT_LEAF 2.0f
+
+// Floats per primitive: type, model, position, size, rotation
+#define PRIMITIVE_SIZE 17
+
 class Data {
 public:
   void updateCamera(const Camera &camera);
 
   void updateBVH(const Scene& scene, const Settings& settings);
+  void updateBVH(ChunkCache &cache, const std::vector<int> &chunks,
+                 const Scene &scene, const Settings &settings);
+  bool loadBVH(const std::string &path);
+  bool expandBVH(const std::vector<int> &nodeIDs, const Settings &settings);
   void updateLights(const Scene& scene);
   void updateSettings(const Settings& settings);
+  // Window pixels per traced texel, kept apart from the settings for dynamic
+  // resolution
+  void updateDownsampleFactor(float factor);
+  const float getDownsampleFactor() const {
+    return mData[REAL_SETTINGS_OFFSET];
+  }
   void updateMaterial(const Scene& scene, bool alone);
+  void updatePrimitives(const Scene &scene);
 
   const int getFloatDataSize() const { return mDataFloatSize; }
+  // Materials are written last, up to the float data size
+  const int getMaterialOffset() const { return mData[MATERIAL_OFFSET]; }
+  const float *getData() const { return mData; }
+
+  // Nodes of the last written hierarchy
+  const int getNodeCount() const { return mNodeCount; }
+  // Float ranges (offset, count) the last expandBVH wrote, everything from
+  // the changed tail to the float data size changed as well
+  const std::vector<std::pair<int, int>> &getChangedRanges() const {
+    return mChangedRanges;
+  }
+  const int getChangedTail() const { return mChangedTail; }
+  const int getUnbuiltCount() const { return mUnbuiltCount; }
+  // Streamed chunks left out of the last gather by the float budget
+  const int getDroppedChunks() const { return mDroppedChunks; }
+  // Stack entries a depth first traversal pushing both children needs
+  const int getStackSize() const { return mTreeDepth + 2; }
 
 private:
+  void updateNodes(const std::vector<Triangle> &triangles,
+                   const Settings &settings);
+  void writeNodes(BVHNode *root, int tableSize);
+  void writeSkipLinks();
   void updateNode(BVHNode *node);
   void updateLeafNode(BVHNode *node);
 
@@ -31,9 +84,24 @@ private:
   void add(const Triangle &triangle);
   void add(const Material &material);
   void add(const Light &light);
+  void add(const Primitive &primitive, int modelIndex);
 
 private:
-  float mData[10000000];
+  float mData[DATA_SIZE];
   int mOffset = 0;
   int mDataFloatSize = 0;
+  std::unique_ptr<BVHNode> mLazyRoot;
+  // Lazy nodes by id, with the triangles and indices unbuilt nodes span
+  std::vector<BVHNode *> mLazyNodes;
+  std::vector<Triangle> mLazyTriangles;
+  std::vector<int> mLazyIndices;
+  std::vector<std::pair<int, int>> mChangedRanges;
+  int mChangedTail = 0;
+  int mNodeCount = 0;
+  // Offset table entries and the end of the node records
+  int mTableSize = 0;
+  int mNodeEnd = 0;
+  int mUnbuiltCount = 0;
+  int mDroppedChunks = 0;
+  int mTreeDepth = 0;
 };
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Settings.h"
+
+#include <vector>
+
+// Edge avoiding a-trous wavelet filter on the CPU. The guides come from the
+// trace, RGBA floats per pixel: normal and depth, albedo. Lighting is
+// filtered with the albedo divided out so textures stay sharp.
+class Denoiser {
+public:
+  Denoiser(int threads = 0);
+
+  void denoise(const std::vector<float> &color,
+               const std::vector<float> &normalDepth,
+               const std::vector<float> &albedo, int width, int height,
+               const Settings &settings, std::vector<float> &result);
+
+  // Filter time of the last call, ms
+  const double getTime() const { return mTime; }
+
+private:
+  void filterPass(const std::vector<float> &input, std::vector<float> &output,
+                  const std::vector<float> &normalDepth, int width,
+                  int height, int step, float colorSigma,
+                  const Settings &settings) const;
+
+private:
+  int mThreads;
+  double mTime = 0.0;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+
+// Shader storage buffer the shader writes per node hit counts into, read
+// back between frames to decide which lazy BVH nodes to expand. Other
+// bindings hold counters, e.g. of re-traced pixels.
+class FeedbackBuffer {
+public:
+  FeedbackBuffer() = default;
+
+  void init(int size, int bindingIndex = 1);
+
+  void read(std::vector<int> &counts, int count);
+  // Read back without stalling, the counts are copied to one of two staging
+  // buffers and cleared, a copy is read once its fence has passed. Skipped
+  // while both copies are in flight.
+  void requestRead(int count);
+  // Oldest finished copy, false while none is ready
+  bool readRequested(std::vector<int> &counts);
+  // Copies in flight are dropped, e.g. once the ids they count changed
+  void dropRequests();
+  void clear();
+  void bind();
+  void unbind();
+  void clean();
+
+  const int getSize() const { return mSize; }
+
+private:
+  unsigned int mID;
+  int mBindingIndex = 1;
+  int mSize = 0;
+  unsigned int mStaging[2] = {0, 0};
+  void *mFences[2] = {nullptr, nullptr}; // GLsync of each copy
+  int mCounts[2] = {0, 0};
+  int mNextSlot = 0;
+};
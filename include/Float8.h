@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Eight lane float used by the packet tracer, AVX2 when the compiler targets
+// it and a plain array otherwise. Comparisons return lane masks with all
+// bits set, like the intrinsics.
+#ifdef __AVX2__
+
+struct Float8 {
+  __m256 mValue;
+
+  Float8() = default;
+  Float8(__m256 value) : mValue(value) {}
+  Float8(float value) : mValue(_mm256_set1_ps(value)) {}
+
+  static Float8 load(const float *values) { return _mm256_loadu_ps(values); }
+  void store(float *values) const { _mm256_storeu_ps(values, mValue); }
+};
+
+inline Float8 operator+(Float8 a, Float8 b) { return _mm256_add_ps(a.mValue, b.mValue); }
+inline Float8 operator-(Float8 a, Float8 b) { return _mm256_sub_ps(a.mValue, b.mValue); }
+inline Float8 operator*(Float8 a, Float8 b) { return _mm256_mul_ps(a.mValue, b.mValue); }
+inline Float8 operator/(Float8 a, Float8 b) { return _mm256_div_ps(a.mValue, b.mValue); }
+inline Float8 operator&(Float8 a, Float8 b) { return _mm256_and_ps(a.mValue, b.mValue); }
+inline Float8 operator|(Float8 a, Float8 b) { return _mm256_or_ps(a.mValue, b.mValue); }
+inline Float8 operator<(Float8 a, Float8 b) { return _mm256_cmp_ps(a.mValue, b.mValue, _CMP_LT_OQ); }
+inline Float8 operator>(Float8 a, Float8 b) { return _mm256_cmp_ps(a.mValue, b.mValue, _CMP_GT_OQ); }
+inline Float8 operator<=(Float8 a, Float8 b) { return _mm256_cmp_ps(a.mValue, b.mValue, _CMP_LE_OQ); }
+inline Float8 operator>=(Float8 a, Float8 b) { return _mm256_cmp_ps(a.mValue, b.mValue, _CMP_GE_OQ); }
+inline Float8 min(Float8 a, Float8 b) { return _mm256_min_ps(a.mValue, b.mValue); }
+inline Float8 max(Float8 a, Float8 b) { return _mm256_max_ps(a.mValue, b.mValue); }
+// mask ? a : b
+inline Float8 select(Float8 mask, Float8 a, Float8 b) { return _mm256_blendv_ps(b.mValue, a.mValue, mask.mValue); }
+inline int movemask(Float8 mask) { return _mm256_movemask_ps(mask.mValue); }
+
+#else
+
+struct Float8 {
+  float mValue[8];
+
+  Float8() = default;
+  Float8(float value) { std::fill(mValue, mValue + 8, value); }
+
+  static Float8 load(const float *values) {
+    Float8 result;
+    std::copy(values, values + 8, result.mValue);
+    return result;
+  }
+  void store(float *values) const { std::copy(mValue, mValue + 8, values); }
+};
+
+#define FLOAT8_LANES(expression)                                               \
+  Float8 result;                                                               \
+  for (int i = 0; i < 8; i++) {                                                \
+    result.mValue[i] = expression;                                             \
+  }                                                                            \
+  return result;
+
+inline float maskLane(bool value) { return value ? -1.0f : 0.0f; }
+inline bool laneSet(float value) { return std::signbit(value); }
+
+inline Float8 operator+(Float8 a, Float8 b) { FLOAT8_LANES(a.mValue[i] + b.mValue[i]) }
+inline Float8 operator-(Float8 a, Float8 b) { FLOAT8_LANES(a.mValue[i] - b.mValue[i]) }
+inline Float8 operator*(Float8 a, Float8 b) { FLOAT8_LANES(a.mValue[i] * b.mValue[i]) }
+inline Float8 operator/(Float8 a, Float8 b) { FLOAT8_LANES(a.mValue[i] / b.mValue[i]) }
+inline Float8 operator&(Float8 a, Float8 b) { FLOAT8_LANES(maskLane(laneSet(a.mValue[i]) && laneSet(b.mValue[i]))) }
+inline Float8 operator|(Float8 a, Float8 b) { FLOAT8_LANES(maskLane(laneSet(a.mValue[i]) || laneSet(b.mValue[i]))) }
+inline Float8 operator<(Float8 a, Float8 b) { FLOAT8_LANES(maskLane(a.mValue[i] < b.mValue[i])) }
+inline Float8 operator>(Float8 a, Float8 b) { FLOAT8_LANES(maskLane(a.mValue[i] > b.mValue[i])) }
+inline Float8 operator<=(Float8 a, Float8 b) { FLOAT8_LANES(maskLane(a.mValue[i] <= b.mValue[i])) }
+inline Float8 operator>=(Float8 a, Float8 b) { FLOAT8_LANES(maskLane(a.mValue[i] >= b.mValue[i])) }
+inline Float8 min(Float8 a, Float8 b) { FLOAT8_LANES(std::min(a.mValue[i], b.mValue[i])) }
+inline Float8 max(Float8 a, Float8 b) { FLOAT8_LANES(std::max(a.mValue[i], b.mValue[i])) }
+// mask ? a : b
+inline Float8 select(Float8 mask, Float8 a, Float8 b) { FLOAT8_LANES(laneSet(mask.mValue[i]) ? a.mValue[i] : b.mValue[i]) }
+inline int movemask(Float8 mask) {
+  int bits = 0;
+  for (int i = 0; i < 8; i++) {
+    if (laneSet(mask.mValue[i]))
+      bits |= 1 << i;
+  }
+  return bits;
+}
+
+#undef FLOAT8_LANES
+
+#endif
+
+struct Vec3x8 {
+  Float8 x;
+  Float8 y;
+  Float8 z;
+};
+
+inline Vec3x8 operator-(const Vec3x8 &a, const Vec3x8 &b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+inline Float8 dot(const Vec3x8 &a, const Vec3x8 &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3x8 cross(const Vec3x8 &a, const Vec3x8 &b) {
+  return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+// GL_TIME_ELAPSED queries on two objects, results are read a frame late so
+// waiting for them never stalls the pipeline
+class GPUTimer {
+public:
+  GPUTimer() = default;
+
+  void init();
+  // The tag is handed back with the result, e.g. what was measured
+  void begin(int tag = 0);
+  void end();
+  // Oldest finished measurement, false while none is ready
+  bool getResult(double &milliseconds, int &tag);
+  void clean();
+
+private:
+  unsigned int mQueries[2];
+  bool mPending[2] = {false, false};
+  int mTags[2] = {0, 0};
+  int mCurrent = 0;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Quad.h"
+#include "RenderTarget.h"
+#include "Shader.h"
+#include "UBO.h"
+
+// Interleaved rendering, each frame traces one phase of a pattern of the
+// render target, every other pixel of a checkerboard or one pixel of each
+// 2x2 quad. Untraced pixels keep their older sample, the reconstruction
+// fills those that no longer fit from the traced neighbors. Once the view
+// rests the remaining phases are traced and every sample is kept as traced,
+// so the image becomes exact.
+class Interleaver {
+public:
+  Interleaver() = default;
+
+  void init(int width, int height);
+  // The older samples can not be reused, e.g. after scene changes
+  void invalidate() { mValid = false; }
+
+  // Picks the phase of a frame traced into target. Changed frames start
+  // settling again, settling frames trace the phases still missing. The
+  // first frame of a target size traces every pixel.
+  void begin(RenderTarget &target, const Settings &settings, bool changed);
+  void reconstruct(Shader &reconstructShader, Quad &quad, UBO &data,
+                   RenderTarget &target);
+  void end() { mPattern = 1; }
+
+  // Traced pixels are one in pattern, 1 outside begin and end
+  const int getPattern() const { return mPattern; }
+  const int getPhase() const { return mPhase; }
+  // Phases are still missing since the view came to rest
+  const bool isSettling() const { return mRemaining > 0; }
+
+  void bindTexture(int unit) { mReconstructed.bindTexture(unit); }
+  void setFilter(UpscaleFilter filter) { mReconstructed.setFilter(filter); }
+  void clean() { mReconstructed.clean(); }
+
+private:
+  RenderTarget mReconstructed;
+  int mPattern = 1;
+  int mPhase = 0;
+  int mFrame = 0;
+  int mRemaining = 0;
+  // Every phase was traced since the last change
+  bool mSettled = false;
+  bool mValid = false;
+};
@@ -21,6 +21,9 @@ struct Triangle {
   int mModelIndex;
   int mMeshIndex;
 
+  // Analytic primitive stand-in, mIndices[1] is the primitive index
+  bool isPrimitive() const { return mIndices[0] < 0; }
+
   void recalculateCenter() {
     mCenter = glm::vec3(0.0f);
     for (int i = 0; i < 3; i++) {
@@ -32,6 +35,13 @@ struct Triangle {
   }
 };
 
+// One detail level of a mesh, level 0 is the imported geometry
+struct LOD {
+  std::vector<Vertex> mVertices;
+  std::vector<Triangle> mTriangles;
+  float mError = 0.0f; // surface deviation bound, object space distance
+};
+
 class Mesh {
 public:
   Mesh() = default;
@@ -50,14 +60,27 @@ public:
   // Rotation
   void setRotation(const glm::vec3 &newRotation) { mRotation = newRotation; }
 
-  // Triangles
-  const int getTriangleCount() const { return mTriangles.size(); }
-  const std::vector<Triangle> &getTriangles() const { return mTriangles; }
-  std::vector<Triangle> &modTriangles() { return mTriangles; }
+  // Triangles, of the active level
+  const int getTriangleCount() const { return getLOD().mTriangles.size(); }
+  const std::vector<Triangle> &getTriangles() const {
+    return getLOD().mTriangles;
+  }
+  std::vector<Triangle> &modTriangles() { return mLODs[mLODLevel].mTriangles; }
+  const int getOriginalTriangleCount() const {
+    return mLODs[0].mTriangles.size();
+  }
+
+  // Vertices, of the active level
+  const int getVerticesCount() const { return getLOD().mVertices.size(); }
+  const std::vector<Vertex> &getVertices() const { return getLOD().mVertices; }
 
-  // Vertices
-  const int getVerticesCount() const { return mVertices.size(); }
-  const std::vector<Vertex> &getVertices() const { return mVertices; }
+  // Level of detail
+  void generateLODs(int levels);
+  const int getLODCount() const { return mLODs.size(); }
+  const LOD &getLOD() const { return mLODs[mLODLevel]; }
+  void setLODLevel(int level);
+  const int getLODLevel() const { return mLODLevel; }
+  void setModelIndex(const int id);
 
   // Material
   void setMaterial(const Material &material) { mMaterial = material; }
@@ -67,21 +90,27 @@ public:
   // Bounding box
   const glm::vec3 &getMaxVert() const { return mMaxVert; }
   const glm::vec3 &getMinVert() const { return mMinVert; }
+  // Before the transform
+  const glm::vec3 &getLocalMaxVert() const { return mLocalMaxVert; }
+  const glm::vec3 &getLocalMinVert() const { return mLocalMinVert; }
 
   void update();
 
 private:
   void createBoundingBox();
   void recalculateVertex(Vertex &vertex);
+  static void buildTriangles(LOD &lod, const std::vector<int> &indices);
 
 private:
   int mIndex;
   glm::vec3 mPosition = glm::vec3(0.0f);
   glm::vec3 mScale = glm::vec3(1.0f);
   glm::vec3 mRotation = glm::vec3(0.0f);
-  std::vector<Triangle> mTriangles;
-  std::vector<Vertex> mVertices;
+  std::vector<LOD> mLODs = std::vector<LOD>(1);
+  int mLODLevel = 0;
   Material mMaterial;
   glm::vec3 mMaxVert;
   glm::vec3 mMinVert;
+  glm::vec3 mLocalMaxVert;
+  glm::vec3 mLocalMinVert;
 };
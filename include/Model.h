@@ -46,8 +46,20 @@ public:
   // Bounding box
   const glm::vec3 &getMaxVert() const { return mMaxVert; }
   const glm::vec3 &getMinVert() const { return mMinVert; }
+  const glm::vec3 &getLocalMaxVert() const { return mLocalMaxVert; }
+  const glm::vec3 &getLocalMinVert() const { return mLocalMinVert; }
+
+  // Level of detail, simplified levels are only generated once asked for
+  void generateLODs();
+  const bool hasLODs() const { return mLODsGenerated; }
+  void setLODLevel(int level);
+  const int getLODLevel() const { return mLODLevel; }
+  const int getLODCount() const;
 
   void update();
+  // Object space point placed in the scene, as the meshes place their
+  // vertices
+  glm::vec3 transform(const glm::vec3 &point) const;
 
 private:
   void processNode(const aiNode *node, const aiScene *scene);
@@ -63,6 +75,10 @@ private:
   int mIndex;
   int mSceneIndex;
   std::vector<Mesh> mMeshes;
+  int mLODLevel = 0;
+  bool mLODsGenerated = false;
   glm::vec3 mMaxVert;
   glm::vec3 mMinVert;
+  glm::vec3 mLocalMaxVert;
+  glm::vec3 mLocalMinVert;
 };
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Material.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtx/euler_angles.hpp>
+#include <string>
+
+enum PrimitiveType { Sphere = 0, Plane, Box };
+
+// Analytic shape traced with its own intersection routine instead of
+// triangles. Size is the radius (x) for spheres, the half extents for boxes
+// and the half extents along x and z for planes, a plane with a zero extent
+// is infinite and is tested outside the BVH.
+struct Primitive {
+  int mIndex;
+  std::string mName;
+  PrimitiveType mType = PrimitiveType::Sphere;
+  glm::vec3 mPosition = glm::vec3(0);
+  glm::vec3 mSize = glm::vec3(1);
+  glm::vec3 mRotation = glm::vec3(0);
+  Material mMaterial;
+
+  Primitive(const PrimitiveType type) {
+    mType = type;
+    mMaterial.setDiffuse(glm::vec3(0.8f));
+    if (type == PrimitiveType::Plane) {
+      mSize = glm::vec3(0.0f);
+      mPosition.y = -1.0f;
+    }
+  }
+
+  void setName() {
+    if (mType == PrimitiveType::Sphere)
+      mName = "Sphere_" + std::to_string(mIndex);
+    else if (mType == PrimitiveType::Plane)
+      mName = "Plane_" + std::to_string(mIndex);
+    else if (mType == PrimitiveType::Box)
+      mName = "Box_" + std::to_string(mIndex);
+  }
+
+  bool isGlobal() const {
+    return mType == PrimitiveType::Plane && (mSize.x <= 0.0f || mSize.z <= 0.0f);
+  }
+
+  glm::mat3 getRotationMatrix() const {
+    return glm::eulerAngleXYZ(glm::radians(mRotation.x),
+                              glm::radians(mRotation.y),
+                              glm::radians(mRotation.z));
+  }
+
+  void getBounds(glm::vec3 &minVert, glm::vec3 &maxVert) const {
+    glm::vec3 extent = glm::vec3(mSize.x);
+    if (mType != PrimitiveType::Sphere) {
+      glm::vec3 halfSize = mSize;
+      if (mType == PrimitiveType::Plane)
+        halfSize.y = 0.001f;
+      // World extent of the rotated box
+      glm::mat3 rotation = getRotationMatrix();
+      for (int i = 0; i < 3; i++) {
+        extent[i] = 0.0f;
+        for (int j = 0; j < 3; j++) {
+          extent[i] += glm::abs(rotation[j][i]) * halfSize[j];
+        }
+      }
+    }
+    minVert = mPosition - extent;
+    maxVert = mPosition + extent;
+  }
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Camera.h"
+#include "Scene.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Screen rectangle a single model edit can change, the union of the model's
+// old and new bounds projected into the traced target. With shadows the
+// bounds swept away from each light are added, shadows of the model land
+// there. Bounds are taken from the scene at each trace and compared at the
+// next edit.
+class RegionTracker {
+public:
+  RegionTracker() = default;
+
+  void snapshot(const Scene &scene);
+  // False unless exactly one model moved and nothing else did, region is
+  // x, y, width, height in target texels
+  bool changedRegion(const Scene &scene, const Camera &camera,
+                     float downsampleFactor, int width, int height,
+                     bool shadows, glm::ivec4 &region) const;
+
+private:
+  // Target rectangle of a world box, the whole target when it reaches
+  // behind the camera
+  glm::vec4 project(const glm::vec3 &minVert, const glm::vec3 &maxVert,
+                    const Camera &camera, float downsampleFactor, int width,
+                    int height) const;
+  // Target rectangle of a world box swept away from the light to infinity,
+  // the whole target when the sweep comes toward the camera
+  glm::vec4 projectShadow(const glm::vec3 &minVert, const glm::vec3 &maxVert,
+                          const Light &light, const Camera &camera,
+                          float downsampleFactor, int width,
+                          int height) const;
+  // Target texel of a view space point, or of the vanishing point of a view
+  // space direction
+  glm::vec2 toTexel(const glm::vec3 &local, const Camera &camera,
+                    float downsampleFactor) const;
+
+private:
+  std::vector<glm::vec3> mMinVerts;
+  std::vector<glm::vec3> mMaxVerts;
+  std::vector<Primitive> mPrimitives;
+};
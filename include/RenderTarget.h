@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Settings.h"
+
+#include <vector>
+
+// Framebuffer with color textures the ray tracer renders into, presented
+// to the window afterwards. Floating point targets hold sums of samples,
+// further attachments hold the guide buffers written alongside. Attachment
+// i receives fragment output outputs[i].
+class RenderTarget {
+public:
+  RenderTarget() = default;
+
+  void init(int width, int height, bool floatingPoint = false,
+            const std::vector<int> &outputs = {0}, bool depth = false);
+  void resize(int width, int height);
+  void setFilter(UpscaleFilter filter);
+
+  void bind();
+  void unbind();
+  void bindTexture(int unit, int attachment = 0);
+  // Write only image of a floating point target, for compute passes
+  void bindImage(int unit, int attachment = 0);
+  void clear();
+  // Mip levels average 2^level square tiles of the first attachment
+  void generateMipmaps();
+  void readLevel(int level, std::vector<float> &pixels, int &width,
+                 int &height, int attachment = 0);
+  // Replaces the first attachment, RGBA floats
+  void upload(const std::vector<float> &pixels);
+  void clean();
+
+  const int getWidth() const { return mWidth; }
+  const int getHeight() const { return mHeight; }
+
+private:
+  unsigned int mFBO = 0;
+  std::vector<unsigned int> mTextures;
+  unsigned int mDepthBuffer = 0;
+  int mWidth = 0;
+  int mHeight = 0;
+  bool mFloatingPoint = false;
+};
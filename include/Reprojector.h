@@ -0,0 +1,54 @@
+#pragma once
+
+#include "FeedbackBuffer.h"
+#include "RenderTarget.h"
+#include "Shader.h"
+#include "UBO.h"
+
+// Temporal reprojection, the previous frame's color and vis buffer are
+// splatted into the new view and the trace only shades pixels where that
+// surface is not hit again. Frames alternate between two history targets.
+class Reprojector {
+public:
+  Reprojector() = default;
+
+  void init(int width, int height);
+  // The previous frame can not be reused, e.g. after scene changes
+  void invalidate() { mValid = false; }
+
+  // Splats the previous frame and binds the new one for tracing, sets the
+  // trace shader's reprojection inputs. False when there was nothing to
+  // reproject and every pixel is traced.
+  bool begin(Shader &reprojectShader, Shader &traceShader, UBO &data,
+             const Settings &settings, int width, int height);
+  void end();
+
+  // Color of the last traced frame
+  void bindTexture(int unit) { mHistory[mCurrent].bindTexture(unit); }
+  // Vis buffer and shadow mask of the last traced frame
+  void bindVis(int visUnit, int shadowMaskUnit) {
+    mHistory[mCurrent].bindTexture(visUnit, 1);
+    mHistory[mCurrent].bindTexture(shadowMaskUnit, 2);
+  }
+  const int getWidth() const { return mHistory[mCurrent].getWidth(); }
+  const int getHeight() const { return mHistory[mCurrent].getHeight(); }
+  void setFilter(UpscaleFilter filter);
+  void clean();
+
+  // Share of pixels traced in the last measured frame
+  const float getTracedFraction() const { return mTracedFraction; }
+
+private:
+  void readCounter();
+
+private:
+  RenderTarget mHistory[2];
+  RenderTarget mReprojected;
+  FeedbackBuffer mCounters[2];
+  int mCounterPixels[2] = {0, 0};
+  unsigned int mPointsVAO = 0;
+  int mCurrent = 0;
+  int mFrame = 0;
+  bool mValid = false;
+  float mTracedFraction = 1.0f;
+};
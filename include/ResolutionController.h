@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Settings.h"
+
+// Picks the render scale, the traced fraction of the window per axis, that
+// keeps the GPU trace time within the frame budget. Trace time is taken to
+// grow with the traced pixel count.
+class ResolutionController {
+public:
+  ResolutionController() = default;
+
+  // A finished measurement of tracedPixels out of windowPixels
+  void update(double traceTime, int tracedPixels, int windowPixels,
+              const Settings &settings);
+  // Rounded to steps so the target is not resized every frame
+  const float getScale() const;
+
+private:
+  float mScale = 1.0f;
+  float mMinScale = 0.25f;
+};
@@ -1,7 +1,10 @@
 #pragma once
 
+#include "Camera.h"
 #include "Light.h"
 #include "Model.h"
+#include "Primitive.h"
+#include "Settings.h"
 #include <iostream>
 #include <memory>
 #include <vector>
@@ -12,9 +15,16 @@ public:
 
   void addModel(const std::string &modelName);
   void addLight(LightType type);
+  void addPrimitive(PrimitiveType type);
   bool removeModel(const int modelIndex);
   bool removeLight(const int lightIndex);
+  bool removePrimitive(const int primitiveIndex);
   void recalculate();
+  // Streamed scenes leave model triangles in their models and the chunk
+  // file, only primitive stand-ins are gathered
+  void setKeepTriangles(bool keep);
+  bool updateLOD(const Camera &camera, const Settings &settings);
+  bool exportTriangles(const std::string &path) const;
 
   // Model
   const int getModelCount() const { return mModels.size(); }
@@ -24,7 +34,11 @@ public:
 
   // Triangles
   const std::vector<Triangle> &getTriangles() const { return mTriangles; }
-  const int getTrianglesCount() const { return mTriangles.size(); }
+  const int getTrianglesCount() const { return mTriangleCount; }
+  const int getOriginalTrianglesCount() const { return mOriginalTriangles; }
+
+  // Level of detail
+  const float getLODError() const { return mLODError; }
 
   // Vertices
   const std::vector<Vertex> &getVertices() const { return mVertices; }
@@ -42,9 +56,15 @@ public:
   const int getLightsCount() const { return mLights.size(); }
   Light *getLight(int index);
 
+  // Primitives, materials follow the models as one mesh models
+  const std::vector<Primitive> &getPrimitives() const { return mPrimitives; }
+  const int getPrimitivesCount() const { return mPrimitives.size(); }
+  Primitive *getPrimitive(int index);
+
 private:
   static int sModelsIndex;
   static int sLightsIndex;
+  static int sPrimitivesIndex;
 
 private:
   std::vector<Model> mModels;
@@ -53,4 +73,9 @@ private:
   std::vector<Material> mMaterials;
   std::vector<int> mMaterialIndexes;
   std::vector<Light> mLights;
+  std::vector<Primitive> mPrimitives;
+  int mTriangleCount = 0;
+  int mOriginalTriangles = 0;
+  bool mKeepTriangles = true;
+  float mLODError = 0.0f;
 };
@@ -4,6 +4,7 @@
 #include "CoordinateSystem.h"
 #include "Scene.h"
 #include "Settings.h"
+#include "Stats.h"
 #include "imgui.h"
 
 #include <memory>
@@ -15,16 +16,21 @@ enum ChangeType {
   SettingsType,
   MaterialType,
   LightType,
-  BVHType
+  BVHType,
+  ShaderType,
+  ProxyType // a model is dragged, its bounding box stands in for it
 };
 
 class SceneEditor {
 public:
   SceneEditor(const std::string &modelsFolder, std::shared_ptr<Scene> scene,
               std::shared_ptr<Camera> camera,
-              std::shared_ptr<Settings> settings);
+              std::shared_ptr<Settings> settings,
+              std::shared_ptr<Stats> stats);
 
   ChangeType render(float fps, int dataSize);
+  // Model under a gizmo drag, its triangles are not moved until release
+  const Model *getProxyModel() const { return mProxyModel; }
 
 private:
   // Windows
@@ -34,6 +40,9 @@ private:
   ChangeType selectorWindow();
   ChangeType propertiesWindow();
   ChangeType settingsWindow();
+  bool streamingEdit();
+  bool lodEdit();
+  bool lazyEdit();
 
   // Refresh
   void refreshLoadedModels();
@@ -47,6 +56,7 @@ private:
   // Selector
   bool modelSelector();
   bool lightSelector();
+  bool primitiveSelector();
 
   // Handle loading/removing model
   void handleRemovingModel(int index);
@@ -60,6 +70,11 @@ private:
   bool handleLoadingLight();
   void loadLight();
 
+  // Handle adding/removing primitive
+  void handleRemovingPrimitive(int index);
+  bool removePrimitive();
+  bool handleLoadingPrimitive();
+
   // Modify model/light
   ChangeType editModel();
   bool scaleModel();
@@ -72,8 +87,18 @@ private:
   bool editPointLight();
   bool editDirectionalLight();
 
+  ChangeType editPrimitive();
+
   // Debug
   bool viewportTypeEdit();
+  bool upscaleFilterEdit();
+  void dynamicResolutionEdit();
+  bool timeSlicingEdit();
+  bool reprojectionEdit();
+  bool progressiveEdit();
+  bool cornerSamplingEdit();
+  bool interleaveEdit();
+  bool denoiseEdit();
   void viewSelected();
 
   // Coordinate system
@@ -83,12 +108,14 @@ private:
   bool handleScaleSystem(glm::vec3 &scale);
   bool handlePositionSystem(glm::vec3 &position);
   bool handleRotationSystem(glm::vec3 &rotation);
+  bool isDragging() const;
   ImVec2 worldToScreen(const glm::vec3 &worldPos);
 
 public:
   std::shared_ptr<Scene> mScene;
   std::shared_ptr<Settings> mSettings;
   std::shared_ptr<Camera> mCamera;
+  std::shared_ptr<Stats> mStats;
 
 private:
   // Available model
@@ -106,6 +133,10 @@ private:
   Light *mSelectedLight = nullptr;
   std::vector<const char *> mLoadedLightsList;
 
+  // Select primitive
+  int mSelectedPrimitiveIndex = -1;
+  Primitive *mSelectedPrimitive = nullptr;
+
   std::unique_ptr<CoordinateSystem> mCoordSystem;
   bool mDraggingX = false;
   bool mDraggingY = false;
@@ -113,4 +144,5 @@ private:
   bool mRotatingX = false;
   bool mRotatingY = false;
   bool mRotatingZ = false;
+  Model *mProxyModel = nullptr;
 };
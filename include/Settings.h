@@ -1,10 +1,91 @@
 #pragma once
 
+#include <algorithm>
+
+// Triangles per group in the CPU leaf kernel
+#define TRIANGLE_GROUP_SIZE 8
+
 enum ViewportMode { Flat = 0, Shaded, Wireframe };
+enum UpscaleFilter { Nearest = 0, Bilinear };
 
 struct Settings {
   int mMaxDepth = 10;
   int mMaxTrianglesInLeaf = 5;
+  bool mPadLeaves = false; // round leaves up to whole triangle groups
   ViewportMode mViewportMode = ViewportMode::Shaded;
-  int mDownsampleFactor = 1;
+  bool mStacklessTraversal = false; // shader define, needs a recompile
+  int mDownsampleFactor = 1; // rendered at 1/n of the window size
+  UpscaleFilter mUpscaleFilter = UpscaleFilter::Nearest;
+
+  // Dynamic resolution, replaces the downsample factor while the view moves
+  bool mDynamicResolution = false;
+  float mFrameBudget = 16.0f; // ms of trace time
+  float mMinRenderScale = 0.25f;
+
+  // Time slicing, the image is traced in tiles over several frames, each
+  // frame within the frame budget
+  bool mTimeSlicing = false;
+  int mTileSize = 64; // pixels
+
+  // Progressive accumulation while the view is static, stops once the noise
+  // of every tile is below the threshold
+  bool mProgressive = false;
+  float mNoiseThreshold = 0.5f; // standard error, 1/255 steps
+  int mMaxSamples = 1024;
+  // Adaptive sampling, after the base samples only noisy tiles are sampled,
+  // the budget counts pixel samples per frame in whole frames
+  bool mAdaptiveSampling = true;
+  int mBaseSamples = 8;
+  float mSampleBudget = 1.0f;
+
+  // A-trous denoiser on the accumulated image, run every interval samples
+  bool mDenoise = false;
+  int mDenoiseInterval = 4;
+  int mDenoiseIterations = 5;
+  float mDenoiseColorSigma = 1.0f;
+  float mDenoiseNormalSigma = 0.3f;
+  float mDenoiseDepthSigma = 0.05f; // relative to the distance
+
+  bool mShadows = true;
+  bool mRenderOnDemand = true; // trace only after changes
+  bool mRegionTrace = true;    // single model edits re-trace their bounds
+
+  // Interleaved rendering traces one pixel in this many per frame, 1 off, 2
+  // checkerboard or 4
+  int mInterleave = 1;
+
+  // Primary hits of pixel blocks whose corners agree skip traversal
+  bool mCornerSampling = false;
+  int mCornerBlock = 4; // pixels
+
+  // Dragged models are traced as their bounding box at a coarser resolution
+  bool mDragProxy = true;
+  int mDragDownsample = 2;
+
+  // Temporal reprojection, reuses the previous frame under camera motion and
+  // traces a share of the reusable pixels anyway
+  bool mReprojection = false;
+  float mRefreshFraction = 0.05f;
+
+  // Geometry streaming
+  bool mStreamGeometry = false;
+  int mChunkSize = 4096;
+  int mResidencyBudget = 256; // MB
+
+  // Lazy BVH, levels built per pass and expansions per frame
+  bool mLazyBVH = false;
+  int mLazyDepth = 6;
+  int mLazyExpandPerFrame = 8;
+
+  // Level of detail
+  bool mLOD = false;
+  int mLODThreshold = 400; // pixels, full detail above
+
+  const int getLeafSize() const {
+    if (!mPadLeaves)
+      return mMaxTrianglesInLeaf;
+    int groups = (mMaxTrianglesInLeaf + TRIANGLE_GROUP_SIZE - 1) /
+                 TRIANGLE_GROUP_SIZE;
+    return std::max(groups, 1) * TRIANGLE_GROUP_SIZE;
+  }
 };
@@ -1,15 +1,30 @@
 #pragma once
 
+#include <glm/glm.hpp>
+
 #include <string>
+#include <vector>
 
 class Shader {
 public:
-  Shader(const char *vertexShaderPath, const char *fragmentShaderPath);
+  // Defines are added to both stages after the #version line
+  Shader(const char *vertexShaderPath, const char *fragmentShaderPath,
+         const std::vector<std::string> &defines = {});
+  // Single compute stage
+  Shader(const char *computeShaderPath,
+         const std::vector<std::string> &defines);
   void use();
+  void setInt(const char *name, int value);
+  void setFloat(const char *name, float value);
+  void setIVec2(const char *name, const glm::ivec2 &value);
+  void setVec3(const char *name, const glm::vec3 &value);
+  void setMat3(const char *name, const glm::mat3 &value);
   const unsigned int getID() const { return mID; }
 
 private:
   std::string readShaderFile(const char *filePath);
+  std::string addDefines(const std::string &code,
+                         const std::vector<std::string> &defines);
 
 private:
   unsigned int mID;
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Sizes and bindings shared by the shaders and the CPU side. The shaders
+// get them as defines, see shaderConstants().
+
+// Traversal stack entries of the fragment trace shader, compute groups pick
+// at most as many
+#define TRACE_STACK_SIZE 100
+
+// Storage buffer bindings next to the data buffer at 0
+#define FEEDBACK_BINDING 1
+#define COUNTER_BINDING 2
+
+// Pixels per side of the tiles samples are counted and budgeted for, the
+// resolved image has one texel per tile at mip level ACCUMULATION_TILE_LEVEL
+#define ACCUMULATION_TILE_LEVEL 4
+#define ACCUMULATION_TILE_SIZE (1 << ACCUMULATION_TILE_LEVEL)
+
+// Defines of the shared constants under their shader names, the stack size
+// is added per stage
+inline std::vector<std::string> shaderConstants() {
+  return {"FEEDBACK_BINDING " + std::to_string(FEEDBACK_BINDING),
+          "COUNTER_BINDING " + std::to_string(COUNTER_BINDING),
+          "TILE_SIZE " + std::to_string(ACCUMULATION_TILE_SIZE)};
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+struct SimplifiedMesh {
+  std::vector<glm::vec3> mPositions;
+  std::vector<int> mIndices;
+  // Bound on how far the surface moved, object space distance. Each
+  // collapse adds its target's distance from the planes around the edge to
+  // the larger bound of its two vertices.
+  float mError = 0.0f;
+};
+
+namespace Simplifier {
+// Quadric edge collapse (Garland-Heckbert). Vertices sharing a position are
+// welded first so split normals/uvs do not block collapses.
+SimplifiedMesh simplify(const std::vector<glm::vec3> &positions,
+                        const std::vector<int> &indices, int targetTriangles);
+} // namespace Simplifier
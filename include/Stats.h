@@ -0,0 +1,57 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <map>
+
+struct Stats {
+  // GPU trace time by downsample factor, ms
+  std::map<int, double> mTraceTimes;
+  double mTraceTime = 0.0; // ms, last measured
+  double mFrameTime = 0.0; // ms
+  float mRenderScale = 1.0f;
+  int mRenderWidth = 0;
+  int mRenderHeight = 0;
+  float mTracedFraction = 1.0f; // under reprojection
+  // Time slicing
+  int mTilesPerFrame = 0;
+  int mTilesDone = 0;
+  int mTileCount = 0;
+  float mBudgetUsed = 0.0f; // share of the frame budget, last measured
+  int mRegionPixels = 0;        // re-traced by the last model edit
+  bool mInterleaveSettling = false;
+  // Corner sampling, error against per pixel tracing when last compared
+  float mCornerSkipped = 0.0f; // share of pixels not traversing
+  float mCornerError = 0.0f;   // mean per channel, 0-255
+  float mCornerErrorPixels = 0.0f;
+  // Compute backend, zero groups on the fragment one. Whole traces of both
+  // when last compared, ms.
+  glm::ivec2 mComputeGroupSize = glm::ivec2(0);
+  double mFragmentTraceTime = 0.0;
+  double mComputeTraceTime = 0.0;
+
+  // Progressive accumulation
+  float mSamples = 0.0f; // per pixel on average
+  int mActiveTiles = 0;
+  double mSamplesPerSecond = 0.0;
+  double mAccumulationTime = 0.0; // s, time to converge once converged
+  float mNoise = 0.0f;            // 1/255 steps
+  bool mConverged = false;
+  double mDenoiseTime = 0.0;       // ms, filter only
+  double mDenoiseTotalTime = 0.0;  // ms, with readback and upload
+
+  // BVH
+  double mBVHBuildTime = 0.0; // ms
+  int mBVHNodes = 0;
+  int mUnbuiltNodes = 0;
+
+  // Geometry streaming
+  int mChunkCount = 0;
+  int mVisibleChunks = 0;
+  int mCasterChunks = 0;  // outside the view, kept for shadows
+  int mDroppedChunks = 0; // over the buffer budget
+  int mResidentChunks = 0;
+  size_t mResidentBytes = 0;
+  float mCacheHitRate = 0.0f;
+};
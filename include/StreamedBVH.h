@@ -0,0 +1,114 @@
+#pragma once
+
+#include "BVHNode.h"
+#include "Settings.h"
+
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#define BVH_FILE_MAGIC 0x33425452 // "RTB3", 64 bit counts, integer fields
+
+// The header is followed by the vertex floats, the node table as 64 bit
+// offsets into the node section and the nodes. Integer node fields (child
+// ids, split axis, triangle counts and record indices) hold int32 bits in
+// their 32 bit slot, bounds and normals are floats.
+struct BVHFileHeader {
+  int mMagic;
+  int mReserved = 0;
+  long long mVertexFloatCount;
+  long long mNodeCount;
+  long long mNodeSlotCount;
+};
+
+// Slot holding the bits of an integer node field
+inline float packBVHInt(int value) {
+  float slot;
+  std::memcpy(&slot, &value, sizeof(float));
+  return slot;
+}
+inline int unpackBVHInt(float slot) {
+  int value;
+  std::memcpy(&value, &slot, sizeof(int));
+  return value;
+}
+
+struct StreamedBVHStats {
+  long long mTriangleCount = 0;
+  int mBucketCount = 0;
+  long long mNodeCount = 0;
+  double mBuildTime = 0.0; // seconds
+  size_t mPeakMemory = 0;  // bytes
+};
+
+// Builds a BVH over a raw triangle file (Triangle records, as written by
+// ChunkCache) without holding all triangles in memory. Triangles are binned
+// by centroid into bucket files, buckets over the memory budget are halved
+// on disk, every bucket gets its own subtree and a small top tree joins the
+// bucket roots. The result is in the data buffer layout with exact
+// integers, Data::loadBVH converts them when the file fits the buffer.
+class StreamedBVH {
+public:
+  StreamedBVH(const std::string &workFolder, size_t memoryBudget);
+
+  bool build(const std::string &trianglePath, const std::string &outputPath,
+             const Settings &settings);
+
+  const StreamedBVHStats &getStats() const { return mStats; }
+
+private:
+  struct Bucket {
+    long long mTriangleCount = 0;
+    glm::vec3 mMaxVert = glm::vec3(-std::numeric_limits<float>::max());
+    glm::vec3 mMinVert = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 mMaxCenter = glm::vec3(-std::numeric_limits<float>::max());
+    glm::vec3 mMinCenter = glm::vec3(std::numeric_limits<float>::max());
+    int mRootID;
+  };
+
+  struct TopNode {
+    int mLeftID;
+    int mRightID;
+    int mSplitAxis;
+    glm::vec3 mMaxVert;
+    glm::vec3 mMinVert;
+  };
+
+  bool computeBounds(std::ifstream &input, int leafSize);
+  bool distribute(std::ifstream &input);
+  bool splitBuckets();
+  // Moves the triangles of a bucket into two new ones, split at the middle
+  // of its centroid bounds or by count when all centroids coincide
+  bool splitBucket(int index);
+  void addTriangle(Bucket &bucket, const Triangle &triangle);
+  // Subtree depth for leaves of about leafSize triangles
+  static int bucketDepth(long long triangleCount, int leafSize);
+  // Bytes a bucket subtree build holds
+  static size_t bucketMemory(long long triangleCount, int leafSize);
+  bool buildBuckets(const Settings &settings);
+  void buildTopTree();
+  int buildTopNode(std::vector<int> &buckets, int begin, int end);
+  bool writeOutput(const std::string &outputPath);
+
+  void writeNode(BVHNode *node, std::vector<float> &floats);
+  std::string bucketPath(int bucket) const;
+  int bucketIndex(const glm::vec3 &center) const;
+
+private:
+  std::string mWorkFolder;
+  size_t mMemoryBudget;
+  long long mBatchSize;
+
+  glm::vec3 mMaxCenter;
+  glm::vec3 mMinCenter;
+  int mBucketsPerAxis;
+  // Most triangles a bucket may hold for its subtree to fit the budget
+  long long mBucketLimit;
+  std::vector<Bucket> mBuckets;
+  std::vector<TopNode> mTopNodes;
+  int mRootID;
+
+  StreamedBVHStats mStats;
+};
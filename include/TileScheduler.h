@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Settings.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Splits the trace of one image into square tiles spread over frames, each
+// frame takes as many as fit the frame budget so the editor stays
+// responsive. Tiles go from the center outwards, the cost per pixel comes
+// from the measured trace times.
+class TileScheduler {
+public:
+  TileScheduler() = default;
+
+  // Starts a new image of the target
+  void reset(int width, int height, int tileSize);
+  // A finished measurement of tracedPixels
+  void update(double traceTime, int tracedPixels);
+  // Tiles of this frame as x, y, width, height, at least one while any
+  // are left
+  void next(const Settings &settings, std::vector<glm::ivec4> &tiles);
+
+  const bool isDone() const { return mNext >= mTiles.size(); }
+  const int getTileCount() const { return mTiles.size(); }
+  const int getDoneCount() const { return mNext; }
+
+private:
+  std::vector<glm::ivec4> mTiles;
+  int mNext = 0;
+  double mTimePerPixel = 0.0; // ms
+};
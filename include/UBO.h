@@ -9,6 +9,8 @@ public:
   void init(const Data &data);
 
   void update(const Data &newData);
+  // Uploads only floats [offset, offset + count)
+  void update(const Data &newData, int offset, int count);
   void bind();
   void unbind();
   void clean();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <fstream>
 #include <string>
 
 namespace Utils {
@@ -13,4 +14,17 @@ inline std::string extractFilename(const std::string &filePath) {
   }
 }
 
+// Peak resident set size of the process in bytes, 0 when unavailable
+inline size_t peakMemoryUsage() {
+#ifdef __linux__
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmHWM:", 0) == 0)
+      return std::stoull(line.substr(6)) * 1024;
+  }
+#endif
+  return 0;
+}
+
 } // namespace Utils
@@ -0,0 +1,14 @@
+#version 430
+
+in vec2 TexCoord;
+
+out vec4 FragColor;
+
+// Ray traced image, one texel per downsampleFactor x downsampleFactor block
+uniform sampler2D uImage;
+uniform float uDownsampleFactor;
+
+void main() {
+  vec2 uv = gl_FragCoord.xy / (uDownsampleFactor * vec2(textureSize(uImage, 0)));
+  FragColor = vec4(texture(uImage, uv).rgb, 1.0);
+}
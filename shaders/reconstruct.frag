@@ -0,0 +1,109 @@
+#version 430
+
+layout(location = 0) out vec4 FragColor;
+
+// Fills the pixels the interleaved trace left out this frame. Their older
+// sample stays while it still lies on the pixel's ray on a surface the
+// traced neighbors see, otherwise the neighbors on the nearest surface are
+// averaged.
+layout(std430, binding = 0) buffer Data
+{
+  float mData[];
+};
+
+uniform sampler2D uColor;
+uniform sampler2D uVis;
+// Traced pixels are one in uInterleave, those of phase uPhase
+uniform int uInterleave;
+uniform int uPhase;
+
+int REAL_SETTINGS_OFFSET = 10;
+int REAL_CAMERA_OFFSET = 20;
+// Older samples may lie this many texels off the ray
+float REUSE_TEXELS = 0.75;
+// Neighbors within this share of the nearest distance are the same surface
+float DEPTH_TOLERANCE = 0.05;
+
+int phase(ivec2 pixel) {
+  if (uInterleave == 2)
+    return (pixel.x + pixel.y) & 1;
+  return (pixel.x & 1) + 2 * (pixel.y & 1);
+}
+
+bool isHit(int id) {
+  return id != 0 && id != -1;
+}
+
+void main() {
+  ivec2 size = textureSize(uColor, 0);
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  vec4 color = texelFetch(uColor, pixel, 0);
+  if (uInterleave <= 1 || phase(pixel) == uPhase) {
+    FragColor = vec4(color.rgb, 1.0);
+    return;
+  }
+
+  int offset = REAL_CAMERA_OFFSET;
+  float fov = mData[offset];
+  float aspectRatio = mData[offset + 1];
+  vec2 resolution = vec2(mData[offset + 2], mData[offset + 3]);
+  vec3 position = vec3(mData[offset + 4], mData[offset + 5], mData[offset + 6]);
+  offset += 7;
+  mat3 matrix = mat3(mData[offset], mData[offset + 1], mData[offset + 2], mData[offset + 3], mData[offset + 4], mData[offset + 5], mData[offset + 6], mData[offset + 7], mData[offset + 8]);
+  float downsampleFactor = mData[REAL_SETTINGS_OFFSET];
+
+  // Same ray as calculateRayDirection in the trace
+  float focal = 1.0 / tan(0.5 * radians(fov));
+  vec2 ndc = gl_FragCoord.xy * downsampleFactor / resolution * 2.0 - 1.0;
+  ndc.x *= aspectRatio;
+  vec3 direction = normalize(matrix * vec3(ndc, -focal));
+
+  vec4 vis = texelFetch(uVis, pixel, 0);
+  int id = int(vis.w);
+  bool idSeen = false;
+  float nearest = 1e30;
+  for (int y = -1; y <= 1; y++) {
+    for (int x = -1; x <= 1; x++) {
+      ivec2 neighbor = pixel + ivec2(x, y);
+      if (any(lessThan(neighbor, ivec2(0))) || any(greaterThanEqual(neighbor, size)) || phase(neighbor) != uPhase)
+        continue;
+      vec4 neighborVis = texelFetch(uVis, neighbor, 0);
+      int neighborId = int(neighborVis.w);
+      idSeen = idSeen || neighborId == id;
+      if (isHit(neighborId))
+        nearest = min(nearest, distance(position, neighborVis.xyz));
+    }
+  }
+
+  if (idSeen && id == -1) {
+    FragColor = vec4(color.rgb, 1.0);
+    return;
+  }
+  if (idSeen && isHit(id)) {
+    vec3 toSample = vis.xyz - position;
+    float along = dot(toSample, direction);
+    float texel = along * 2.0 * downsampleFactor / (resolution.y * focal);
+    if (along > 0.0 && length(toSample - along * direction) < REUSE_TEXELS * texel) {
+      FragColor = vec4(color.rgb, 1.0);
+      return;
+    }
+  }
+
+  // Misses only count when every neighbor missed
+  vec3 sum = vec3(0.0);
+  float weight = 0.0;
+  for (int y = -1; y <= 1; y++) {
+    for (int x = -1; x <= 1; x++) {
+      ivec2 neighbor = pixel + ivec2(x, y);
+      if (any(lessThan(neighbor, ivec2(0))) || any(greaterThanEqual(neighbor, size)) || phase(neighbor) != uPhase)
+        continue;
+      vec4 neighborVis = texelFetch(uVis, neighbor, 0);
+      bool hit = isHit(int(neighborVis.w));
+      if (nearest < 1e30 && (!hit || distance(position, neighborVis.xyz) > nearest * (1.0 + DEPTH_TOLERANCE)))
+        continue;
+      sum += texelFetch(uColor, neighbor, 0).rgb;
+      weight += 1.0;
+    }
+  }
+  FragColor = vec4(weight > 0.0 ? sum / weight : color.rgb, 1.0);
+}
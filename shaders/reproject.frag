@@ -0,0 +1,15 @@
+#version 430
+
+flat in vec3 vColor;
+flat in vec4 vVis;
+flat in float vShadowMask;
+
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 FragVis;
+layout(location = 2) out vec4 FragShadowMask;
+
+void main() {
+  FragColor = vec4(vColor, 1.0);
+  FragVis = vVis;
+  FragShadowMask = vec4(vShadowMask, 0.0, 0.0, 0.0);
+}
@@ -0,0 +1,55 @@
+#version 430
+
+// One point per texel of the previous frame, moved to where its surface
+// lands in the current camera
+layout(std430, binding = 0) buffer Data
+{
+  float mData[];
+};
+
+uniform sampler2D uColor;
+uniform sampler2D uVis;
+uniform sampler2D uShadowMask;
+
+flat out vec3 vColor;
+flat out vec4 vVis;
+flat out float vShadowMask;
+
+int REAL_SETTINGS_OFFSET = 10;
+int REAL_CAMERA_OFFSET = 20;
+
+void main() {
+  // Outside the clip volume unless something is splatted
+  gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+
+  ivec2 size = textureSize(uVis, 0);
+  ivec2 texel = ivec2(gl_VertexID % size.x, gl_VertexID / size.x);
+  vec4 vis = texelFetch(uVis, texel, 0);
+  int id = int(vis.w);
+  if (id == 0 || id == -1)
+    return;
+
+  int offset = REAL_CAMERA_OFFSET;
+  float fov = mData[offset];
+  float aspectRatio = mData[offset + 1];
+  vec2 resolution = vec2(mData[offset + 2], mData[offset + 3]);
+  vec3 position = vec3(mData[offset + 4], mData[offset + 5], mData[offset + 6]);
+  offset += 7;
+  mat3 matrix = mat3(mData[offset], mData[offset + 1], mData[offset + 2], mData[offset + 3], mData[offset + 4], mData[offset + 5], mData[offset + 6], mData[offset + 7], mData[offset + 8]);
+  float downsampleFactor = mData[REAL_SETTINGS_OFFSET];
+
+  // Inverse of calculateRayDirection, the camera matrix is orthonormal
+  vec3 view = transpose(matrix) * (vis.xyz - position);
+  if (view.z >= 0.0)
+    return;
+  float focal = 1.0 / tan(0.5 * radians(fov));
+  vec2 ndc = vec2(view.x / aspectRatio, view.y) * focal / -view.z;
+  vec2 targetCoords = (ndc * 0.5 + 0.5) * resolution / downsampleFactor;
+
+  // Nearest surface wins, no far plane needed
+  float distance = length(view);
+  gl_Position = vec4(targetCoords / vec2(size) * 2.0 - 1.0, distance / (distance + 1.0) * 2.0 - 1.0, 1.0);
+  vColor = texelFetch(uColor, texel, 0).rgb;
+  vVis = vis;
+  vShadowMask = texelFetch(uShadowMask, texel, 0).r;
+}
@@ -0,0 +1,39 @@
+#version 430
+
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 FragNormalDepth;
+layout(location = 2) out vec4 FragAlbedo;
+
+// Summed samples, rgb colors and squared luminance in alpha, then the
+// denoiser guides
+uniform sampler2D uSums;
+uniform sampler2D uNormalDepthSums;
+uniform sampler2D uAlbedoSums;
+// Samples taken per tile in red
+uniform sampler2D uTileSamples;
+
+// TILE_SIZE is defined by the application
+const vec3 LUMINANCE = vec3(0.2126, 0.7152, 0.0722);
+
+void main() {
+  // The target is padded to whole tiles, padding repeats the edge color and
+  // adds no noise
+  ivec2 size = textureSize(uSums, 0);
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  ivec2 clamped = min(pixel, size - 1);
+  float samples = texelFetch(uTileSamples, clamped / TILE_SIZE, 0).r;
+  vec4 sums = texelFetch(uSums, clamped, 0);
+  vec3 color = sums.rgb / max(samples, 1.0);
+  FragNormalDepth = texelFetch(uNormalDepthSums, clamped, 0) / max(samples, 1.0);
+  FragAlbedo = texelFetch(uAlbedoSums, clamped, 0) / max(samples, 1.0);
+  if (pixel != clamped || samples < 2.0) {
+    FragColor = vec4(color, 0.0);
+    return;
+  }
+
+  // Variance of the mean over the samples taken so far
+  float mean = dot(color, LUMINANCE);
+  float meanSquare = sums.a / samples;
+  float variance = max(meanSquare - mean * mean, 0.0) / samples;
+  FragColor = vec4(color, variance);
+}
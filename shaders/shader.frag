@@ -2,6 +2,8 @@
  
 int BVH_OFFSET = 0;
 int MATERIAL_OFFSET = 1;
+int PRIMITIVE_OFFSET = 2;
+int SKIP_OFFSET = 3;
 
 int REAL_SETTINGS_OFFSET = 10;
 int REAL_CAMERA_OFFSET = 20;
@@ -11,10 +13,24 @@ int REAL_VERTICES_OFFSET = 140;
 int POINT_LIGHT = 0;
 int DIRECTIONAL_LIGHT = 1;
 
+float UNBUILT_LEAF = 2.0f;
+
+// STACK_SIZE, TILE_SIZE and the buffer bindings are defined by the
+// application, see ShaderConstants.h
+
+// Shadow rays start off the surface, shadowed lights keep a little light
+float SHADOW_BIAS = 0.001f;
+float SHADOW_FACTOR = 0.2f;
+
 int VIEWPORT_FLAT = 0;
 int VIEWPORT_SHADED = 1;
 int VIEWPORT_WIREFRAME = 2;
 
+int PRIMITIVE_SPHERE = 0;
+int PRIMITIVE_PLANE = 1;
+int PRIMITIVE_BOX = 2;
+int primitiveSize = 17;
+
 struct Ray {
   vec3 mOrigin;
   vec3 mDirection;
@@ -25,6 +41,7 @@ struct Vertex {
 int vertexSize = 3;
 
 struct Triangle {
+  int mRecord; // vis buffer id, see recordID
   int mModelIndex;
   int mMeshIndex;
   int mIndices[3];
@@ -32,6 +49,14 @@ struct Triangle {
   vec3 mNormal;
 };
 
+struct Primitive {
+  int mType;
+  int mModelIndex;
+  vec3 mPosition;
+  vec3 mSize;
+  mat3 mRotation;
+};
+
 struct Material {
   vec3 mDiffuse;
   //vec3 mAmbient;
@@ -52,7 +77,8 @@ struct Camera {
 
 struct Settings {
   int mViewportMode;
-  int mDownsampleFactor;
+  float mDownsampleFactor;
+  bool mShadows;
 };
 
 struct Light {
@@ -76,7 +102,102 @@ layout(std430, binding = 0) buffer Data
   float mData[10000000];
 };
 
-out vec4 FragColor;
+// Per node hit counts of unbuilt lazy nodes
+layout(std430, binding = FEEDBACK_BINDING) buffer Feedback
+{
+  int mFeedback[];
+};
+
+#ifdef COMPUTE
+// Compiled as a compute stage, one invocation per pixel of the rectangle
+// uRectOffset, uRectSize of the target. Color, vis and shadow mask are
+// stored to its images, the other outputs are dropped.
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y) in;
+layout(rgba32f, binding = 0) uniform writeonly image2D uColorImage;
+layout(rgba32f, binding = 1) uniform writeonly image2D uVisImage;
+layout(rgba32f, binding = 2) uniform writeonly image2D uShadowMaskImage;
+uniform ivec2 uRectOffset;
+uniform ivec2 uRectSize;
+vec4 FragColor;
+vec4 FragNormalDepth;
+vec4 FragAlbedo;
+vec4 FragVis;
+vec4 FragShadowMask;
+// Traversal stacks in shared memory, a STACK_SIZE slice per invocation
+// instead of a per thread array spilled to scratch memory
+shared int sStacks[LOCAL_SIZE_X * LOCAL_SIZE_Y * STACK_SIZE];
+#define STACK(i) sStacks[int(gl_LocalInvocationIndex) * STACK_SIZE + (i)]
+#define DECLARE_STACK
+// Skipped pixels keep what the image held
+#define DISCARD return false
+#else
+// Guides for the denoiser and the vis buffer for reprojection, only kept by
+// targets with the attachments
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 FragNormalDepth;
+layout(location = 2) out vec4 FragAlbedo;
+layout(location = 3) out vec4 FragVis;
+layout(location = 4) out vec4 FragShadowMask;
+#define STACK(i) stack[i]
+#define DECLARE_STACK int stack[STACK_SIZE]
+#define DISCARD discard
+#endif
+// Center of the traced pixel in target texels
+vec2 fragCoord;
+// Set when a hierarchy deeper than STACK_SIZE dropped nodes, the pixel shows
+// STACK_OVERFLOW_COLOR instead of a silently wrong image
+bool stackOverflowed = false;
+vec3 STACK_OVERFLOW_COLOR = vec3(1.0, 0.0, 1.0);
+
+// Pixels traced while reprojecting, the rest reuse the previous frame
+layout(std430, binding = COUNTER_BINDING) buffer Counters
+{
+  int mTracedPixels;
+};
+
+// Previous frame splatted into this view, color and vis. Vis holds the
+// world position and the record id: leaf record offset of a triangle,
+// -2 - index of a primitive, -1 for a miss and 0 where nothing landed.
+uniform bool uReproject;
+uniform sampler2D uReprojectedColor;
+uniform sampler2D uReprojectedVis;
+uniform sampler2D uReprojectedShadowMask;
+// Share of reusable pixels traced anyway, so stale ones are refreshed
+uniform float uRefreshFraction;
+uniform int uFrame;
+// Shading only, from the vis buffer and shadow mask of the last trace.
+// Shadow rays are traced again when lights moved.
+uniform bool uReshade;
+uniform bool uReshadeShadows;
+uniform sampler2D uVis;
+uniform sampler2D uShadowMask;
+// Model dragged in the editor, traced as its transformed bounding box in
+// place of its triangles until the drag ends
+uniform bool uProxy;
+uniform int uProxyModel;
+uniform vec3 uProxyPosition;
+uniform vec3 uProxySize;
+uniform mat3 uProxyRotation;
+// Corner sampling, a first pass traces the vis id at the corners of
+// uCornerBlock square pixel blocks. Blocks whose four corners agree only
+// intersect that record, the others traverse the BVH.
+uniform bool uCornerTrace;
+uniform bool uCornerInterpolate;
+uniform int uCornerBlock;
+uniform sampler2D uCorners;
+// Interleaved rendering traces one pixel in uInterleave, those of phase
+// uPhase, reconstruct.frag fills the rest
+uniform int uInterleave;
+uniform int uPhase;
+// Reused pixels must hit their record within this share of the distance
+float REPROJECT_TOLERANCE = 0.05;
+
+// Progressive samples are jittered and only taken in the tiles the pass
+// picked, green flags them, red counts their samples so far
+uniform bool uAccumulate;
+uniform sampler2D uTileSamples;
+
+vec3 LUMINANCE = vec3(0.2126, 0.7152, 0.0722);
 
 bool getBool(inout int offset) {
   bool bol = mData[offset] != 0.0f;
@@ -115,6 +236,7 @@ Vertex getVertex(inout int offset) {
 }
 Triangle getTriangle(inout int offset) {
   Triangle triangle;
+  triangle.mRecord = offset;
   triangle.mModelIndex = getInt(offset);
   triangle.mMeshIndex = getInt(offset);
   triangle.mIndices[0] = getInt(offset);
@@ -122,6 +244,10 @@ Triangle getTriangle(inout int offset) {
   triangle.mIndices[2] = getInt(offset);
   triangle.mNormal = getVec3(offset);
 
+  // Primitive stand-in, no vertices
+  if (triangle.mIndices[0] < 0)
+    return triangle;
+
   int verticesOffset = REAL_VERTICES_OFFSET;
   for (int i = 0; i < 3; i++) {
     int vertOffset = verticesOffset + triangle.mIndices[i] * vertexSize;
@@ -129,6 +255,18 @@ Triangle getTriangle(inout int offset) {
   }
   return triangle;
 }
+Primitive getPrimitive(int index) {
+  int primitivesOffset = int(mData[PRIMITIVE_OFFSET]);
+  int globalCount = int(mData[primitivesOffset + 1]);
+  int offset = primitivesOffset + 2 + globalCount + index * primitiveSize;
+  Primitive primitive;
+  primitive.mType = getInt(offset);
+  primitive.mModelIndex = getInt(offset);
+  primitive.mPosition = getVec3(offset);
+  primitive.mSize = getVec3(offset);
+  primitive.mRotation = getMat3(offset);
+  return primitive;
+}
 BoundingBox getAABB(inout int offset) {
   BoundingBox aabb;
   aabb.mMaxVert = getVec3(offset);
@@ -143,8 +281,9 @@ Material getMaterial(inout int offset) {
 }
 Settings getSettings(inout int offset) {
   Settings settings;
-  settings.mDownsampleFactor = getInt(offset);
+  settings.mDownsampleFactor = getFloat(offset);
   settings.mViewportMode = getInt(offset);
+  settings.mShadows = getFloat(offset) != 0.0f;
   return settings;
 }
 Camera getCamera(inout int offset) {
@@ -174,7 +313,7 @@ float findMaxComponent(vec3 vector) {
   return max(max(vector.x, vector.y), vector.z);
 }
 
-bool intersectRayAABB(Ray ray, BoundingBox aabb) {
+bool intersectRayAABB(Ray ray, BoundingBox aabb, out float outTNear) {
   vec3 invDir = 1.0f / ray.mDirection;
   vec3 t1 = (aabb.mMinVert - ray.mOrigin) * invDir;
   vec3 t2 = (aabb.mMaxVert - ray.mOrigin) * invDir;
@@ -182,6 +321,7 @@ bool intersectRayAABB(Ray ray, BoundingBox aabb) {
   float tNear = findMaxComponent(min(t1, t2));
   float tFar = findMinComponent(max(t1, t2));
 
+  outTNear = tNear;
   return tNear <= tFar && tFar >= 0;
 }
 
@@ -217,6 +357,135 @@ bool intersectRayTriangle(Ray ray, Triangle triangle, out float outT) {
   return false;
 }
 
+bool intersectRaySphere(vec3 origin, vec3 direction, float radius, out float outT, out vec3 outNormal) {
+  float b = dot(origin, direction);
+  float c = dot(origin, origin) - radius * radius;
+  float discriminant = b * b - c;
+  if (discriminant < 0.0f)
+    return false;
+  float root = sqrt(discriminant);
+  outT = -b - root;
+  if (outT <= 0.000001f)
+    outT = -b + root;
+  if (outT <= 0.000001f)
+    return false;
+  outNormal = (origin + direction * outT) / radius;
+  return true;
+}
+
+bool intersectRayPlane(vec3 origin, vec3 direction, vec3 size, out float outT, out vec3 outNormal) {
+  if (abs(direction.y) < 0.000001f)
+    return false;
+  outT = -origin.y / direction.y;
+  if (outT <= 0.000001f)
+    return false;
+  vec3 hit = origin + direction * outT;
+  // Zero extent -> infinite
+  if (size.x > 0.0f && abs(hit.x) > size.x)
+    return false;
+  if (size.z > 0.0f && abs(hit.z) > size.z)
+    return false;
+  outNormal = vec3(0.0f, direction.y > 0.0f ? -1.0f : 1.0f, 0.0f);
+  return true;
+}
+
+bool intersectRayBox(vec3 origin, vec3 direction, vec3 size, out float outT, out vec3 outNormal) {
+  vec3 invDir = 1.0f / direction;
+  vec3 t1 = (-size - origin) * invDir;
+  vec3 t2 = (size - origin) * invDir;
+  float tNear = findMaxComponent(min(t1, t2));
+  float tFar = findMinComponent(max(t1, t2));
+  if (tNear > tFar || tFar <= 0.000001f)
+    return false;
+  outT = tNear > 0.000001f ? tNear : tFar;
+
+  // Face normal from the dominant axis of the hit point
+  vec3 hit = (origin + direction * outT) / size;
+  vec3 absHit = abs(hit);
+  if (absHit.x >= absHit.y && absHit.x >= absHit.z)
+    outNormal = vec3(sign(hit.x), 0.0f, 0.0f);
+  else if (absHit.y >= absHit.z)
+    outNormal = vec3(0.0f, sign(hit.y), 0.0f);
+  else
+    outNormal = vec3(0.0f, 0.0f, sign(hit.z));
+  return true;
+}
+
+bool intersectRayPrimitive(Ray ray, Primitive primitive, out float outT, out vec3 outNormal) {
+  // Primitive space, rotation is orthonormal
+  mat3 inverseRotation = transpose(primitive.mRotation);
+  vec3 origin = inverseRotation * (ray.mOrigin - primitive.mPosition);
+  vec3 direction = inverseRotation * ray.mDirection;
+
+  bool hit = false;
+  vec3 normal;
+  if (primitive.mType == PRIMITIVE_SPHERE)
+    hit = intersectRaySphere(origin, direction, primitive.mSize.x, outT, normal);
+  else if (primitive.mType == PRIMITIVE_PLANE)
+    hit = intersectRayPlane(origin, direction, primitive.mSize, outT, normal);
+  else if (primitive.mType == PRIMITIVE_BOX)
+    hit = intersectRayBox(origin, direction, primitive.mSize, outT, normal);
+
+  outNormal = primitive.mRotation * normal;
+  return hit;
+}
+
+Triangle primitiveTriangle(Primitive primitive, int index, vec3 normal) {
+  Triangle triangle;
+  triangle.mRecord = -2 - index;
+  triangle.mModelIndex = primitive.mModelIndex;
+  triangle.mMeshIndex = 0;
+  triangle.mIndices[0] = -1;
+  triangle.mIndices[1] = index;
+  triangle.mIndices[2] = 0;
+  triangle.mNormal = normal;
+  return triangle;
+}
+
+// Unbounded primitives are not part of the BVH
+void intersectGlobalPrimitives(Ray ray, inout float closestT, inout Triangle closestTriangle) {
+  int primitivesOffset = int(mData[PRIMITIVE_OFFSET]);
+  int globalCount = int(mData[primitivesOffset + 1]);
+  for (int i = 0; i < globalCount; i++) {
+    int index = int(mData[primitivesOffset + 2 + i]);
+    Primitive primitive = getPrimitive(index);
+    float t;
+    vec3 normal;
+    if (intersectRayPrimitive(ray, primitive, t, normal) && t < closestT) {
+      closestT = t;
+      closestTriangle = primitiveTriangle(primitive, index, normal);
+    }
+  }
+}
+
+Primitive proxyPrimitive() {
+  Primitive primitive;
+  primitive.mType = PRIMITIVE_BOX;
+  primitive.mModelIndex = uProxyModel;
+  primitive.mPosition = uProxyPosition;
+  primitive.mSize = uProxySize;
+  primitive.mRotation = uProxyRotation;
+  return primitive;
+}
+
+bool hiddenByProxy(Triangle triangle) {
+  return uProxy && triangle.mIndices[0] >= 0 && triangle.mModelIndex == uProxyModel;
+}
+
+void intersectProxy(Ray ray, inout float closestT, inout Triangle closestTriangle) {
+  if (!uProxy)
+    return;
+  float t;
+  vec3 normal;
+  Primitive primitive = proxyPrimitive();
+  if (intersectRayPrimitive(ray, primitive, t, normal) && t < closestT) {
+    closestT = t;
+    // Nothing to reuse from the vis buffer
+    closestTriangle = primitiveTriangle(primitive, 0, normal);
+    closestTriangle.mRecord = 0;
+  }
+}
+
 HitPayload miss() {
   HitPayload payload;
   payload.mHit = false;
@@ -232,52 +501,195 @@ HitPayload closestHit(float t, Triangle triangle, vec3 worldPosition) {
   return payload;
 }
 
+// Leaf records of one node, world position is set by the caller
+void intersectLeaf(Ray ray, int nodeIndex, float leafFlag, int offset, inout float closestT, inout Triangle closestTriangle) {
+  // Unbuilt nodes hold no triangles until expanded, rays pass and report them
+  if (leafFlag == UNBUILT_LEAF && nodeIndex < mFeedback.length())
+    atomicAdd(mFeedback[nodeIndex], 1);
+  int triangleCount = getInt(offset);
+  for (int i = 0; i < triangleCount; i++) {
+    Triangle triangle = getTriangle(offset);
+    float t;
+    if (hiddenByProxy(triangle))
+      continue;
+    if (triangle.mIndices[0] < 0) {
+      Primitive primitive = getPrimitive(triangle.mIndices[1]);
+      vec3 normal;
+      if (intersectRayPrimitive(ray, primitive, t, normal) && t < closestT) {
+        closestT = t;
+        closestTriangle = primitiveTriangle(primitive, triangle.mIndices[1], normal);
+      }
+      continue;
+    }
+    if (intersectRayTriangle(ray, triangle, t)) {
+      if(t < closestT){
+        closestT = t;
+        closestTriangle = triangle;
+      }
+    }
+  }
+}
+
 HitPayload traverseBVH(Ray ray, int nodeIndex) {
   int BVHOffset = int(mData[BVH_OFFSET]);
 
   float closestT = 1e30;
   Triangle closestTriangle;
-  vec3 worldPosition;
 
-  int stack[100];
+  intersectGlobalPrimitives(ray, closestT, closestTriangle);
+  intersectProxy(ray, closestT, closestTriangle);
+
+#ifdef STACKLESS_TRAVERSAL
+  // Hit goes to the left child, miss or a finished leaf follows the skip link
+  int skipOffset = int(mData[SKIP_OFFSET]);
+  int endIndex = int(mData[skipOffset + nodeIndex]);
+  int currentIndex = nodeIndex;
+
+  while (currentIndex != endIndex) {
+    int offset = int(mData[BVHOffset + currentIndex]);
+    BoundingBox aabb = getAABB(offset);
+    int skipIndex = int(mData[skipOffset + currentIndex]);
+
+    float tNear;
+    if (!intersectRayAABB(ray, aabb, tNear) || tNear > closestT) {
+      currentIndex = skipIndex;
+      continue;
+    }
+    float leafFlag = getFloat(offset);
+    if (leafFlag != 0.0f) {
+      intersectLeaf(ray, currentIndex, leafFlag, offset, closestT, closestTriangle);
+      currentIndex = skipIndex;
+    } else {
+      currentIndex = getInt(offset);
+    }
+  }
+#else
+  DECLARE_STACK;
   int stackPointer = 0;
 
-  stack[stackPointer++] = nodeIndex;
+  STACK(stackPointer++) = nodeIndex;
 
   while (stackPointer > 0) {
-    int currentIndex = stack[--stackPointer];
+    int currentIndex = STACK(--stackPointer);
     int offset = int(mData[BVHOffset + currentIndex]);
     BoundingBox aabb = getAABB(offset);
 
-    if (intersectRayAABB(ray, aabb)) {
-      bool isLeaf = getBool(offset);
-      if (isLeaf) {
-        int triangleCount = getInt(offset);
-        for (int i = 0; i < triangleCount; i++) {
-          Triangle triangle = getTriangle(offset);
-          float t;
-          if (intersectRayTriangle(ray, triangle, t)) {
-            if(t < closestT){
-              closestT = t;
-              closestTriangle = triangle;
-              worldPosition = ray.mOrigin + ray.mDirection * t;
-            }
-          }
-        }
+    // Nodes entered behind the closest hit cannot contain a closer one
+    float tNear;
+    if (intersectRayAABB(ray, aabb, tNear) && tNear <= closestT) {
+      float leafFlag = getFloat(offset);
+      if (leafFlag != 0.0f) {
+        intersectLeaf(ray, currentIndex, leafFlag, offset, closestT, closestTriangle);
       } else {
         int leftIndex = getInt(offset);
         int rightIndex = getInt(offset);
-        stack[stackPointer++] = leftIndex;
-        stack[stackPointer++] = rightIndex;
+        int splitAxis = getInt(offset);
+        if (stackPointer + 2 > STACK_SIZE) {
+          stackOverflowed = true;
+          continue;
+        }
+        // Left holds the lower half, push the near child last
+        if (ray.mDirection[splitAxis] > 0.0f) {
+          STACK(stackPointer++) = rightIndex;
+          STACK(stackPointer++) = leftIndex;
+        } else {
+          STACK(stackPointer++) = leftIndex;
+          STACK(stackPointer++) = rightIndex;
+        }
       }
     }
   }
+#endif
   if (closestT < 1e30) {
-    return closestHit(closestT, closestTriangle, worldPosition);
+    return closestHit(closestT, closestTriangle, ray.mOrigin + ray.mDirection * closestT);
   }
   return miss();
 }
 
+// Any hit before maxT ends the query, triangles go first as primitives cost more
+bool intersectLeafAny(Ray ray, int offset, float maxT) {
+  int triangleCount = getInt(offset);
+  int recordsOffset = offset;
+  for (int i = 0; i < triangleCount; i++) {
+    Triangle triangle = getTriangle(offset);
+    float t;
+    if (triangle.mIndices[0] >= 0 && !hiddenByProxy(triangle) && intersectRayTriangle(ray, triangle, t) && t < maxT)
+      return true;
+  }
+  offset = recordsOffset;
+  for (int i = 0; i < triangleCount; i++) {
+    Triangle triangle = getTriangle(offset);
+    if (triangle.mIndices[0] >= 0)
+      continue;
+    float t;
+    vec3 normal;
+    if (intersectRayPrimitive(ray, getPrimitive(triangle.mIndices[1]), t, normal) && t < maxT)
+      return true;
+  }
+  return false;
+}
+
+bool occluded(Ray ray, float maxT) {
+  int primitivesOffset = int(mData[PRIMITIVE_OFFSET]);
+  int globalCount = int(mData[primitivesOffset + 1]);
+  for (int i = 0; i < globalCount; i++) {
+    float t;
+    vec3 normal;
+    Primitive primitive = getPrimitive(int(mData[primitivesOffset + 2 + i]));
+    if (intersectRayPrimitive(ray, primitive, t, normal) && t < maxT)
+      return true;
+  }
+  float proxyT;
+  vec3 proxyNormal;
+  if (uProxy && intersectRayPrimitive(ray, proxyPrimitive(), proxyT, proxyNormal) && proxyT < maxT)
+    return true;
+
+  int BVHOffset = int(mData[BVH_OFFSET]);
+#ifdef STACKLESS_TRAVERSAL
+  int skipOffset = int(mData[SKIP_OFFSET]);
+  int currentIndex = 0;
+  while (currentIndex >= 0) {
+    int offset = int(mData[BVHOffset + currentIndex]);
+    BoundingBox aabb = getAABB(offset);
+    int skipIndex = int(mData[skipOffset + currentIndex]);
+    float tNear;
+    if (!intersectRayAABB(ray, aabb, tNear) || tNear > maxT) {
+      currentIndex = skipIndex;
+      continue;
+    }
+    if (getFloat(offset) != 0.0f) {
+      if (intersectLeafAny(ray, offset, maxT))
+        return true;
+      currentIndex = skipIndex;
+    } else {
+      currentIndex = getInt(offset);
+    }
+  }
+#else
+  // Child order does not matter for any hit
+  DECLARE_STACK;
+  int stackPointer = 0;
+  STACK(stackPointer++) = 0;
+  while (stackPointer > 0) {
+    int offset = int(mData[BVHOffset + STACK(--stackPointer)]);
+    BoundingBox aabb = getAABB(offset);
+    float tNear;
+    if (!intersectRayAABB(ray, aabb, tNear) || tNear > maxT)
+      continue;
+    if (getFloat(offset) != 0.0f) {
+      if (intersectLeafAny(ray, offset, maxT))
+        return true;
+    } else if (stackPointer + 2 > STACK_SIZE) {
+      stackOverflowed = true;
+    } else {
+      STACK(stackPointer++) = getInt(offset);
+      STACK(stackPointer++) = getInt(offset);
+    }
+  }
+#endif
+  return false;
+}
+
 vec3 computeBarycentricCoordinates(vec3 P, Triangle triangle) {
   vec3 A = triangle.mVertices[0].mPosition;
   vec3 B = triangle.mVertices[1].mPosition;
@@ -326,55 +738,171 @@ void calculateLight(Light light, HitPayload payload, out vec3 lightDirection, ou
   }
 }
 
-vec3 rayTrace(Ray ray, Settings settings) {
-  vec3 closestColor = vec3(0.0);
+bool inShadow(Light light, HitPayload payload, vec3 lightDirection) {
+  Ray shadowRay;
+  float lightDistance = 1e30;
+  if (light.mType == POINT_LIGHT) {
+    shadowRay.mDirection = lightDirection;
+    lightDistance = length(light.mPosition - payload.mWorldPosition);
+  } else {
+    shadowRay.mDirection = -lightDirection;
+  }
+  shadowRay.mOrigin = payload.mWorldPosition + shadowRay.mDirection * SHADOW_BIAS;
+  return occluded(shadowRay, lightDistance - SHADOW_BIAS);
+}
 
-  HitPayload payload = traverseBVH(ray, 0);
-  if (payload.mHit) {
-    int materialOffset = int(mData[MATERIAL_OFFSET]);
-    int modelMaterialOffset = int(mData[materialOffset + payload.mTriangle.mModelIndex]);
-    int meshMaterialOffset = modelMaterialOffset + payload.mTriangle.mMeshIndex * 3; // 3 -> material size
-    Material material = getMaterial(meshMaterialOffset);
+Material hitMaterial(HitPayload payload) {
+  int materialOffset = int(mData[MATERIAL_OFFSET]);
+  int modelMaterialOffset = int(mData[materialOffset + payload.mTriangle.mModelIndex]);
+  int meshMaterialOffset = modelMaterialOffset + payload.mTriangle.mMeshIndex * 3; // 3 -> material size
+  return getMaterial(meshMaterialOffset);
+}
 
-    if (settings.mViewportMode == VIEWPORT_FLAT) {
-      return material.mDiffuse;
-    }
-    else if (settings.mViewportMode == VIEWPORT_WIREFRAME){
-      vec3 barycentricCoords = computeBarycentricCoordinates(payload.mWorldPosition, payload.mTriangle);
-      float factor = 0.01;
-      if (barycentricCoords.x <= factor || barycentricCoords.y <= factor || barycentricCoords.z <= factor)
-        return vec3(0.8);
-      else
-        return closestColor;
-    }
+// Bit i of the shadow mask is set when light i is occluded. With
+// useShadowMask the bits are taken as given instead of tracing shadow rays.
+vec3 shadeHit(HitPayload payload, Settings settings, inout int shadowMask, bool useShadowMask) {
+  Material material = hitMaterial(payload);
 
-    vec3 totalColor = vec3(0.0f);
+  if (settings.mViewportMode == VIEWPORT_FLAT) {
+    return material.mDiffuse;
+  }
+  else if (settings.mViewportMode == VIEWPORT_WIREFRAME){
+    // Primitives have no edges, draw them dimmed
+    if (payload.mTriangle.mIndices[0] < 0)
+      return material.mDiffuse * 0.5;
+    vec3 barycentricCoords = computeBarycentricCoordinates(payload.mWorldPosition, payload.mTriangle);
+    float factor = 0.01;
+    if (barycentricCoords.x <= factor || barycentricCoords.y <= factor || barycentricCoords.z <= factor)
+      return vec3(0.8);
+    else
+      return vec3(0.0);
+  }
 
-    int lightsOffset = REAL_LIGHTS_OFFSET;
-    int lightsCount = getInt(lightsOffset);
+  vec3 totalColor = vec3(0.0f);
 
-    for(int i = 0; i < lightsCount; i++) {
-      Light light = getLight(lightsOffset);
+  int lightsOffset = REAL_LIGHTS_OFFSET;
+  int lightsCount = getInt(lightsOffset);
 
-      vec3 lightDirection;
-      float intensity;
-      calculateLight(light, payload, lightDirection, intensity);
+  for(int i = 0; i < lightsCount; i++) {
+    Light light = getLight(lightsOffset);
 
-      float diffuseIntensity = dot(payload.mTriangle.mNormal, -lightDirection) * 0.5 + 0.5;
-      vec3 diffuseColor = material.mDiffuse * diffuseIntensity;
+    vec3 lightDirection;
+    float intensity;
+    calculateLight(light, payload, lightDirection, intensity);
 
-      vec3 lightContribution = diffuseColor * light.mColor * intensity;
-      totalColor += lightContribution;
-    }
-    closestColor = totalColor;
+    float diffuseIntensity = dot(payload.mTriangle.mNormal, -lightDirection) * 0.5 + 0.5;
+    vec3 diffuseColor = material.mDiffuse * diffuseIntensity;
+
+    vec3 lightContribution = diffuseColor * light.mColor * intensity;
+    if (!useShadowMask && settings.mShadows && inShadow(light, payload, lightDirection))
+      shadowMask |= 1 << i;
+    if ((shadowMask & (1 << i)) != 0)
+      lightContribution *= SHADOW_FACTOR;
+    totalColor += lightContribution;
   }
+  return totalColor;
+}
 
-  return closestColor;
+// Hit of a ray against the single triangle or primitive of a vis id
+bool intersectRecord(Ray ray, int id, out float t) {
+  if (id >= 0) {
+    int offset = id;
+    Triangle triangle = getTriangle(offset);
+    return intersectRayTriangle(ray, triangle, t);
+  }
+  vec3 normal;
+  return intersectRayPrimitive(ray, getPrimitive(-2 - id), t, normal);
 }
 
-vec3 calculateRayDirection(vec2 screenCoords, Camera camera, int downsampleFactor) {
-  // Calculate downsampled screen coordinates
-  vec2 downsampledCoords = floor(screenCoords / float(downsampleFactor)) * float(downsampleFactor);
+// Hit rebuilt from a vis id, primitive normals depend on the hit point so the
+// one primitive is hit again
+HitPayload recordHit(Ray ray, int id, vec3 worldPosition) {
+  HitPayload payload;
+  payload.mHit = true;
+  payload.mWorldPosition = worldPosition;
+  payload.mClosestHit = distance(ray.mOrigin, worldPosition);
+  if (id >= 0) {
+    int offset = id;
+    payload.mTriangle = getTriangle(offset);
+  } else {
+    int index = -2 - id;
+    Primitive primitive = getPrimitive(index);
+    float t;
+    vec3 normal;
+    intersectRayPrimitive(ray, primitive, t, normal);
+    payload.mTriangle = primitiveTriangle(primitive, index, normal);
+  }
+  return payload;
+}
+
+// Primary hit from the block corners when all four saw the same triangle,
+// plane or miss
+bool interpolateCorners(Ray ray, out HitPayload payload) {
+  if (!uCornerInterpolate)
+    return false;
+  ivec2 block = ivec2(fragCoord) / uCornerBlock;
+  int id = int(texelFetch(uCorners, block, 0).w);
+  if (id == 0 ||
+      int(texelFetch(uCorners, block + ivec2(1, 0), 0).w) != id ||
+      int(texelFetch(uCorners, block + ivec2(0, 1), 0).w) != id ||
+      int(texelFetch(uCorners, block + ivec2(1, 1), 0).w) != id)
+    return false;
+  if (id == -1) {
+    payload = miss();
+    return true;
+  }
+  if (id < -1 && getPrimitive(-2 - id).mType != PRIMITIVE_PLANE)
+    return false;
+  float t;
+  if (!intersectRecord(ray, id, t))
+    return false;
+  payload = recordHit(ray, id, ray.mOrigin + ray.mDirection * t);
+  return true;
+}
+
+vec3 rayTrace(Ray ray, Settings settings, out vec4 normalDepth, out vec3 albedo, out vec4 vis, out int shadowMask) {
+  normalDepth = vec4(0.0);
+  albedo = vec3(0.0);
+  vis = vec4(0.0, 0.0, 0.0, -1.0);
+  shadowMask = 0;
+
+  HitPayload payload;
+  if (!interpolateCorners(ray, payload)) {
+    if (uCornerInterpolate)
+      atomicAdd(mTracedPixels, 1);
+    payload = traverseBVH(ray, 0);
+  }
+  if (!payload.mHit)
+    return vec3(0.0);
+
+  vis = vec4(payload.mWorldPosition, float(payload.mTriangle.mRecord));
+  // Normals face the camera so both sides of a triangle match
+  vec3 normal = payload.mTriangle.mNormal;
+  if (dot(normal, ray.mDirection) > 0.0)
+    normal = -normal;
+  normalDepth = vec4(normal, payload.mClosestHit);
+  albedo = hitMaterial(payload).mDiffuse;
+  return shadeHit(payload, settings, shadowMask, false);
+}
+
+// Shading again from the vis buffer of the last trace, the primary hit is
+// rebuilt from its record instead of traversing
+vec3 reshade(Ray ray, Settings settings) {
+  ivec2 pixel = ivec2(fragCoord);
+  vec4 vis = texelFetch(uVis, pixel, 0);
+  int id = int(vis.w);
+  if (id == 0 || id == -1)
+    return vec3(0.0);
+
+  HitPayload payload = recordHit(ray, id, vis.xyz);
+  int shadowMask = uReshadeShadows ? 0 : int(texelFetch(uShadowMask, pixel, 0).r);
+  return shadeHit(payload, settings, shadowMask, !uReshadeShadows);
+}
+
+vec3 calculateRayDirection(vec2 screenCoords, Camera camera, float downsampleFactor) {
+  // The target is downsampleFactor times smaller than the window, each texel
+  // traces the center of its block, the factor need not be whole
+  vec2 downsampledCoords = screenCoords * downsampleFactor;
 
   //vec2 normalizedCoords = screenCoords / camera.mResolution;
   vec2 normalizedCoords = downsampledCoords / camera.mResolution;
@@ -390,8 +918,69 @@ vec3 calculateRayDirection(vec2 screenCoords, Camera camera, int downsampleFacto
   return rayDirectionWorld;
 }
 
-void main() {
-  vec2 pixelCoords = gl_FragCoord.xy;
+float halton(int index, int base) {
+  float result = 0.0;
+  float fraction = 1.0;
+  while (index > 0) {
+    fraction /= float(base);
+    result += fraction * float(index % base);
+    index /= base;
+  }
+  return result;
+}
+
+vec2 sampleJitter() {
+  if (!uAccumulate)
+    return vec2(0.0);
+  // The first sample is centered
+  int index = int(texelFetch(uTileSamples, ivec2(fragCoord) / TILE_SIZE, 0).r);
+  if (index == 0)
+    return vec2(0.0);
+  return vec2(halton(index, 2), halton(index, 3)) - 0.5;
+}
+
+bool refreshPixel(ivec2 pixel) {
+  float hash = fract(sin(dot(vec2(pixel) + float(uFrame) * vec2(17.0, 59.0), vec2(12.9898, 78.233))) * 43758.5453);
+  return hash < uRefreshFraction;
+}
+
+// Previous color when the ray still hits the record that landed here
+bool reuseReprojected(Ray ray) {
+  ivec2 pixel = ivec2(fragCoord);
+  vec4 vis = texelFetch(uReprojectedVis, pixel, 0);
+  int id = int(vis.w);
+  if (id == 0 || id == -1 || refreshPixel(pixel))
+    return false;
+  float t;
+  float expected = distance(ray.mOrigin, vis.xyz);
+  if (!intersectRecord(ray, id, t) || abs(t - expected) > REPROJECT_TOLERANCE * expected)
+    return false;
+
+  FragColor = vec4(texelFetch(uReprojectedColor, pixel, 0).rgb, 1.0);
+  FragNormalDepth = vec4(0.0);
+  FragAlbedo = vec4(0.0);
+  FragVis = vec4(ray.mOrigin + ray.mDirection * t, vis.w);
+  FragShadowMask = texelFetch(uReprojectedShadowMask, pixel, 0);
+  return true;
+}
+
+int interleavePhase(ivec2 pixel) {
+  if (uInterleave == 2)
+    return (pixel.x + pixel.y) & 1;
+  return (pixel.x & 1) + 2 * (pixel.y & 1);
+}
+
+// Writes the outputs of the pixel at fragCoord, false when it is skipped
+bool tracePixel() {
+  if (uInterleave > 1 && interleavePhase(ivec2(fragCoord)) != uPhase)
+    DISCARD;
+  if (uAccumulate && texelFetch(uTileSamples, ivec2(fragCoord) / TILE_SIZE, 0).g == 0.0)
+    DISCARD;
+
+  vec2 pixelCoords = fragCoord + sampleJitter();
+  // Texel i of the corner pass is the center of pixel i * block
+  if (uCornerTrace)
+    pixelCoords = (fragCoord - 0.5) * float(uCornerBlock) + 0.5;
 
   int cameraOffset = REAL_CAMERA_OFFSET;
   int settingsOffset = REAL_SETTINGS_OFFSET;
@@ -402,6 +991,55 @@ void main() {
   ray.mOrigin = cam.mPosition;
   ray.mDirection = calculateRayDirection(pixelCoords, cam, settings.mDownsampleFactor);
 
-  vec3 color = rayTrace(ray, settings);
-  FragColor = vec4(color, 1.0);
+  if (uReshade) {
+    FragColor = vec4(reshade(ray, settings), 1.0);
+    return true;
+  }
+  if (uCornerTrace) {
+    HitPayload payload = traverseBVH(ray, 0);
+    FragVis = payload.mHit ? vec4(payload.mWorldPosition, float(payload.mTriangle.mRecord)) : vec4(0.0, 0.0, 0.0, -1.0);
+    return true;
+  }
+  if (uReproject) {
+    if (reuseReprojected(ray))
+      return true;
+    atomicAdd(mTracedPixels, 1);
+  }
+
+  vec4 normalDepth;
+  vec3 albedo;
+  vec4 vis;
+  int shadowMask;
+  vec3 color = rayTrace(ray, settings, normalDepth, albedo, vis, shadowMask);
+  if (stackOverflowed)
+    color = STACK_OVERFLOW_COLOR;
+  // Alpha is only read when accumulating, as squared luminance for the noise
+  // estimate
+  float luminance = dot(color, LUMINANCE);
+  FragColor = vec4(color, luminance * luminance);
+  FragNormalDepth = normalDepth;
+  FragAlbedo = vec4(albedo, 1.0);
+  FragVis = vis;
+  FragShadowMask = vec4(float(shadowMask), 0.0, 0.0, 0.0);
+  return true;
+}
+
+#ifdef COMPUTE
+void main() {
+  ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(pixel, uRectSize)))
+    return;
+  pixel += uRectOffset;
+  fragCoord = vec2(pixel) + 0.5;
+  if (!tracePixel())
+    return;
+  imageStore(uColorImage, pixel, FragColor);
+  imageStore(uVisImage, pixel, FragVis);
+  imageStore(uShadowMaskImage, pixel, FragShadowMask);
+}
+#else
+void main() {
+  fragCoord = gl_FragCoord.xy;
+  tracePixel();
 }
+#endif
@@ -0,0 +1,240 @@
+#include <glad/glad.h>
+
+#include "Accumulator.h"
+#include "ShaderConstants.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Passes a frame may spend on few remaining tiles
+#define MAX_PASSES_PER_FRAME 16
+
+// Resolves between tile noise readbacks, each one waits for the GPU
+#define NOISE_CHECK_INTERVAL 8
+
+void Accumulator::init(int width, int height) {
+  mSums.init(width, height, true, {0, 1, 2});
+  mResolved.init(width, height, true, {0, 1, 2});
+  mDenoised.init(width, height, true);
+  glGenTextures(1, &mTileTexture);
+  glBindTexture(GL_TEXTURE_2D, mTileTexture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  reset(width, height);
+}
+
+void Accumulator::reset(int width, int height) {
+  mTilesX = (width + ACCUMULATION_TILE_SIZE - 1) / ACCUMULATION_TILE_SIZE;
+  mTilesY = (height + ACCUMULATION_TILE_SIZE - 1) / ACCUMULATION_TILE_SIZE;
+  mSums.resize(width, height);
+  mResolved.resize(mTilesX * ACCUMULATION_TILE_SIZE,
+                   mTilesY * ACCUMULATION_TILE_SIZE);
+  mSums.clear();
+  mResolved.clear();
+  mHasDenoised = false;
+
+  int tileCount = mTilesX * mTilesY;
+  mTileSamples.assign(tileCount, 0);
+  mTileNoise.assign(tileCount, INFINITY);
+  mActiveTiles.clear();
+  mMaxNoise = INFINITY;
+  mPixelSamples = 0.0;
+  mResolvesSinceNoise = NOISE_CHECK_INTERVAL;
+  mConverged = false;
+  mStart = std::chrono::high_resolution_clock::now();
+  mEnd = mStart;
+  uploadTiles(false);
+}
+
+int Accumulator::beginFrame(const Settings &settings) {
+  int tileCount = mTilesX * mTilesY;
+  if (tileCount == 0) {
+    mConverged = true;
+    return 0;
+  }
+  int maxSamples = std::max(settings.mMaxSamples, 1);
+  mMaxSamples = maxSamples;
+  int baseSamples = std::clamp(settings.mBaseSamples, 2, maxSamples);
+  bool base = *std::min_element(mTileSamples.begin(), mTileSamples.end()) <
+              baseSamples;
+
+  // Uniform sampling keeps every tile until all converged
+  mActiveTiles.clear();
+  bool adaptive = settings.mAdaptiveSampling && !base;
+  for (int tile = 0; tile < tileCount; tile++) {
+    if (mTileSamples[tile] >= maxSamples)
+      continue;
+    if (adaptive && mTileNoise[tile] < settings.mNoiseThreshold)
+      continue;
+    mActiveTiles.push_back(tile);
+  }
+  if (!base && !adaptive && mMaxNoise < settings.mNoiseThreshold)
+    mActiveTiles.clear();
+  if (mActiveTiles.empty()) {
+    mConverged = true;
+    return 0;
+  }
+  if (!adaptive)
+    return 1;
+
+  // The budget goes to the noisiest tiles, few tiles get several passes
+  int budget = std::max((int)(settings.mSampleBudget * tileCount), 1);
+  if (mActiveTiles.size() > budget) {
+    std::partial_sort(mActiveTiles.begin(), mActiveTiles.begin() + budget,
+                      mActiveTiles.end(), [this](int a, int b) {
+                        return mTileNoise[a] > mTileNoise[b];
+                      });
+    mActiveTiles.resize(budget);
+    return 1;
+  }
+  return std::clamp(budget / (int)mActiveTiles.size(), 1,
+                    MAX_PASSES_PER_FRAME);
+}
+
+void Accumulator::beginPass() {
+  uploadTiles(true);
+  mSums.bind();
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE);
+}
+
+void Accumulator::endPass() {
+  glDisable(GL_BLEND);
+  mSums.unbind();
+  for (int tile : mActiveTiles) {
+    mTileSamples[tile]++;
+    mPixelSamples += tilePixels(tile);
+  }
+  // Later passes of the frame skip tiles out of samples
+  mActiveTiles.erase(std::remove_if(mActiveTiles.begin(), mActiveTiles.end(),
+                                    [this](int tile) {
+                                      return mTileSamples[tile] >= mMaxSamples;
+                                    }),
+                     mActiveTiles.end());
+  mEnd = std::chrono::high_resolution_clock::now();
+}
+
+void Accumulator::resolve(Shader &resolveShader, Quad &quad,
+                          const Settings &settings) {
+  if (mTileSamples.empty())
+    return;
+  uploadTiles(false);
+  mResolved.bind();
+  resolveShader.use();
+  resolveShader.setInt("uSums", 0);
+  resolveShader.setInt("uTileSamples", 1);
+  resolveShader.setInt("uNormalDepthSums", 2);
+  resolveShader.setInt("uAlbedoSums", 3);
+  mSums.bindTexture(0);
+  bindTileSamples(1);
+  mSums.bindTexture(2, 1);
+  mSums.bindTexture(3, 2);
+  quad.draw();
+  mResolved.unbind();
+
+  // Tile noise is only trusted once every tile has its base samples, and is
+  // read every few resolves after that
+  int baseSamples = std::clamp(settings.mBaseSamples, 2,
+                               std::max(settings.mMaxSamples, 2));
+  if (*std::min_element(mTileSamples.begin(), mTileSamples.end()) <
+      baseSamples)
+    return;
+  if (++mResolvesSinceNoise < NOISE_CHECK_INTERVAL)
+    return;
+  mResolvesSinceNoise = 0;
+  mResolved.generateMipmaps();
+  std::vector<float> tiles;
+  int width, height;
+  mResolved.readLevel(ACCUMULATION_TILE_LEVEL, tiles, width, height);
+  mMaxNoise = 0.0f;
+  for (int tile = 0; tile < mTilesX * mTilesY; tile++) {
+    // Tiles are averaged over their padding too, scale back to the image
+    float coverage =
+        (float)tilePixels(tile) /
+        (ACCUMULATION_TILE_SIZE * ACCUMULATION_TILE_SIZE);
+    float variance = tiles[tile * 4 + 3] / coverage;
+    mTileNoise[tile] = std::sqrt(variance) * 255.0f;
+    mMaxNoise = std::max(mMaxNoise, mTileNoise[tile]);
+  }
+}
+
+void Accumulator::readResolved(std::vector<float> &color,
+                               std::vector<float> &normalDepth,
+                               std::vector<float> &albedo, int &width,
+                               int &height) {
+  mResolved.readLevel(0, color, width, height, 0);
+  mResolved.readLevel(0, normalDepth, width, height, 1);
+  mResolved.readLevel(0, albedo, width, height, 2);
+}
+
+void Accumulator::setDenoised(const std::vector<float> &pixels) {
+  mDenoised.resize(mResolved.getWidth(), mResolved.getHeight());
+  mDenoised.upload(pixels);
+  mHasDenoised = true;
+}
+
+void Accumulator::bindTexture(int unit) {
+  if (mHasDenoised)
+    mDenoised.bindTexture(unit);
+  else
+    mResolved.bindTexture(unit);
+}
+
+void Accumulator::setFilter(UpscaleFilter filter) {
+  mResolved.setFilter(filter);
+  mDenoised.setFilter(filter);
+}
+
+void Accumulator::bindTileSamples(int unit) {
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(GL_TEXTURE_2D, mTileTexture);
+}
+
+void Accumulator::uploadTiles(bool picked) {
+  std::vector<float> tiles(mTilesX * mTilesY * 2, 0.0f);
+  for (int tile = 0; tile < mTilesX * mTilesY; tile++) {
+    tiles[tile * 2] = (float)mTileSamples[tile];
+  }
+  if (picked) {
+    for (int tile : mActiveTiles) {
+      tiles[tile * 2 + 1] = 1.0f;
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D, mTileTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, mTilesX, mTilesY, 0, GL_RG,
+               GL_FLOAT, tiles.data());
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+int Accumulator::tilePixels(int tile) const {
+  int x = tile % mTilesX * ACCUMULATION_TILE_SIZE;
+  int y = tile / mTilesX * ACCUMULATION_TILE_SIZE;
+  int width = std::min(ACCUMULATION_TILE_SIZE, mSums.getWidth() - x);
+  int height = std::min(ACCUMULATION_TILE_SIZE, mSums.getHeight() - y);
+  return width * height;
+}
+
+const float Accumulator::getAverageSamples() const {
+  int pixels = mSums.getWidth() * mSums.getHeight();
+  return pixels > 0 ? (float)(mPixelSamples / pixels) : 0.0f;
+}
+
+const double Accumulator::getElapsed() const {
+  std::chrono::duration<double> elapsed = mEnd - mStart;
+  return elapsed.count();
+}
+
+const double Accumulator::getSamplesPerSecond() const {
+  double elapsed = getElapsed();
+  if (elapsed <= 0.0)
+    return 0.0;
+  return mPixelSamples / elapsed;
+}
+
+void Accumulator::clean() {
+  mSums.clean();
+  mResolved.clean();
+  mDenoised.clean();
+  glDeleteTextures(1, &mTileTexture);
+}
@@ -10,37 +10,113 @@
 #include <stb_image_write.h>
 
 #include "Application.h"
+#include "ShaderConstants.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <filesystem>
 #include <iostream>
 #include <memory>
 
 #define MODELS "../models/"
 #define SHADERS "../shaders/"
 
-Application::Application(unsigned int width, unsigned int height)
-    : mWindow(initWindow(width, height)) {
+// Largest per channel difference still counted as matching
+#define CPU_COMPARE_TOLERANCE 2
+// Timed traces of each backend when comparing them
+#define BACKEND_COMPARE_RUNS 5
+// Texture units of the trace shader's inputs beyond the accumulation and
+// reprojection ones
+#define VIS_UNIT 4
+#define SHADOW_MASK_UNIT 5
+#define CORNERS_UNIT 6
+
+// Lazy BVH nodes the shader can report, ids past this are ignored
+#define FEEDBACK_SIZE (1 << 20)
+
+// Seconds without camera or scene changes before dynamic resolution returns
+// to the full window resolution
+#define IDLE_DELAY 0.25
+
+// Longest wait for input while nothing needs tracing, seconds, keeps the
+// editor responsive to timed changes like the dynamic resolution snap back
+#define IDLE_WAIT_TIMEOUT 0.1
+
+Application::Application(unsigned int width, unsigned int height,
+                         const std::vector<std::string> &models,
+                         const std::string &bvhFile, bool computeBackend)
+    : mWindow(initWindow(width, height)), mBVHFile(bvhFile) {
   mCamera = std::make_shared<Camera>(width, height, 45.0f);
   mQuad = std::make_unique<Quad>();
   mData = std::make_unique<Data>();
   mDataUBO = std::make_unique<UBO>();
+  mFeedback = std::make_unique<FeedbackBuffer>();
+  mCPURenderer = std::make_unique<CPURenderer>();
+  mDenoiser = std::make_unique<Denoiser>();
   mScene = std::make_shared<Scene>();
-  mShader =
-      std::make_unique<Shader>(SHADERS "shader.vert", SHADERS "shader.frag");
   mSettings = std::make_shared<Settings>();
+  if (computeBackend) {
+    // The fragment shader traces when the compute stacks do not fit
+    mComputeTracer = std::make_unique<ComputeTracer>();
+    if (!mComputeTracer->init())
+      mComputeTracer.reset();
+  }
+  loadShader();
+  mPresentShader =
+      std::make_unique<Shader>(SHADERS "shader.vert", SHADERS "present.frag");
+  mRenderTarget = std::make_unique<RenderTarget>();
+  // Color, vis and shadow mask, reused by reshading
+  mRenderTarget->init(width, height, true, {0, 3, 4});
+  // Time sliced restarts at a new size fill this one, then swap
+  mSliceTarget = std::make_unique<RenderTarget>();
+  mSliceTarget->init(width, height, true, {0, 3, 4});
+  mReshadeTarget = std::make_unique<RenderTarget>();
+  mReshadeTarget->init(width, height);
+  // Vis ids of block corners, written to output 3
+  mCornerTarget = std::make_unique<RenderTarget>();
+  mCornerTarget->init(width, height, true, {3});
+  mCornerCounter = std::make_unique<FeedbackBuffer>();
+  mResolveShader =
+      std::make_unique<Shader>(SHADERS "shader.vert", SHADERS "resolve.frag",
+                               shaderConstants());
+  mAccumulator = std::make_unique<Accumulator>();
+  mAccumulator->init(width, height);
+  mReprojectShader = std::make_unique<Shader>(SHADERS "reproject.vert",
+                                              SHADERS "reproject.frag");
+  mReprojector = std::make_unique<Reprojector>();
+  mReprojector->init(width, height);
+  mReconstructShader = std::make_unique<Shader>(SHADERS "shader.vert",
+                                                SHADERS "reconstruct.frag");
+  mInterleaver = std::make_unique<Interleaver>();
+  mInterleaver->init(width, height);
+  mTraceTimer = std::make_unique<GPUTimer>();
+  mTraceTimer->init();
+  mResolutionController = std::make_unique<ResolutionController>();
+  mTileScheduler = std::make_unique<TileScheduler>();
+  mRegionTracker = std::make_unique<RegionTracker>();
+  mStats = std::make_shared<Stats>();
+  if (mComputeTracer)
+    mStats->mComputeGroupSize = mComputeTracer->getLocalSize();
+  mChunkCache = std::make_unique<ChunkCache>(
+      (std::filesystem::temp_directory_path() / "RayTracerChunks.bin")
+          .string());
 
-  mScene->addModel(MODELS "Default/Monkey.obj");
+  for (const std::string &model : models) {
+    mScene->addModel(model);
+  }
   mScene->addLight(LightType::Directional);
 
-  mSceneEditor =
-      std::make_shared<SceneEditor>(MODELS, mScene, mCamera, mSettings);
+  mSceneEditor = std::make_shared<SceneEditor>(MODELS, mScene, mCamera,
+                                               mSettings, mStats);
 
   mData->updateSettings(*mSettings);
   mData->updateCamera(*mCamera);
   mData->updateLights(*mScene);
-  mData->updateBVH(*mScene, *mSettings);
-  mData->updateMaterial(*mScene, false);
+  updateBVH();
   mDataUBO->init(*mData);
+  mFeedback->init(FEEDBACK_SIZE, FEEDBACK_BINDING);
+  mCornerCounter->init(1, COUNTER_BINDING);
 
   mTimeStep = 0.0f;
   initCallbacks();
@@ -103,46 +179,165 @@ void Application::run() {
     processInput();
     if (mCamera->update(mWindow.get(), mTimeStep)) {
       mData->updateCamera(*mCamera);
-      mDataUBO->update(*mData);
+      uploadCamera();
+      markChanged();
     }
 
-    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
+    renderFrame();
 
-    mShader->use();
+    if (mCompareRequested) {
+      compareWithCPU();
+      mCompareRequested = false;
+    }
+    if (mCornerCompareRequested) {
+      compareCornerSampling();
+      mCornerCompareRequested = false;
+    }
+    if (mBackendCompareRequested) {
+      compareBackends();
+      mBackendCompareRequested = false;
+    }
 
-    mDataUBO->bind();
-    mQuad->draw();
-    mDataUBO->unbind();
+    if (expandLazyBVH())
+      mTraceDirty = true;
 
     if (mShowEditor) {
+      updateStats();
       ChangeType change = mSceneEditor->render(fps, mData->getFloatDataSize());
+      if (change == ChangeType::MaterialType ||
+          change == ChangeType::LightType)
+        requestReshade();
+      else if (change == ChangeType::BVHType)
+        requestRegionTrace();
+      else if (change != ChangeType::NoneType)
+        markChanged();
+      // Only camera edits leave the previous frame valid
+      if (change != ChangeType::NoneType && change != ChangeType::CameraType) {
+        mReprojector->invalidate();
+        mInterleaver->invalidate();
+      }
+      // Levels follow LOD settings and added or moved models
       if (change == ChangeType::BVHType) {
-        mData->updateBVH(*mScene, *mSettings);
-        mData->updateMaterial(*mScene, false);
+        mScene->updateLOD(*mCamera, *mSettings);
+        updateBVH();
       }
-      if (change == ChangeType::MaterialType)
+      // Only the edited part of the buffer is uploaded, idle frames upload
+      // nothing
+      if (change == ChangeType::BVHType)
+        mDataUBO->update(*mData);
+      if (change == ChangeType::MaterialType) {
         mData->updateMaterial(*mScene, true);
-      if (change == ChangeType::CameraType)
+        mDataUBO->update(*mData, mData->getMaterialOffset(),
+                         mData->getFloatDataSize() -
+                             mData->getMaterialOffset());
+      }
+      if (change == ChangeType::CameraType) {
         mData->updateCamera(*mCamera);
-      if (change == ChangeType::SettingsType)
+        uploadCamera();
+      }
+      if (change == ChangeType::SettingsType) {
         mData->updateSettings(*mSettings);
-      if (change == ChangeType::LightType)
+        // Shadows add or drop the streamed shadow casters
+        if (updateStreamedChunks())
+          mDataUBO->update(*mData);
+        else
+          mDataUBO->update(*mData, REAL_SETTINGS_OFFSET,
+                           REAL_CAMERA_OFFSET - REAL_SETTINGS_OFFSET);
+      }
+      if (change == ChangeType::LightType) {
         mData->updateLights(*mScene);
-
-      mDataUBO->update(*mData);
+        // Moved lights shadow from other streamed chunks, the vis buffer of
+        // the reshade no longer matches the hierarchy
+        if (updateStreamedChunks()) {
+          markChanged();
+          mDataUBO->update(*mData);
+        } else {
+          mDataUBO->update(*mData, REAL_LIGHTS_OFFSET,
+                           REAL_VERTICES_OFFSET - REAL_LIGHTS_OFFSET);
+        }
+      }
+      if (change == ChangeType::ShaderType)
+        loadShader();
     }
 
     glfwSwapBuffers(mWindow.get());
-    glfwPollEvents();
 
+    // Time spent waiting for input is left out so the camera does not jump
     mFrameEnd = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> frameDuration = mFrameEnd - mFrameStart;
     mTimeStep = frameDuration.count();
+    mStats->mFrameTime = mTimeStep * 1000.0;
     fps = 1.0 / mTimeStep;
+
+    // Nothing to trace, sleep until input instead of redrawing the cached
+    // image as fast as possible
+    bool looking = glfwGetMouseButton(mWindow.get(), GLFW_MOUSE_BUTTON_RIGHT);
+    bool settling = isInterleaving() && mInterleaver->isSettling();
+    if (mSettings->mRenderOnDemand && !mTraceDirty && !mReshadeDirty &&
+        !mRegionDirty && !isAccumulating() && !settling && !isSlicing() &&
+        !looking)
+      glfwWaitEventsTimeout(IDLE_WAIT_TIMEOUT);
+    else
+      glfwPollEvents();
   }
 }
 
+void Application::uploadCamera() {
+  // Levels of detail and streamed chunks follow the camera and rewrite the
+  // hierarchy
+  if (mScene->updateLOD(*mCamera, *mSettings)) {
+    updateBVH();
+    mDataUBO->update(*mData);
+  } else if (updateStreamedChunks()) {
+    mDataUBO->update(*mData);
+  } else {
+    mDataUBO->update(*mData, REAL_CAMERA_OFFSET,
+                     REAL_LIGHTS_OFFSET - REAL_CAMERA_OFFSET);
+  }
+}
+
+void Application::markChanged() {
+  mTraceDirty = true;
+  mLastChangeTime = glfwGetTime();
+}
+
+void Application::requestReshade() {
+  // Accumulated samples and pending traces need the full trace anyway
+  if (mSettings->mProgressive || !mSettings->mRenderOnDemand || mTraceDirty ||
+      mRegionDirty || mVisStale || mProxyTraced ||
+      (isInterleaving() && mInterleaver->isSettling()) || isSlicing()) {
+    markChanged();
+    return;
+  }
+  mReshadeDirty = true;
+}
+
+void Application::requestRegionTrace() {
+  // Reprojected and accumulated images are not kept in the render target
+  glm::ivec4 region;
+  if (!mSettings->mRegionTrace || !mSettings->mRenderOnDemand ||
+      mSettings->mProgressive ||
+      mSettings->mReprojection || mTraceDirty || mReshadeDirty ||
+      mShowReshaded || mProxyTraced || isInterleaving() || isSlicing() ||
+      !mRegionTracker->changedRegion(
+          *mScene, *mCamera, mData->getDownsampleFactor(),
+          mRenderTarget->getWidth(), mRenderTarget->getHeight(),
+          mSettings->mShadows, region)) {
+    markChanged();
+    return;
+  }
+  // Several edits before the next trace cover all their regions
+  if (mRegionDirty) {
+    int minX = std::min(region.x, mTraceRegion.x);
+    int minY = std::min(region.y, mTraceRegion.y);
+    int maxX = std::max(region.x + region.z, mTraceRegion.x + mTraceRegion.z);
+    int maxY = std::max(region.y + region.w, mTraceRegion.y + mTraceRegion.w);
+    region = glm::ivec4(minX, minY, maxX - minX, maxY - minY);
+  }
+  mTraceRegion = region;
+  mRegionDirty = true;
+}
+
 std::unique_ptr<GLFWwindow, decltype(&glfwDestroyWindow)>
 Application::initWindow(unsigned int width, unsigned int height) {
   if (!glfwInit()) {
@@ -180,12 +375,591 @@ Application::initWindow(unsigned int width, unsigned int height) {
       window, glfwDestroyWindow);
 }
 
+void Application::renderFrame() {
+  int width = mCamera->getResolution().x;
+  int height = mCamera->getResolution().y;
+
+  // Window pixels per traced texel, whole for the fixed downsample factor and
+  // continuous under dynamic resolution, full resolution once the view rests
+  float factor = (float)std::max(mSettings->mDownsampleFactor, 1);
+  if (mSettings->mDynamicResolution) {
+    bool idle = glfwGetTime() - mLastChangeTime > IDLE_DELAY;
+    factor = idle ? 1.0f : 1.0f / mResolutionController->getScale();
+  }
+  if (mSceneEditor->getProxyModel() != nullptr)
+    factor = std::max(factor, (float)mSettings->mDragDownsample);
+  int targetWidth = (int)std::ceil(width / factor);
+  int targetHeight = (int)std::ceil(height / factor);
+  if (factor != mData->getDownsampleFactor()) {
+    mData->updateDownsampleFactor(factor);
+    mDataUBO->update(*mData, REAL_SETTINGS_OFFSET, 1);
+    mTraceDirty = true;
+  }
+
+  // Measurements come a frame late, tagged with the traced pixel count
+  double traceTime;
+  int tracedPixels;
+  if (mTraceTimer->getResult(traceTime, tracedPixels)) {
+    mStats->mTraceTime = traceTime;
+    mResolutionController->update(traceTime, tracedPixels, width * height,
+                                  *mSettings);
+    mTileScheduler->update(traceTime, tracedPixels);
+    mStats->mBudgetUsed = traceTime / mSettings->mFrameBudget;
+    if (!mSettings->mDynamicResolution &&
+        tracedPixels == targetWidth * targetHeight) {
+      double &average = mStats->mTraceTimes[(int)factor];
+      average = average == 0.0 ? traceTime : average * 0.9 + traceTime * 0.1;
+    }
+  }
+  mStats->mRenderScale = 1.0f / factor;
+  mStats->mRenderWidth = targetWidth;
+  mStats->mRenderHeight = targetHeight;
+
+  // Skipped share of the last interpolated trace
+  if (mCornerReadPending && mCornerPixels > 0) {
+    std::vector<int> traced;
+    mCornerCounter->read(traced, 1);
+    mStats->mCornerSkipped = 1.0f - (float)traced[0] / mCornerPixels;
+    mCornerReadPending = false;
+  }
+
+  // Trace into the smaller target, the last image is kept while nothing
+  // changed. Progressive mode adds samples to it until it converges.
+  if (!mSettings->mRenderOnDemand && !mSettings->mProgressive && !isSlicing())
+    mTraceDirty = true;
+  // Interleaved traces go on with the missing phases once the view rests
+  bool changed = mTraceDirty;
+  if (isInterleaving() && mInterleaver->isSettling())
+    mTraceDirty = true;
+  if (mSettings->mProgressive) {
+    if (mTraceDirty) {
+      mAccumulator->reset(targetWidth, targetHeight);
+      mDenoisedSamples = 0.0f;
+      mTraceDirty = false;
+    }
+    if (!mAccumulator->isConverged())
+      accumulateFrame();
+  } else if (mTraceDirty && mSettings->mReprojection) {
+    bool reproject =
+        mReprojector->begin(*mReprojectShader, *mShader, *mDataUBO,
+                            *mSettings, targetWidth, targetHeight);
+    // Only the disoccluded share is traced when reprojecting, its count is
+    // not known until the counter is read, so the time is not attributed
+    mTraceTimer->begin(reproject ? 0 : targetWidth * targetHeight);
+    traceImage(reproject ? TraceMode::ReprojectTrace : TraceMode::FullTrace);
+    mTraceTimer->end();
+    mReprojector->end();
+    mStats->mTracedFraction = mReprojector->getTracedFraction();
+    mShadowLights = mScene->getLights();
+    mTraceDirty = false;
+    mReshadeDirty = false;
+    mShowReshaded = false;
+  } else if (mSettings->mTimeSlicing && (mTraceDirty || isSlicing())) {
+    traceTiles(targetWidth, targetHeight);
+  } else if (mTraceDirty) {
+    mRenderTarget->resize(targetWidth, targetHeight);
+    mTargetFactor = factor;
+    mSlicingBack = false;
+    if (isInterleaving())
+      mInterleaver->begin(*mRenderTarget, *mSettings, changed);
+    int tracedPixels =
+        targetWidth * targetHeight / mInterleaver->getPattern();
+    mTraceTimer->begin(tracedPixels);
+    if (mSettings->mCornerSampling)
+      traceCorners(targetWidth, targetHeight);
+    tracePrimary(*mRenderTarget, glm::ivec4(0, 0, targetWidth, targetHeight),
+                 mComputeTracer != nullptr);
+    mTraceTimer->end();
+    if (isInterleaving()) {
+      mInterleaver->reconstruct(*mReconstructShader, *mQuad, *mDataUBO,
+                                *mRenderTarget);
+      mInterleaver->end();
+    }
+    mStats->mInterleaveSettling = mInterleaver->isSettling();
+    if (mSettings->mCornerSampling) {
+      mCornerPixels += tracedPixels;
+      mCornerReadPending = true;
+    }
+    mShadowLights = mScene->getLights();
+    mRegionTracker->snapshot(*mScene);
+    mTraceDirty = false;
+    mReshadeDirty = false;
+    mRegionDirty = false;
+    mVisStale = false;
+    mShowReshaded = false;
+  } else if (mRegionDirty) {
+    // The rest of the cached image stays as traced
+    int regionPixels = mTraceRegion.z * mTraceRegion.w;
+    mTraceTimer->begin(regionPixels);
+    if (mSettings->mCornerSampling)
+      traceCorners(mRenderTarget->getWidth(), mRenderTarget->getHeight());
+    tracePrimary(*mRenderTarget, mTraceRegion, mComputeTracer != nullptr);
+    mTraceTimer->end();
+    if (mSettings->mCornerSampling) {
+      mCornerPixels += regionPixels;
+      mCornerReadPending = true;
+    }
+    mStats->mRegionPixels = regionPixels;
+    mRegionTracker->snapshot(*mScene);
+    mRegionDirty = false;
+    mVisStale = true;
+  } else if (mReshadeDirty) {
+    reshadeImage();
+  }
+
+  // Upscale the cached image to the window, every frame under the editor
+  glViewport(0, 0, width, height);
+  glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+  mPresentShader->use();
+  mPresentShader->setInt("uImage", 0);
+  mPresentShader->setFloat("uDownsampleFactor", factor);
+  if (mSettings->mProgressive) {
+    mAccumulator->setFilter(mSettings->mUpscaleFilter);
+    mAccumulator->bindTexture(0);
+  } else if (mShowReshaded) {
+    mReshadeTarget->setFilter(mSettings->mUpscaleFilter);
+    mReshadeTarget->bindTexture(0);
+  } else if (mSettings->mReprojection) {
+    mReprojector->setFilter(mSettings->mUpscaleFilter);
+    mReprojector->bindTexture(0);
+  } else if (isInterleaving()) {
+    mInterleaver->setFilter(mSettings->mUpscaleFilter);
+    mInterleaver->bindTexture(0);
+  } else {
+    // Kept at the factor it was traced at while slices fill the other target
+    mPresentShader->setFloat("uDownsampleFactor", mTargetFactor);
+    mRenderTarget->setFilter(mSettings->mUpscaleFilter);
+    mRenderTarget->bindTexture(0);
+  }
+  mQuad->draw();
+}
+
+void Application::setTraceUniforms(Shader &shader, TraceMode mode) {
+  shader.use();
+  shader.setInt("uAccumulate", mode == TraceMode::AccumulateTrace);
+  shader.setInt("uReproject", mode == TraceMode::ReprojectTrace);
+  shader.setInt("uReshade", false);
+  shader.setInt("uCornerTrace", mode == TraceMode::CornerTrace);
+  shader.setInt("uCornerInterpolate", mode == TraceMode::InterpolateTrace);
+  shader.setInt("uCornerBlock", mSettings->mCornerBlock);
+  bool primary =
+      mode == TraceMode::FullTrace || mode == TraceMode::InterpolateTrace;
+  shader.setInt("uInterleave", primary ? mInterleaver->getPattern() : 1);
+  shader.setInt("uPhase", mInterleaver->getPhase());
+  if (mode == TraceMode::InterpolateTrace) {
+    // Pixels still traversing are counted
+    shader.setInt("uCorners", CORNERS_UNIT);
+    mCornerTarget->bindTexture(CORNERS_UNIT);
+    mCornerCounter->bind();
+  }
+  // The dragged model as its transformed local bounds
+  const Model *proxy = mSceneEditor->getProxyModel();
+  mProxyTraced = proxy != nullptr;
+  shader.setInt("uProxy", mProxyTraced);
+  if (proxy) {
+    glm::vec3 angles = glm::radians(proxy->getRotation());
+    glm::mat3 rotation = glm::eulerAngleXYZ(angles.x, angles.y, angles.z);
+    glm::vec3 center =
+        (proxy->getLocalMinVert() + proxy->getLocalMaxVert()) * 0.5f;
+    glm::vec3 extent =
+        (proxy->getLocalMaxVert() - proxy->getLocalMinVert()) * 0.5f;
+    shader.setInt("uProxyModel", proxy->getSceneIndex());
+    shader.setVec3("uProxyPosition",
+                     proxy->getPosition() +
+                         rotation * (center * proxy->getScale()));
+    shader.setVec3("uProxySize", glm::abs(extent * proxy->getScale()));
+    shader.setMat3("uProxyRotation", rotation);
+  }
+  shader.setInt("uTileSamples", 0);
+  if (mode == TraceMode::AccumulateTrace)
+    mAccumulator->bindTileSamples(0);
+}
+
+void Application::traceImage(TraceMode mode) {
+  setTraceUniforms(*mShader, mode);
+  mDataUBO->bind();
+  mFeedback->bind();
+  mQuad->draw();
+  mDataUBO->unbind();
+}
+
+void Application::tracePrimary(RenderTarget &target, const glm::ivec4 &rect,
+                               bool compute) {
+  if (compute) {
+    setTraceUniforms(mComputeTracer->getShader(), primaryTraceMode());
+    mDataUBO->bind();
+    mFeedback->bind();
+    mComputeTracer->dispatch(target, rect);
+    mDataUBO->unbind();
+    return;
+  }
+  target.bind();
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(rect.x, rect.y, rect.z, rect.w);
+  traceImage(primaryTraceMode());
+  glDisable(GL_SCISSOR_TEST);
+  target.unbind();
+}
+
+
+void Application::traceCorners(int width, int height) {
+  // One texel per block corner, the extra row and column close the last
+  // blocks
+  int block = mSettings->mCornerBlock;
+  mCornerTarget->resize(width / block + 2, height / block + 2);
+  mCornerTarget->bind();
+  traceImage(TraceMode::CornerTrace);
+  mCornerTarget->unbind();
+  mCornerCounter->clear();
+  mCornerPixels = 0;
+}
+
+void Application::traceTiles(int width, int height) {
+  // A new image restarts from the center, the previous one stays visible
+  // where no tile has landed yet. Resizing would leave it undefined, so a
+  // new size is traced into the slice target and shown once it is covered.
+  bool restart = mTraceDirty;
+  if (restart) {
+    mSlicingBack = width != mRenderTarget->getWidth() ||
+                   height != mRenderTarget->getHeight();
+    if (mSlicingBack)
+      mSliceTarget->resize(width, height);
+    else
+      mTargetFactor = mData->getDownsampleFactor();
+    mTileScheduler->reset(width, height, mSettings->mTileSize);
+    mShadowLights = mScene->getLights();
+    mRegionTracker->snapshot(*mScene);
+    mTraceDirty = false;
+    mReshadeDirty = false;
+    mRegionDirty = false;
+    mVisStale = false;
+    mShowReshaded = false;
+  }
+
+  std::vector<glm::ivec4> tiles;
+  mTileScheduler->next(*mSettings, tiles);
+  int tracedPixels = 0;
+  for (const glm::ivec4 &tile : tiles) {
+    tracedPixels += tile.z * tile.w;
+  }
+  mTraceTimer->begin(tracedPixels);
+  if (restart && mSettings->mCornerSampling)
+    traceCorners(width, height);
+  RenderTarget &target = mSlicingBack ? *mSliceTarget : *mRenderTarget;
+  for (const glm::ivec4 &tile : tiles) {
+    tracePrimary(target, tile, mComputeTracer != nullptr);
+  }
+  mTraceTimer->end();
+  if (mSlicingBack && mTileScheduler->isDone()) {
+    std::swap(mRenderTarget, mSliceTarget);
+    mTargetFactor = mData->getDownsampleFactor();
+    mSlicingBack = false;
+  }
+  if (mSettings->mCornerSampling) {
+    mCornerPixels += tracedPixels;
+    mCornerReadPending = true;
+  }
+
+  mStats->mTilesPerFrame = tiles.size();
+  mStats->mTilesDone = mTileScheduler->getDoneCount();
+  mStats->mTileCount = mTileScheduler->getTileCount();
+}
+
+const TraceMode Application::primaryTraceMode() const {
+  return mSettings->mCornerSampling ? TraceMode::InterpolateTrace
+                                    : TraceMode::FullTrace;
+}
+
+void Application::reshadeImage() {
+  // Vis buffer of whichever target the last trace went to
+  int width, height;
+  mShader->use();
+  mShader->setInt("uVis", VIS_UNIT);
+  mShader->setInt("uShadowMask", SHADOW_MASK_UNIT);
+  if (mSettings->mReprojection) {
+    width = mReprojector->getWidth();
+    height = mReprojector->getHeight();
+    mReprojector->bindVis(VIS_UNIT, SHADOW_MASK_UNIT);
+  } else {
+    width = mRenderTarget->getWidth();
+    height = mRenderTarget->getHeight();
+    mRenderTarget->bindTexture(VIS_UNIT, 1);
+    mRenderTarget->bindTexture(SHADOW_MASK_UNIT, 2);
+  }
+  // Moved lights need new shadow rays, everything else keeps the mask
+  mShader->setInt("uReshade", true);
+  mShader->setInt("uReshadeShadows", shadowsChanged());
+
+  mReshadeTarget->resize(width, height);
+  mReshadeTarget->bind();
+  mTraceTimer->begin(0);
+  mDataUBO->bind();
+  mQuad->draw();
+  mDataUBO->unbind();
+  mTraceTimer->end();
+  mReshadeTarget->unbind();
+  mReshadeDirty = false;
+  mShowReshaded = true;
+}
+
+bool Application::shadowsChanged() const {
+  const std::vector<Light> &lights = mScene->getLights();
+  if (lights.size() != mShadowLights.size())
+    return true;
+  for (int i = 0; i < lights.size(); i++) {
+    const Light &light = lights[i];
+    const Light &traced = mShadowLights[i];
+    if (light.mType != traced.mType || light.mPosition != traced.mPosition ||
+        light.mPitch != traced.mPitch || light.mYaw != traced.mYaw)
+      return true;
+  }
+  return false;
+}
+
+void Application::accumulateFrame() {
+  int passes = mAccumulator->beginFrame(*mSettings);
+  int targetPixels = mAccumulator->getWidth() * mAccumulator->getHeight();
+  for (int pass = 0; pass < passes; pass++) {
+    mAccumulator->beginPass();
+    // Only full frame passes are comparable for the resolution controller
+    if (pass == 0)
+      mTraceTimer->begin(mAccumulator->getActiveTiles() ==
+                                 mAccumulator->getTileCount()
+                             ? targetPixels
+                             : 0);
+    traceImage(TraceMode::AccumulateTrace);
+    if (pass == 0)
+      mTraceTimer->end();
+    mAccumulator->endPass();
+  }
+  if (passes > 0)
+    mAccumulator->resolve(*mResolveShader, *mQuad, *mSettings);
+
+  // Every interval samples and once more for the final image
+  float samples = mAccumulator->getAverageSamples();
+  if (mSettings->mDenoise && samples > mDenoisedSamples &&
+      (samples - mDenoisedSamples >= mSettings->mDenoiseInterval ||
+       mAccumulator->isConverged()))
+    denoiseImage();
+
+  mStats->mSamples = mAccumulator->getAverageSamples();
+  mStats->mActiveTiles = mAccumulator->getActiveTiles();
+  mStats->mNoise = mAccumulator->getMaxNoise();
+  mStats->mSamplesPerSecond = mAccumulator->getSamplesPerSecond();
+  mStats->mAccumulationTime = mAccumulator->getElapsed();
+  mStats->mConverged = mAccumulator->isConverged();
+}
+
+void Application::denoiseImage() {
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<float> color, normalDepth, albedo, denoised;
+  int width, height;
+  mAccumulator->readResolved(color, normalDepth, albedo, width, height);
+  mDenoiser->denoise(color, normalDepth, albedo, width, height, *mSettings,
+                     denoised);
+  mAccumulator->setDenoised(denoised);
+  mDenoisedSamples = mAccumulator->getAverageSamples();
+
+  std::chrono::duration<double, std::milli> totalTime =
+      std::chrono::high_resolution_clock::now() - start;
+  mStats->mDenoiseTime = mDenoiser->getTime();
+  mStats->mDenoiseTotalTime = totalTime.count();
+}
+
+bool Application::isAccumulating() const {
+  return mSettings->mProgressive && !mAccumulator->isConverged();
+}
+
+bool Application::isInterleaving() const {
+  return mSettings->mInterleave > 1 && !mSettings->mProgressive &&
+         !mSettings->mReprojection && !mSettings->mTimeSlicing;
+}
+
+bool Application::isSlicing() const {
+  return mSettings->mTimeSlicing && !mSettings->mProgressive &&
+         !mSettings->mReprojection && !mTileScheduler->isDone();
+}
+
+void Application::loadShader() {
+  std::vector<std::string> defines = shaderConstants();
+  if (mSettings->mStacklessTraversal)
+    defines.push_back("STACKLESS_TRAVERSAL");
+  std::vector<std::string> fragmentDefines = defines;
+  fragmentDefines.push_back("STACK_SIZE " + std::to_string(TRACE_STACK_SIZE));
+  mShader = std::make_unique<Shader>(SHADERS "shader.vert",
+                                     SHADERS "shader.frag", fragmentDefines);
+  if (mComputeTracer)
+    mComputeTracer->load(SHADERS "shader.frag", defines);
+}
+
+void Application::updateBVH() {
+  auto buildStart = std::chrono::high_resolution_clock::now();
+  rebuildBVH();
+  checkStackSize();
+  std::chrono::duration<double, std::milli> buildTime =
+      std::chrono::high_resolution_clock::now() - buildStart;
+  mStats->mBVHBuildTime = buildTime.count();
+}
+
+void Application::rebuildBVH() {
+  // Record offsets in the vis buffer change with the hierarchy
+  mReprojector->invalidate();
+  mInterleaver->invalidate();
+
+  // Prebuilt hierarchy, materials still come from the loaded models
+  if (!mBVHFile.empty() && mData->loadBVH(mBVHFile)) {
+    mData->updatePrimitives(*mScene);
+    mData->updateMaterial(*mScene, false);
+    return;
+  }
+  // Streamed model triangles are read from their meshes and the chunk file
+  mScene->setKeepTriangles(!mSettings->mStreamGeometry);
+  if (!mSettings->mStreamGeometry) {
+    mData->updateBVH(*mScene, *mSettings);
+    mData->updatePrimitives(*mScene);
+    mData->updateMaterial(*mScene, false);
+    return;
+  }
+  mChunkCache->setBudget((size_t)mSettings->mResidencyBudget << 20);
+  // Chunked once per set of models, moves only place the chunks again
+  if (!mChunkCache->build(mScene->getModels(), mSettings->mChunkSize))
+    mChunkCache->place(mScene->getModels());
+  mVisibleChunks = streamedChunks();
+  mData->updateBVH(*mChunkCache, mVisibleChunks, *mScene, *mSettings);
+  mData->updatePrimitives(*mScene);
+  mData->updateMaterial(*mScene, false);
+}
+
+bool Application::updateStreamedChunks() {
+  if (!mSettings->mStreamGeometry)
+    return false;
+  std::vector<int> visibleChunks = streamedChunks();
+  if (visibleChunks == mVisibleChunks)
+    return false;
+  mVisibleChunks = visibleChunks;
+  mData->updateBVH(*mChunkCache, mVisibleChunks, *mScene, *mSettings);
+  mData->updatePrimitives(*mScene);
+  mData->updateMaterial(*mScene, false);
+  mReprojector->invalidate();
+  mInterleaver->invalidate();
+  checkStackSize();
+  return true;
+}
+
+std::vector<int> Application::streamedChunks() {
+  std::vector<int> chunks = mChunkCache->visibleChunks(*mCamera);
+  mCasterChunks = 0;
+  if (!mSettings->mShadows)
+    return chunks;
+  std::vector<int> casters =
+      mChunkCache->shadowCasters(chunks, mScene->getLights(), *mCamera);
+  mCasterChunks = casters.size();
+  chunks.insert(chunks.end(), casters.begin(), casters.end());
+  return chunks;
+}
+
+bool Application::expandLazyBVH() {
+  if (!mSettings->mLazyBVH || mData->getUnbuiltCount() == 0)
+    return false;
+
+  // Counts come back a frame or two late instead of stalling on the trace
+  mFeedback->requestRead(mData->getNodeCount());
+  std::vector<int> counts;
+  if (!mFeedback->readRequested(counts))
+    return false;
+
+  // Most hit unbuilt nodes first
+  std::vector<std::pair<int, int>> requested;
+  for (int id = 0; id < counts.size(); id++) {
+    if (counts[id] > 0)
+      requested.push_back({counts[id], id});
+  }
+  if (requested.empty())
+    return false;
+  int expandCount =
+      std::min((int)requested.size(), mSettings->mLazyExpandPerFrame);
+  std::partial_sort(requested.begin(), requested.begin() + expandCount,
+                    requested.end(), std::greater<std::pair<int, int>>());
+  std::vector<int> nodeIDs;
+  for (int i = 0; i < expandCount; i++) {
+    nodeIDs.push_back(requested[i].second);
+  }
+
+  return expandNodes(nodeIDs);
+}
+
+bool Application::expandNodes(const std::vector<int> &nodeIDs) {
+  if (!mData->expandBVH(nodeIDs, *mSettings))
+    return false;
+  // Copies in flight still count the nodes just expanded
+  mFeedback->dropRequests();
+  mData->updatePrimitives(*mScene);
+  mData->updateMaterial(*mScene, false);
+  // Only the rewritten records, new table entries and what follows the
+  // records are uploaded
+  for (const std::pair<int, int> &range : mData->getChangedRanges()) {
+    mDataUBO->update(*mData, range.first, range.second);
+  }
+  mDataUBO->update(*mData, mData->getChangedTail(),
+                   mData->getFloatDataSize() - mData->getChangedTail());
+  mReprojector->invalidate();
+  mInterleaver->invalidate();
+  checkStackSize();
+  return true;
+}
+
+void Application::checkStackSize() {
+  int stackSize = mData->getStackSize();
+  int shaderStackSize = mComputeTracer ? mComputeTracer->getStackSize()
+                                       : TRACE_STACK_SIZE;
+  if (stackSize <= shaderStackSize || stackSize <= mWarnedStackSize)
+    return;
+  mWarnedStackSize = stackSize;
+  std::cout << "BVH traversal needs " << stackSize
+            << " stack entries, the trace shader holds " << shaderStackSize
+            << ", pixels that overflow are drawn magenta" << std::endl;
+}
+
+void Application::updateStats() {
+  mStats->mBVHNodes = mData->getNodeCount();
+  mStats->mUnbuiltNodes = mData->getUnbuiltCount();
+  mStats->mChunkCount = mChunkCache->getChunkCount();
+  mStats->mVisibleChunks = mVisibleChunks.size() - mCasterChunks;
+  mStats->mCasterChunks = mCasterChunks;
+  mStats->mDroppedChunks = mData->getDroppedChunks();
+  mStats->mResidentChunks = mChunkCache->getResidentCount();
+  mStats->mResidentBytes = mChunkCache->getResidentBytes();
+  mStats->mCacheHitRate = mChunkCache->getHitRate();
+}
+
 void Application::processInput() {
   if (glfwGetKey(mWindow.get(), GLFW_KEY_ESCAPE) == GLFW_PRESS)
     glfwSetWindowShouldClose(mWindow.get(), true);
   if (glfwGetKey(mWindow.get(), GLFW_KEY_R) == GLFW_PRESS)
     saveImage("../renders/hello.png", mCamera->getResolution().x,
               mCamera->getResolution().y);
+  if (glfwGetKey(mWindow.get(), GLFW_KEY_C) == GLFW_PRESS) {
+    double currentTime = glfwGetTime();
+    if (currentTime - mCompareTimer > 0.3) {
+      mCompareRequested = true;
+      mCompareTimer = currentTime;
+    }
+  }
+  if (glfwGetKey(mWindow.get(), GLFW_KEY_V) == GLFW_PRESS) {
+    double currentTime = glfwGetTime();
+    if (currentTime - mCompareTimer > 0.3) {
+      mCornerCompareRequested = true;
+      mCompareTimer = currentTime;
+    }
+  }
+  if (glfwGetKey(mWindow.get(), GLFW_KEY_B) == GLFW_PRESS) {
+    double currentTime = glfwGetTime();
+    if (currentTime - mCompareTimer > 0.3) {
+      mBackendCompareRequested = true;
+      mCompareTimer = currentTime;
+    }
+  }
   if (glfwGetKey(mWindow.get(), GLFW_KEY_N) == GLFW_PRESS) {
     double currentTime = glfwGetTime();
     if (currentTime - mEditorToggleTimer > 0.3) {
@@ -207,10 +981,136 @@ void Application::framebuffer_size_callback(GLFWwindow *window, int width,
     glViewport(0, 0, width, height);
     app->mCamera->setResolution(width, height);
     app->mData->updateCamera(*(app->mCamera));
-    app->mDataUBO->update(*(app->mData));
+    app->mDataUBO->update(*(app->mData), REAL_CAMERA_OFFSET,
+                          REAL_LIGHTS_OFFSET - REAL_CAMERA_OFFSET);
+    app->markChanged();
   }
 }
 
+void Application::compareWithCPU() {
+  int width = mCamera->getResolution().x;
+  int height = mCamera->getResolution().y;
+  std::vector<unsigned char> gpuPixels(width * height * 4);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+               gpuPixels.data());
+
+  std::vector<unsigned char> cpuPixels;
+  mCPURenderer->render(*mData, width, height, cpuPixels);
+  // Lazy nodes the CPU rays reached are built and the image traced again,
+  // until the rays reach no unbuilt node
+  bool expanded = false;
+  while (expandNodes(mCPURenderer->getReachedUnbuilt())) {
+    expanded = true;
+    mCPURenderer->render(*mData, width, height, cpuPixels);
+  }
+  if (expanded)
+    mTraceDirty = true;
+  ImageDifference difference =
+      CPURenderer::compare(gpuPixels, cpuPixels, CPU_COMPARE_TOLERANCE);
+  const CPURenderStats &stats = mCPURenderer->getStats();
+
+  std::cout << "CPU render: " << stats.mRenderTime * 1000.0 << " ms, "
+            << stats.mRaysPerSecond << " rays/s" << std::endl;
+  std::cout << "GPU/CPU mean error " << difference.mMeanError << ", max "
+            << difference.mMaxError << ", "
+            << difference.mPixelsOverTolerance * 100.0f
+            << "% pixels over tolerance" << std::endl;
+}
+
+void Application::compareCornerSampling() {
+  if (!mSettings->mCornerSampling || mSettings->mProgressive ||
+      mSettings->mReprojection) {
+    std::cout << "Corner sampling is not in use" << std::endl;
+    return;
+  }
+  // The same view traced per pixel into a scratch target
+  RenderTarget reference;
+  reference.init(mRenderTarget->getWidth(), mRenderTarget->getHeight(), true);
+  reference.bind();
+  traceImage();
+  reference.unbind();
+
+  int width, height;
+  std::vector<float> sampledColor, referenceColor;
+  mRenderTarget->readLevel(0, sampledColor, width, height);
+  reference.readLevel(0, referenceColor, width, height);
+  reference.clean();
+
+  // Alpha holds the noise estimate, compared as opaque
+  std::vector<unsigned char> sampledPixels(sampledColor.size());
+  std::vector<unsigned char> referencePixels(referenceColor.size());
+  for (int i = 0; i < sampledColor.size(); i++) {
+    bool alpha = i % 4 == 3;
+    sampledPixels[i] =
+        alpha ? 255 : std::clamp(sampledColor[i], 0.0f, 1.0f) * 255.0f + 0.5f;
+    referencePixels[i] =
+        alpha ? 255
+              : std::clamp(referenceColor[i], 0.0f, 1.0f) * 255.0f + 0.5f;
+  }
+  ImageDifference difference = CPURenderer::compare(
+      sampledPixels, referencePixels, CPU_COMPARE_TOLERANCE);
+  mStats->mCornerError = difference.mMeanError;
+  mStats->mCornerErrorPixels = difference.mPixelsOverTolerance;
+
+  std::cout << "Corner sampling skipped " << mStats->mCornerSkipped * 100.0f
+            << "% of pixels, mean error " << difference.mMeanError
+            << ", max " << difference.mMaxError << ", "
+            << difference.mPixelsOverTolerance * 100.0f
+            << "% pixels over tolerance" << std::endl;
+}
+
+void Application::compareBackends() {
+  if (!mComputeTracer) {
+    std::cout << "The compute backend is not in use, start with --compute"
+              << std::endl;
+    return;
+  }
+  // The current view traced whole by each backend into its own target,
+  // timed with the pipeline drained before and after
+  int width = mRenderTarget->getWidth();
+  int height = mRenderTarget->getHeight();
+  glm::ivec4 rect(0, 0, width, height);
+  RenderTarget targets[2];
+  double times[2];
+  for (int compute = 0; compute < 2; compute++) {
+    targets[compute].init(width, height, true, {0, 3, 4});
+    tracePrimary(targets[compute], rect, compute);
+    glFinish();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int run = 0; run < BACKEND_COMPARE_RUNS; run++) {
+      tracePrimary(targets[compute], rect, compute);
+    }
+    glFinish();
+    std::chrono::duration<double, std::milli> time =
+        std::chrono::high_resolution_clock::now() - start;
+    times[compute] = time.count() / BACKEND_COMPARE_RUNS;
+  }
+  mStats->mFragmentTraceTime = times[0];
+  mStats->mComputeTraceTime = times[1];
+
+  // Both trace the same rays, the images should match
+  std::vector<float> colors[2];
+  std::vector<unsigned char> pixels[2];
+  for (int i = 0; i < 2; i++) {
+    targets[i].readLevel(0, colors[i], width, height);
+    targets[i].clean();
+    pixels[i].resize(colors[i].size());
+    for (int j = 0; j < colors[i].size(); j++) {
+      pixels[i][j] = j % 4 == 3
+                         ? 255
+                         : std::clamp(colors[i][j], 0.0f, 1.0f) * 255.0f + 0.5f;
+    }
+  }
+  ImageDifference difference =
+      CPURenderer::compare(pixels[0], pixels[1], CPU_COMPARE_TOLERANCE);
+
+  glm::ivec2 localSize = mComputeTracer->getLocalSize();
+  std::cout << "Trace " << width << "x" << height << ": fragment "
+            << times[0] << " ms, compute " << localSize.x << "x"
+            << localSize.y << " " << times[1] << " ms, max difference "
+            << difference.mMaxError << std::endl;
+}
+
 void Application::saveImage(const std::string &filename, int width,
                             int height) {
   std::vector<unsigned char> pixels(width * height * 4);
@@ -1,5 +1,7 @@
 #include "BVHNode.h"
+#include <algorithm>
 #include <iostream>
+#include <numeric>
 
 int BVHNode::mIdCounter = -1;
 
@@ -27,14 +29,18 @@ void BVHNode::clean() {
   }
 }
 
-BVHNode *BVHNode::createLeafNode(const std::vector<Triangle> &triangles) {
+BVHNode *BVHNode::createLeafNode(const std::vector<Triangle> &triangles,
+                                 const std::vector<int> &indices, int begin,
+                                 int end) {
   BVHNode *node = new BVHNode;
   node->mID = mIdCounter;
   node->mLeftID = -1;
   node->mRightID = -1;
   node->mIsLeaf = true;
-  node->mTriangles = triangles;
-  node->computeBoundingBox();
+  for (int i = begin; i < end; i++) {
+    node->mTriangles.push_back(triangles[indices[i]]);
+  }
+  node->computeBoundingBox(triangles, indices, begin, end);
   node->mLeft = nullptr;
   node->mRight = nullptr;
   return node;
@@ -42,18 +48,45 @@ BVHNode *BVHNode::createLeafNode(const std::vector<Triangle> &triangles) {
 
 BVHNode *BVHNode::buildBVH(const std::vector<Triangle> &triangles,
                            const int maxDepth, int maxTrianglesInLeaf,
-                           int depth) {
+                           int depth, int lazyDepth) {
+  std::vector<int> indices(triangles.size());
+  std::iota(indices.begin(), indices.end(), 0);
+  return buildBVH(triangles, indices, 0, indices.size(), maxDepth,
+                  maxTrianglesInLeaf, depth, lazyDepth);
+}
+
+BVHNode *BVHNode::buildBVH(const std::vector<Triangle> &triangles,
+                           std::vector<int> &indices, int begin, int end,
+                           const int maxDepth, int maxTrianglesInLeaf,
+                           int depth, int lazyDepth) {
   mIdCounter++;
-  if (depth == maxDepth || triangles.size() <= maxTrianglesInLeaf) {
-    return createLeafNode(triangles);
+  if (depth == maxDepth || end - begin <= maxTrianglesInLeaf) {
+    BVHNode *leaf = createLeafNode(triangles, indices, begin, end);
+    leaf->mDepth = depth;
+    return leaf;
+  }
+  if (depth == lazyDepth) {
+    BVHNode *unbuilt = new BVHNode;
+    unbuilt->mID = mIdCounter;
+    unbuilt->mLeftID = -1;
+    unbuilt->mRightID = -1;
+    unbuilt->mIsLeaf = true;
+    unbuilt->mIsBuilt = false;
+    unbuilt->mDepth = depth;
+    unbuilt->mBegin = begin;
+    unbuilt->mEnd = end;
+    unbuilt->computeBoundingBox(triangles, indices, begin, end);
+    unbuilt->mLeft = nullptr;
+    unbuilt->mRight = nullptr;
+    return unbuilt;
   }
 
   BVHNode *node = new BVHNode;
   node->mID = mIdCounter;
   node->mLeftID = mIdCounter + 1;
   node->mIsLeaf = false;
-  node->mTriangles = triangles;
-  node->computeBoundingBox();
+  node->mDepth = depth;
+  node->computeBoundingBox(triangles, indices, begin, end);
 
   glm::vec3 mid = (node->getMaxVert() + node->getMinVert()) / 2.0f;
   glm::vec3 sizeOfAABB = node->getMaxVert() - node->getMinVert();
@@ -69,30 +102,82 @@ BVHNode *BVHNode::buildBVH(const std::vector<Triangle> &triangles,
   else if (height > width && height > length)
     splitCoord = 2;
 
-  std::vector<Triangle> leftTriangles;
-  std::vector<Triangle> rightTriangles;
+  // Stable keeps the triangle order of the leaves
+  int split =
+      std::stable_partition(indices.begin() + begin, indices.begin() + end,
+                            [&](int index) {
+                              return triangles[index].mCenter[splitCoord] <
+                                     mid[splitCoord];
+                            }) -
+      indices.begin();
+  node->mSplitAxis = splitCoord;
+
+  node->mLeft = buildBVH(triangles, indices, begin, split, maxDepth,
+                         maxTrianglesInLeaf, depth + 1, lazyDepth);
+  node->mRightID = mIdCounter + 1;
+  node->mRight = buildBVH(triangles, indices, split, end, maxDepth,
+                          maxTrianglesInLeaf, depth + 1, lazyDepth);
 
-  for (const Triangle &triangle : node->mTriangles) {
-    if (triangle.mCenter[splitCoord] >= mid[splitCoord]) {
-      leftTriangles.push_back(triangle);
-    } else {
-      rightTriangles.push_back(triangle);
-    }
-  }
+  return node;
+}
+
+void BVHNode::expand(const std::vector<Triangle> &triangles,
+                     std::vector<int> &indices, const int maxDepth,
+                     const int maxTrianglesInLeaf, const int lazyLevels) {
+  if (mIsBuilt)
+    return;
+
+  // Build the next levels in place, ids are assigned by the caller
+  BVHNode *subtree =
+      buildBVH(triangles, indices, mBegin, mEnd, maxDepth,
+               maxTrianglesInLeaf, mDepth, mDepth + lazyLevels);
+  mIsLeaf = subtree->mIsLeaf;
+  mIsBuilt = subtree->mIsBuilt;
+  mSplitAxis = subtree->mSplitAxis;
+  mTriangles = std::move(subtree->mTriangles);
+  mLeft = subtree->mLeft;
+  mRight = subtree->mRight;
+  subtree->mLeft = nullptr;
+  subtree->mRight = nullptr;
+  delete subtree;
+}
 
-  node->mLeft = buildBVH(leftTriangles, maxDepth, maxTrianglesInLeaf, depth + 1);
+void BVHNode::assignIDs(BVHNode *node) {
+  mIdCounter++;
+  node->mID = mIdCounter;
+  if (node->mIsLeaf)
+    return;
+  node->mLeftID = mIdCounter + 1;
+  assignIDs(node->mLeft);
   node->mRightID = mIdCounter + 1;
-  node->mRight = buildBVH(rightTriangles, maxDepth, maxTrianglesInLeaf, depth + 1);
+  assignIDs(node->mRight);
+}
 
-  return node;
+void BVHNode::assignChildIDs(BVHNode *node, int &nextID) {
+  if (node->mIsLeaf)
+    return;
+  node->mLeftID = node->mLeft->mID = nextID++;
+  assignChildIDs(node->mLeft, nextID);
+  node->mRightID = node->mRight->mID = nextID++;
+  assignChildIDs(node->mRight, nextID);
 }
 
-void BVHNode::computeBoundingBox() {
+void BVHNode::collectNodes(BVHNode *node, std::vector<BVHNode *> &nodes) {
+  if (!node)
+    return;
+  nodes.push_back(node);
+  collectNodes(node->mLeft, nodes);
+  collectNodes(node->mRight, nodes);
+}
+
+void BVHNode::computeBoundingBox(const std::vector<Triangle> &triangles,
+                                 const std::vector<int> &indices, int begin,
+                                 int end) {
   float max = std::numeric_limits<float>::max();
   glm::vec3 minVert = glm::vec3(max, max, max);
   glm::vec3 maxVert = glm::vec3(-max, -max, -max);
-  for (int j = 0; j < mTriangles.size(); j++) {
-    const Triangle &triangle = mTriangles[j];
+  for (int j = begin; j < end; j++) {
+    const Triangle &triangle = triangles[indices[j]];
     for (int k = 0; k < 3; k++) {
       const Vertex &vert = triangle.mVertices[k];
       for (int i = 0; i < 3; i++) {
@@ -104,14 +189,17 @@ void BVHNode::computeBoundingBox() {
   mMaxVert = maxVert;
   mMinVert = minVert;
 }
+
 int BVHNode::calculateNodeSize(const BVHNode *node) {
   int size = 0;
 
   size += 6; // aabb
   size += 1; // isLeaf
 
-  if (!node->mIsLeaf) {
-    size += 2; // left/right
+  // Unbuilt nodes have no triangles yet and reserve the inner node fields,
+  // expanding rewrites them in place
+  if (!node->mIsLeaf || !node->mIsBuilt) {
+    size += 3; // left/right, split axis
     return size;
   }
   size += 1; // triangle count
@@ -0,0 +1,1055 @@
+#include "CPURenderer.h"
+#include "Float8.h"
+
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+#define EPSILON 0.000001f
+#define STACK_SIZE 100
+#define SHADOW_BIAS 0.001f
+#define SHADOW_FACTOR 0.2f
+
+namespace {
+
+void writePixel(std::vector<unsigned char> &pixels, int width, int x, int y,
+                const glm::vec3 &color) {
+  size_t index = ((size_t)y * width + x) * 4;
+  for (int c = 0; c < 3; c++) {
+    float value = glm::clamp(color[c], 0.0f, 1.0f);
+    pixels[index + c] = (unsigned char)(value * 255.0f + 0.5f);
+  }
+}
+
+// Fixed size traversal stack, on the heap for hierarchies deeper than it
+// holds
+class TraversalStack {
+public:
+  explicit TraversalStack(int size) {
+    if (size > STACK_SIZE) {
+      mHeap.resize(size);
+      mEntries = mHeap.data();
+    }
+  }
+  int &operator[](int index) { return mEntries[index]; }
+  int *data() { return mEntries; }
+
+private:
+  std::array<int, STACK_SIZE> mFixed;
+  std::vector<int> mHeap;
+  int *mEntries = mFixed.data();
+};
+
+} // namespace
+
+struct CPURenderer::RayPacket {
+  Ray mRays[PACKET_SIZE];
+  int mActive; // lane bits
+  Vec3x8 mOrigin;
+  Vec3x8 mDirection;
+  Vec3x8 mInvDirection;
+  // Bounds over the active lanes for culling nodes for the whole packet,
+  // only valid when every axis has one direction sign
+  bool mCoherent;
+  glm::vec3 mOriginMin;
+  glm::vec3 mOriginMax;
+  glm::vec3 mInvDirectionMin;
+  glm::vec3 mInvDirectionMax;
+  glm::vec3 mDirectionSum; // orders children for the whole packet
+};
+
+CPURenderer::CPURenderer(int threads) {
+  mThreads = threads > 0 ? threads : std::thread::hardware_concurrency();
+  mThreads = std::max(mThreads, 1);
+}
+
+void CPURenderer::render(const Data &data, int width, int height,
+                         std::vector<unsigned char> &pixels) {
+  setData(data);
+  pixels.assign((size_t)width * height * 4, 255);
+
+  int tilesX = (width + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+  int tilesY = (height + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+  int tileCount = tilesX * tilesY;
+  std::atomic<int> nextTile(0);
+  std::atomic<long long> nodeVisits(0);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  auto worker = [&]() {
+    long long workerVisits = 0;
+    for (int tile = nextTile++; tile < tileCount; tile = nextTile++) {
+      int x0 = (tile % tilesX) * CPU_TILE_SIZE;
+      int y0 = (tile / tilesX) * CPU_TILE_SIZE;
+      int x1 = std::min(x0 + CPU_TILE_SIZE, width);
+      int y1 = std::min(y0 + CPU_TILE_SIZE, height);
+      if (mPacketMode) {
+        for (int y = y0; y < y1; y += PACKET_HEIGHT) {
+          for (int x = x0; x < x1; x += PACKET_WIDTH) {
+            glm::vec2 fragCoords[PACKET_SIZE];
+            glm::vec3 colors[PACKET_SIZE];
+            int activeMask = 0;
+            for (int lane = 0; lane < PACKET_SIZE; lane++) {
+              int px = x + lane % PACKET_WIDTH;
+              int py = y + lane / PACKET_WIDTH;
+              fragCoords[lane] = glm::vec2(px + 0.5f, py + 0.5f);
+              if (px < x1 && py < y1)
+                activeMask |= 1 << lane;
+            }
+            tracePacket(fragCoords, activeMask, colors, workerVisits);
+            for (int lane = 0; lane < PACKET_SIZE; lane++) {
+              if (activeMask & (1 << lane))
+                writePixel(pixels, width, x + lane % PACKET_WIDTH,
+                           y + lane / PACKET_WIDTH, colors[lane]);
+            }
+          }
+        }
+        continue;
+      }
+      for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+          // Pixel centers like gl_FragCoord
+          Hit hit = traverseBVH(cameraRay(glm::vec2(x + 0.5f, y + 0.5f)));
+          workerVisits += hit.mNodeVisits;
+          writePixel(pixels, width, x, y, shade(hit));
+        }
+      }
+    }
+    nodeVisits += workerVisits;
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < mThreads; i++) {
+    threads.emplace_back(worker);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  std::chrono::duration<double> renderTime =
+      std::chrono::high_resolution_clock::now() - start;
+  mStats.mRays = (long long)width * height;
+  mStats.mRenderTime = renderTime.count();
+  mStats.mRaysPerSecond = mStats.mRays / std::max(mStats.mRenderTime, 1e-9);
+  mStats.mThreads = mThreads;
+  mStats.mPacketMode = mPacketMode;
+  mStats.mGroupMode = mGroupMode;
+  mStats.mOrderedMode = mOrderedMode;
+  mStats.mNodeVisits = nodeVisits;
+}
+
+void CPURenderer::setData(const Data &data) {
+  mData = data.getData();
+  mStackSize = data.getStackSize();
+  mReached = std::vector<std::atomic<char>>(
+      data.getUnbuiltCount() > 0 ? data.getNodeCount() : 0);
+  buildTriangleGroups();
+}
+
+std::vector<int> CPURenderer::getReachedUnbuilt() const {
+  std::vector<int> nodeIDs;
+  for (int id = 0; id < mReached.size(); id++) {
+    if (mReached[id].load(std::memory_order_relaxed))
+      nodeIDs.push_back(id);
+  }
+  return nodeIDs;
+}
+
+void CPURenderer::markReached(int nodeIndex, float leafFlag) const {
+  if (leafFlag == UNBUILT_LEAF && nodeIndex < mReached.size())
+    mReached[nodeIndex].store(1, std::memory_order_relaxed);
+}
+
+void CPURenderer::buildTriangleGroups() {
+  mGroups.clear();
+  mPrimitiveRecords.clear();
+  mLeafGroups.clear();
+
+  int bvhOffset = (int)mData[BVH_OFFSET];
+  std::vector<int> stack = {0};
+  while (!stack.empty()) {
+    int nodeIndex = stack.back();
+    stack.pop_back();
+    int offset = (int)mData[bvhOffset + nodeIndex] + 6;
+    if (getFloat(offset) != 0.0f) {
+      addLeafGroups(nodeIndex);
+    } else {
+      stack.push_back(getInt(offset));
+      stack.push_back(getInt(offset));
+    }
+  }
+}
+
+void CPURenderer::addLeafGroups(int nodeIndex) {
+  if (nodeIndex >= (int)mLeafGroups.size())
+    mLeafGroups.resize(nodeIndex + 1);
+  LeafGroups &leaf = mLeafGroups[nodeIndex];
+  leaf.mFirstGroup = mGroups.size();
+  leaf.mFirstPrimitive = mPrimitiveRecords.size();
+
+  int offset = (int)mData[(int)mData[BVH_OFFSET] + nodeIndex] + 7;
+  int triangleCount = getInt(offset);
+  int lane = TRIANGLE_GROUP_SIZE;
+  for (int i = 0; i < triangleCount; i++, offset += 8) {
+    int recordOffset = offset;
+    getInt(recordOffset);
+    getInt(recordOffset);
+    int indices[3];
+    for (int k = 0; k < 3; k++) {
+      indices[k] = getInt(recordOffset);
+    }
+    if (indices[0] < 0) {
+      mPrimitiveRecords.push_back(offset);
+      continue;
+    }
+
+    if (lane == TRIANGLE_GROUP_SIZE) {
+      mGroups.emplace_back(); // zeroed, so padding lanes are degenerate
+      TriangleGroup &group = mGroups.back();
+      std::fill(group.mRecords, group.mRecords + TRIANGLE_GROUP_SIZE, -1);
+      lane = 0;
+    }
+    glm::vec3 vertices[3];
+    for (int k = 0; k < 3; k++) {
+      int vertexOffset = REAL_VERTICES_OFFSET + indices[k] * 3;
+      vertices[k] = getVec3(vertexOffset);
+    }
+    TriangleGroup &group = mGroups.back();
+    for (int axis = 0; axis < 3; axis++) {
+      group.mVertex0[axis][lane] = vertices[0][axis];
+      group.mEdge1[axis][lane] = vertices[1][axis] - vertices[0][axis];
+      group.mEdge2[axis][lane] = vertices[2][axis] - vertices[0][axis];
+    }
+    group.mRecords[lane++] = offset;
+  }
+  leaf.mGroupCount = mGroups.size() - leaf.mFirstGroup;
+  leaf.mPrimitiveCount = mPrimitiveRecords.size() - leaf.mFirstPrimitive;
+}
+
+glm::vec3 CPURenderer::tracePixel(const glm::vec2 &fragCoord) const {
+  return rayTrace(cameraRay(fragCoord));
+}
+
+CPURenderer::Ray CPURenderer::cameraRay(const glm::vec2 &fragCoord) const {
+  int settingsOffset = REAL_SETTINGS_OFFSET;
+  float factor = getFloat(settingsOffset);
+
+  int offset = REAL_CAMERA_OFFSET;
+  float fov = getFloat(offset);
+  float aspectRatio = getFloat(offset);
+  glm::vec2 resolution;
+  resolution.x = getFloat(offset);
+  resolution.y = getFloat(offset);
+  glm::vec3 position = getVec3(offset);
+  glm::mat3 matrix = getMat3(offset);
+
+  // calculateRayDirection, the GPU traces one texel per block at its center
+  glm::vec2 block(std::floor(fragCoord.x / factor),
+                  std::floor(fragCoord.y / factor));
+  glm::vec2 downsampledCoords = (block + 0.5f) * factor;
+  glm::vec2 normalizedCoords(downsampledCoords.x / resolution.x,
+                             downsampledCoords.y / resolution.y);
+  glm::vec2 ndc(normalizedCoords.x * 2 - 1, normalizedCoords.y * 2 - 1);
+  ndc.x *= aspectRatio;
+  glm::vec3 directionView = glm::normalize(
+      glm::vec3(ndc.x, ndc.y, -1.0f / std::tan(0.5f * glm::radians(fov))));
+
+  Ray ray;
+  ray.mOrigin = position;
+  ray.mDirection = matrix * directionView;
+  return ray;
+}
+
+glm::vec3 CPURenderer::rayTrace(const Ray &ray) const {
+  return shade(traverseBVH(ray));
+}
+
+glm::vec3 CPURenderer::shade(const Hit &hit) const {
+  glm::vec3 closestColor(0.0f);
+  if (!hit.mHit)
+    return closestColor;
+
+  int settingsOffset = REAL_SETTINGS_OFFSET + 1;
+  int viewportMode = getInt(settingsOffset);
+  bool shadows = getFloat(settingsOffset) != 0.0f;
+
+  int materialOffset = (int)mData[MATERIAL_OFFSET];
+  int modelMaterialOffset = (int)mData[materialOffset + hit.mModelIndex];
+  int meshMaterialOffset = modelMaterialOffset + hit.mMeshIndex * 3;
+  glm::vec3 diffuse = getVec3(meshMaterialOffset);
+
+  if (viewportMode == ViewportMode::Flat)
+    return diffuse;
+  if (viewportMode == ViewportMode::Wireframe) {
+    if (hit.mIndices[0] < 0)
+      return diffuse * 0.5f;
+    // computeBarycentricCoordinates
+    glm::vec3 v0 = hit.mVertices[1] - hit.mVertices[0];
+    glm::vec3 v1 = hit.mVertices[2] - hit.mVertices[0];
+    glm::vec3 v2 = hit.mWorldPosition - hit.mVertices[0];
+    float d00 = glm::dot(v0, v0);
+    float d01 = glm::dot(v0, v1);
+    float d11 = glm::dot(v1, v1);
+    float d20 = glm::dot(v2, v0);
+    float d21 = glm::dot(v2, v1);
+    float invDenom = 1.0f / (d00 * d11 - d01 * d01);
+    float v = (d11 * d20 - d01 * d21) * invDenom;
+    float w = (d00 * d21 - d01 * d20) * invDenom;
+    float u = 1.0f - v - w;
+    float factor = 0.01f;
+    if (u <= factor || v <= factor || w <= factor)
+      return glm::vec3(0.8f);
+    return closestColor;
+  }
+
+  glm::vec3 totalColor(0.0f);
+  int lightsOffset = REAL_LIGHTS_OFFSET;
+  int lightsCount = getInt(lightsOffset);
+  for (int i = 0; i < lightsCount; i++) {
+    int type = getInt(lightsOffset);
+    float intensity = getFloat(lightsOffset);
+    float pitch = getFloat(lightsOffset);
+    float yaw = getFloat(lightsOffset);
+    glm::vec3 position = getVec3(lightsOffset);
+    glm::vec3 color = getVec3(lightsOffset);
+
+    glm::vec3 lightDirection(0.0f);
+    float lightIntensity = 0.0f;
+    if (type == LightType::Point) {
+      lightDirection = glm::normalize(position - hit.mWorldPosition);
+      float distance = glm::length(position - hit.mWorldPosition);
+      lightIntensity = intensity / distance;
+    } else if (type == LightType::Directional) {
+      float pitchRadians = glm::radians(pitch);
+      float yawRadians = glm::radians(yaw);
+      lightDirection = glm::normalize(
+          glm::vec3(std::cos(pitchRadians) * std::sin(yawRadians),
+                    std::sin(pitchRadians),
+                    std::cos(pitchRadians) * std::cos(yawRadians)));
+      lightIntensity = intensity;
+    }
+
+    float diffuseIntensity = glm::dot(hit.mNormal, -lightDirection) * 0.5f + 0.5f;
+    glm::vec3 contribution =
+        diffuse * diffuseIntensity * color * lightIntensity;
+
+    // inShadow
+    if (shadows) {
+      Ray shadowRay;
+      float lightDistance = 1e30f;
+      if (type == LightType::Point) {
+        shadowRay.mDirection = lightDirection;
+        lightDistance = glm::length(position - hit.mWorldPosition);
+      } else {
+        shadowRay.mDirection = -lightDirection;
+      }
+      shadowRay.mOrigin =
+          hit.mWorldPosition + shadowRay.mDirection * SHADOW_BIAS;
+      if (occluded(shadowRay, lightDistance - SHADOW_BIAS))
+        contribution *= SHADOW_FACTOR;
+    }
+    totalColor += contribution;
+  }
+  return totalColor;
+}
+
+CPURenderer::Hit CPURenderer::traverseBVH(const Ray &ray) const {
+  Hit hit;
+  intersectGlobalPrimitives(ray, hit);
+
+  int bvhOffset = (int)mData[BVH_OFFSET];
+  TraversalStack stack(mStackSize);
+  int stackPointer = 0;
+  stack[stackPointer++] = 0;
+
+  while (stackPointer > 0) {
+    int currentIndex = stack[--stackPointer];
+    int offset = (int)mData[bvhOffset + currentIndex];
+    glm::vec3 maxVert = getVec3(offset);
+    glm::vec3 minVert = getVec3(offset);
+    hit.mNodeVisits++;
+    float tNear;
+    if (!CPUIntersect::rayAABB(ray, maxVert, minVert, tNear))
+      continue;
+    if (mOrderedMode && tNear > hit.mT)
+      continue;
+
+    // Unbuilt lazy nodes are leaves without triangles here
+    float leafFlag = getFloat(offset);
+    markReached(currentIndex, leafFlag);
+    if (leafFlag != 0.0f && mGroupMode) {
+      intersectLeafGroups(ray, currentIndex, hit);
+    } else if (leafFlag != 0.0f) {
+      int triangleCount = getInt(offset);
+      for (int i = 0; i < triangleCount; i++) {
+        intersectLeafRecord(ray, offset, hit);
+      }
+    } else {
+      int leftIndex = getInt(offset);
+      int rightIndex = getInt(offset);
+      int splitAxis = getInt(offset);
+      pushChildren(stack.data(), stackPointer, leftIndex, rightIndex,
+                   ray.mDirection[splitAxis]);
+    }
+  }
+  if (hit.mHit)
+    hit.mWorldPosition = ray.mOrigin + ray.mDirection * hit.mT;
+  return hit;
+}
+
+bool CPURenderer::occluded(const Ray &ray, float maxT) const {
+  int primitivesOffset = (int)mData[PRIMITIVE_OFFSET];
+  int globalCount = (int)mData[primitivesOffset + 1];
+  for (int i = 0; i < globalCount; i++) {
+    float t;
+    glm::vec3 normal;
+    int model;
+    int index = (int)mData[primitivesOffset + 2 + i];
+    if (intersectPrimitive(ray, index, t, normal, model) && t < maxT)
+      return true;
+  }
+
+  // Child order does not matter for any hit
+  int bvhOffset = (int)mData[BVH_OFFSET];
+  TraversalStack stack(mStackSize);
+  int stackPointer = 0;
+  stack[stackPointer++] = 0;
+  while (stackPointer > 0) {
+    int currentIndex = stack[--stackPointer];
+    int offset = (int)mData[bvhOffset + currentIndex];
+    glm::vec3 maxVert = getVec3(offset);
+    glm::vec3 minVert = getVec3(offset);
+    float tNear;
+    if (!CPUIntersect::rayAABB(ray, maxVert, minVert, tNear) || tNear > maxT)
+      continue;
+    float leafFlag = getFloat(offset);
+    markReached(currentIndex, leafFlag);
+    if (leafFlag != 0.0f) {
+      if (intersectLeafAny(ray, currentIndex, offset, maxT))
+        return true;
+    } else {
+      stack[stackPointer++] = getInt(offset);
+      stack[stackPointer++] = getInt(offset);
+    }
+  }
+  return false;
+}
+
+bool CPURenderer::intersectLeafAny(const Ray &ray, int nodeIndex, int offset,
+                                   float maxT) const {
+  // Triangles first, primitives are the expensive tests
+  if (mGroupMode) {
+    const LeafGroups &leaf = mLeafGroups[nodeIndex];
+    for (int i = 0; i < leaf.mGroupCount; i++) {
+      float t;
+      if (CPUIntersect::rayTriangleGroup(ray, mGroups[leaf.mFirstGroup + i],
+                                         maxT, t) >= 0)
+        return true;
+    }
+    for (int i = 0; i < leaf.mPrimitiveCount; i++) {
+      Hit hit;
+      hit.mT = maxT;
+      int recordOffset = mPrimitiveRecords[leaf.mFirstPrimitive + i];
+      if (intersectLeafRecord(ray, recordOffset, hit))
+        return true;
+    }
+    return false;
+  }
+
+  int triangleCount = getInt(offset);
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < triangleCount; i++) {
+      int recordOffset = offset + i * 8;
+      bool primitive = mData[recordOffset + 2] < 0.0f;
+      if (primitive != (pass == 1))
+        continue;
+      Hit hit;
+      hit.mT = maxT;
+      if (intersectLeafRecord(ray, recordOffset, hit))
+        return true;
+    }
+  }
+  return false;
+}
+
+void CPURenderer::intersectLeafGroups(const Ray &ray, int nodeIndex,
+                                      Hit &hit) const {
+  const LeafGroups &leaf = mLeafGroups[nodeIndex];
+  for (int i = 0; i < leaf.mPrimitiveCount; i++) {
+    int offset = mPrimitiveRecords[leaf.mFirstPrimitive + i];
+    intersectLeafRecord(ray, offset, hit);
+  }
+  for (int i = 0; i < leaf.mGroupCount; i++) {
+    const TriangleGroup &group = mGroups[leaf.mFirstGroup + i];
+    float t;
+    int lane = CPUIntersect::rayTriangleGroup(ray, group, hit.mT, t);
+    if (lane >= 0)
+      readLeafRecord(group.mRecords[lane], t, hit);
+  }
+}
+
+void CPURenderer::readLeafRecord(int offset, float t, Hit &hit) const {
+  hit.mHit = true;
+  hit.mT = t;
+  hit.mModelIndex = getInt(offset);
+  hit.mMeshIndex = getInt(offset);
+  for (int k = 0; k < 3; k++) {
+    hit.mIndices[k] = getInt(offset);
+  }
+  hit.mNormal = getVec3(offset);
+  for (int k = 0; k < 3; k++) {
+    int vertexOffset = REAL_VERTICES_OFFSET + hit.mIndices[k] * 3;
+    hit.mVertices[k] = getVec3(vertexOffset);
+  }
+}
+
+bool CPURenderer::intersectLeafRecord(const Ray &ray, int &offset,
+                                      Hit &hit) const {
+  int modelIndex = getInt(offset);
+  int meshIndex = getInt(offset);
+  int indices[3];
+  for (int k = 0; k < 3; k++) {
+    indices[k] = getInt(offset);
+  }
+  glm::vec3 normal = getVec3(offset);
+
+  float t;
+  if (indices[0] < 0) {
+    glm::vec3 primitiveNormal;
+    int primitiveModel;
+    if (!intersectPrimitive(ray, indices[1], t, primitiveNormal,
+                            primitiveModel) ||
+        t >= hit.mT)
+      return false;
+    hit.mHit = true;
+    hit.mT = t;
+    hit.mModelIndex = primitiveModel;
+    hit.mMeshIndex = 0;
+    for (int k = 0; k < 3; k++) {
+      hit.mIndices[k] = indices[k];
+    }
+    hit.mNormal = primitiveNormal;
+    return true;
+  }
+
+  glm::vec3 vertices[3];
+  for (int k = 0; k < 3; k++) {
+    int vertexOffset = REAL_VERTICES_OFFSET + indices[k] * 3;
+    vertices[k] = getVec3(vertexOffset);
+  }
+  if (!CPUIntersect::rayTriangle(ray, vertices[0], vertices[1], vertices[2],
+                                 t) ||
+      t >= hit.mT)
+    return false;
+  hit.mHit = true;
+  hit.mT = t;
+  hit.mModelIndex = modelIndex;
+  hit.mMeshIndex = meshIndex;
+  for (int k = 0; k < 3; k++) {
+    hit.mIndices[k] = indices[k];
+    hit.mVertices[k] = vertices[k];
+  }
+  hit.mNormal = normal;
+  return true;
+}
+
+void CPURenderer::intersectGlobalPrimitives(const Ray &ray, Hit &hit) const {
+  int primitivesOffset = (int)mData[PRIMITIVE_OFFSET];
+  int globalCount = (int)mData[primitivesOffset + 1];
+  for (int i = 0; i < globalCount; i++) {
+    int index = (int)mData[primitivesOffset + 2 + i];
+    float t;
+    glm::vec3 normal;
+    int modelIndex;
+    if (intersectPrimitive(ray, index, t, normal, modelIndex) && t < hit.mT) {
+      hit.mHit = true;
+      hit.mT = t;
+      hit.mModelIndex = modelIndex;
+      hit.mMeshIndex = 0;
+      hit.mIndices[0] = -1;
+      hit.mIndices[1] = index;
+      hit.mIndices[2] = 0;
+      hit.mNormal = normal;
+    }
+  }
+}
+
+bool CPURenderer::intersectPrimitive(const Ray &ray, int index, float &outT,
+                                     glm::vec3 &outNormal,
+                                     int &outModelIndex) const {
+  int primitivesOffset = (int)mData[PRIMITIVE_OFFSET];
+  int globalCount = (int)mData[primitivesOffset + 1];
+  int offset = primitivesOffset + 2 + globalCount + index * PRIMITIVE_SIZE;
+  int type = getInt(offset);
+  outModelIndex = getInt(offset);
+  glm::vec3 position = getVec3(offset);
+  glm::vec3 size = getVec3(offset);
+  glm::mat3 rotation = getMat3(offset);
+
+  glm::mat3 inverseRotation = glm::transpose(rotation);
+  glm::vec3 origin = inverseRotation * (ray.mOrigin - position);
+  glm::vec3 direction = inverseRotation * ray.mDirection;
+  glm::vec3 normal(0.0f);
+
+  if (type == PrimitiveType::Sphere) {
+    float radius = size.x;
+    float b = glm::dot(origin, direction);
+    float c = glm::dot(origin, origin) - radius * radius;
+    float discriminant = b * b - c;
+    if (discriminant < 0.0f)
+      return false;
+    float root = std::sqrt(discriminant);
+    outT = -b - root;
+    if (outT <= EPSILON)
+      outT = -b + root;
+    if (outT <= EPSILON)
+      return false;
+    normal = (origin + direction * outT) / radius;
+  } else if (type == PrimitiveType::Plane) {
+    if (std::abs(direction.y) < EPSILON)
+      return false;
+    outT = -origin.y / direction.y;
+    if (outT <= EPSILON)
+      return false;
+    glm::vec3 hit = origin + direction * outT;
+    if (size.x > 0.0f && std::abs(hit.x) > size.x)
+      return false;
+    if (size.z > 0.0f && std::abs(hit.z) > size.z)
+      return false;
+    normal = glm::vec3(0.0f, direction.y > 0.0f ? -1.0f : 1.0f, 0.0f);
+  } else if (type == PrimitiveType::Box) {
+    glm::vec3 invDir = 1.0f / direction;
+    glm::vec3 t1 = (-size - origin) * invDir;
+    glm::vec3 t2 = (size - origin) * invDir;
+    glm::vec3 tMin = glm::min(t1, t2);
+    glm::vec3 tMax = glm::max(t1, t2);
+    float tNear = std::max(std::max(tMin.x, tMin.y), tMin.z);
+    float tFar = std::min(std::min(tMax.x, tMax.y), tMax.z);
+    if (tNear > tFar || tFar <= EPSILON)
+      return false;
+    outT = tNear > EPSILON ? tNear : tFar;
+    glm::vec3 hit = (origin + direction * outT) / size;
+    glm::vec3 absHit = glm::abs(hit);
+    if (absHit.x >= absHit.y && absHit.x >= absHit.z)
+      normal = glm::vec3(hit.x < 0.0f ? -1.0f : 1.0f, 0.0f, 0.0f);
+    else if (absHit.y >= absHit.z)
+      normal = glm::vec3(0.0f, hit.y < 0.0f ? -1.0f : 1.0f, 0.0f);
+    else
+      normal = glm::vec3(0.0f, 0.0f, hit.z < 0.0f ? -1.0f : 1.0f);
+  } else {
+    return false;
+  }
+  outNormal = rotation * normal;
+  return true;
+}
+
+void CPURenderer::tracePacket(const glm::vec2 *fragCoords, int activeMask,
+                              glm::vec3 *colors, long long &nodeVisits) const {
+  RayPacket packet;
+  packet.mActive = activeMask;
+  for (int lane = 0; lane < PACKET_SIZE; lane++) {
+    packet.mRays[lane] = cameraRay(fragCoords[lane]);
+  }
+  setupPacket(packet);
+
+  Hit hits[PACKET_SIZE];
+  traversePacket(packet, hits);
+  for (int lane = 0; lane < PACKET_SIZE; lane++) {
+    nodeVisits += hits[lane].mNodeVisits;
+    if (activeMask & (1 << lane))
+      colors[lane] = shade(hits[lane]);
+  }
+}
+
+void CPURenderer::setupPacket(RayPacket &packet) const {
+  float origin[3][PACKET_SIZE];
+  float direction[3][PACKET_SIZE];
+  float invDirection[3][PACKET_SIZE];
+  float max = std::numeric_limits<float>::max();
+  packet.mOriginMin = glm::vec3(max);
+  packet.mOriginMax = glm::vec3(-max);
+  packet.mInvDirectionMin = glm::vec3(max);
+  packet.mInvDirectionMax = glm::vec3(-max);
+  packet.mDirectionSum = glm::vec3(0.0f);
+  for (int lane = 0; lane < PACKET_SIZE; lane++) {
+    const Ray &ray = packet.mRays[lane];
+    for (int axis = 0; axis < 3; axis++) {
+      origin[axis][lane] = ray.mOrigin[axis];
+      direction[axis][lane] = ray.mDirection[axis];
+      invDirection[axis][lane] = 1.0f / ray.mDirection[axis];
+    }
+    if (!(packet.mActive & (1 << lane)))
+      continue;
+    packet.mDirectionSum += ray.mDirection;
+    for (int axis = 0; axis < 3; axis++) {
+      packet.mOriginMin[axis] =
+          std::min(packet.mOriginMin[axis], origin[axis][lane]);
+      packet.mOriginMax[axis] =
+          std::max(packet.mOriginMax[axis], origin[axis][lane]);
+      packet.mInvDirectionMin[axis] =
+          std::min(packet.mInvDirectionMin[axis], invDirection[axis][lane]);
+      packet.mInvDirectionMax[axis] =
+          std::max(packet.mInvDirectionMax[axis], invDirection[axis][lane]);
+    }
+  }
+  packet.mOrigin = {Float8::load(origin[0]), Float8::load(origin[1]),
+                    Float8::load(origin[2])};
+  packet.mDirection = {Float8::load(direction[0]), Float8::load(direction[1]),
+                       Float8::load(direction[2])};
+  packet.mInvDirection = {Float8::load(invDirection[0]),
+                          Float8::load(invDirection[1]),
+                          Float8::load(invDirection[2])};
+
+  packet.mCoherent = packet.mActive != 0;
+  for (int axis = 0; axis < 3; axis++) {
+    bool positive = packet.mInvDirectionMin[axis] > 0.0f;
+    bool negative = packet.mInvDirectionMax[axis] < 0.0f;
+    bool finite = std::isfinite(packet.mInvDirectionMin[axis]) &&
+                  std::isfinite(packet.mInvDirectionMax[axis]);
+    if (!(positive || negative) || !finite)
+      packet.mCoherent = false;
+  }
+}
+
+void CPURenderer::traversePacket(const RayPacket &packet, Hit *hits) const {
+  float closestT[PACKET_SIZE];
+  for (int lane = 0; lane < PACKET_SIZE; lane++) {
+    if (packet.mActive & (1 << lane))
+      intersectGlobalPrimitives(packet.mRays[lane], hits[lane]);
+    closestT[lane] = hits[lane].mT;
+  }
+  Float8 closest = Float8::load(closestT);
+
+  // Lane masks have all bits set
+  float activeLanes[PACKET_SIZE];
+  for (int lane = 0; lane < PACKET_SIZE; lane++) {
+    activeLanes[lane] = (packet.mActive & (1 << lane)) ? -1.0f : 0.0f;
+  }
+  Float8 active = Float8(0.0f) > Float8::load(activeLanes);
+
+  int bvhOffset = (int)mData[BVH_OFFSET];
+  TraversalStack stack(mStackSize);
+  int stackPointer = 0;
+  stack[stackPointer++] = 0;
+  int nodeVisits = 0;
+
+  while (stackPointer > 0) {
+    int currentIndex = stack[--stackPointer];
+    int offset = (int)mData[bvhOffset + currentIndex];
+    glm::vec3 maxVert = getVec3(offset);
+    glm::vec3 minVert = getVec3(offset);
+    nodeVisits++;
+
+    // Whole packet rejection first, then the per lane slab test
+    if (packet.mCoherent) {
+      closest.store(closestT);
+      float maxClosest = 0.0f;
+      for (int lane = 0; lane < PACKET_SIZE; lane++) {
+        if (packet.mActive & (1 << lane))
+          maxClosest = std::max(maxClosest, closestT[lane]);
+      }
+      if (!mOrderedMode)
+        maxClosest = std::numeric_limits<float>::max();
+      if (!intersectPacketInterval(packet, maxVert, minVert, maxClosest))
+        continue;
+    }
+    Float8 t1x = (Float8(minVert.x) - packet.mOrigin.x) * packet.mInvDirection.x;
+    Float8 t2x = (Float8(maxVert.x) - packet.mOrigin.x) * packet.mInvDirection.x;
+    Float8 t1y = (Float8(minVert.y) - packet.mOrigin.y) * packet.mInvDirection.y;
+    Float8 t2y = (Float8(maxVert.y) - packet.mOrigin.y) * packet.mInvDirection.y;
+    Float8 t1z = (Float8(minVert.z) - packet.mOrigin.z) * packet.mInvDirection.z;
+    Float8 t2z = (Float8(maxVert.z) - packet.mOrigin.z) * packet.mInvDirection.z;
+    Float8 tNear = max(max(min(t1x, t2x), min(t1y, t2y)), min(t1z, t2z));
+    Float8 tFar = min(min(max(t1x, t2x), max(t1y, t2y)), max(t1z, t2z));
+    Float8 mask = active & (tNear <= tFar) & (tFar >= Float8(0.0f));
+    if (mOrderedMode)
+      mask = mask & (tNear <= closest);
+    if (movemask(mask) == 0)
+      continue;
+
+    float leafFlag = getFloat(offset);
+    markReached(currentIndex, leafFlag);
+    if (leafFlag != 0.0f) {
+      int triangleCount = getInt(offset);
+      for (int i = 0; i < triangleCount; i++) {
+        intersectPacketLeafRecord(packet, mask, offset, closest, hits);
+      }
+    } else {
+      int leftIndex = getInt(offset);
+      int rightIndex = getInt(offset);
+      int splitAxis = getInt(offset);
+      pushChildren(stack.data(), stackPointer, leftIndex, rightIndex,
+                   packet.mDirectionSum[splitAxis]);
+    }
+  }
+
+  // Visits are shared by the packet, counted once
+  for (int lane = 0; lane < PACKET_SIZE; lane++) {
+    if (packet.mActive & (1 << lane)) {
+      hits[lane].mNodeVisits = nodeVisits;
+      break;
+    }
+  }
+  for (int lane = 0; lane < PACKET_SIZE; lane++) {
+    Hit &hit = hits[lane];
+    if (hit.mHit)
+      hit.mWorldPosition =
+          packet.mRays[lane].mOrigin + packet.mRays[lane].mDirection * hit.mT;
+  }
+}
+
+bool CPURenderer::intersectPacketInterval(const RayPacket &packet,
+                                          const glm::vec3 &maxVert,
+                                          const glm::vec3 &minVert,
+                                          float maxClosest) const {
+  // Interval arithmetic over origins and inverse directions gives a lower
+  // bound of every lane's entry and an upper bound of every lane's exit
+  float tNearLow = -std::numeric_limits<float>::max();
+  float tFarHigh = std::numeric_limits<float>::max();
+  for (int axis = 0; axis < 3; axis++) {
+    bool positive = packet.mInvDirectionMin[axis] > 0.0f;
+    float nearPlane = positive ? minVert[axis] : maxVert[axis];
+    float farPlane = positive ? maxVert[axis] : minVert[axis];
+    float invMin = packet.mInvDirectionMin[axis];
+    float invMax = packet.mInvDirectionMax[axis];
+
+    float nearLow = std::numeric_limits<float>::max();
+    float farHigh = -std::numeric_limits<float>::max();
+    for (float origin :
+         {packet.mOriginMin[axis], packet.mOriginMax[axis]}) {
+      for (float inv : {invMin, invMax}) {
+        nearLow = std::min(nearLow, (nearPlane - origin) * inv);
+        farHigh = std::max(farHigh, (farPlane - origin) * inv);
+      }
+    }
+    tNearLow = std::max(tNearLow, nearLow);
+    tFarHigh = std::min(tFarHigh, farHigh);
+  }
+  return tNearLow <= tFarHigh && tFarHigh >= 0.0f && tNearLow < maxClosest;
+}
+
+void CPURenderer::intersectPacketLeafRecord(const RayPacket &packet,
+                                            Float8 mask, int &offset,
+                                            Float8 &closest,
+                                            Hit *hits) const {
+  int modelIndex = getInt(offset);
+  int meshIndex = getInt(offset);
+  int indices[3];
+  for (int k = 0; k < 3; k++) {
+    indices[k] = getInt(offset);
+  }
+  glm::vec3 normal = getVec3(offset);
+
+  // Primitives are rare in leaves, trace them per lane
+  if (indices[0] < 0) {
+    int lanes = movemask(mask);
+    float closestT[PACKET_SIZE];
+    closest.store(closestT);
+    for (int lane = 0; lane < PACKET_SIZE; lane++) {
+      if (!(lanes & (1 << lane)))
+        continue;
+      int recordOffset = offset - 8;
+      intersectLeafRecord(packet.mRays[lane], recordOffset, hits[lane]);
+      closestT[lane] = hits[lane].mT;
+    }
+    closest = Float8::load(closestT);
+    return;
+  }
+
+  glm::vec3 vertices[3];
+  for (int k = 0; k < 3; k++) {
+    int vertexOffset = REAL_VERTICES_OFFSET + indices[k] * 3;
+    vertices[k] = getVec3(vertexOffset);
+  }
+
+  // Moller-Trumbore, one triangle against all lanes
+  glm::vec3 edge1 = vertices[1] - vertices[0];
+  glm::vec3 edge2 = vertices[2] - vertices[0];
+  Vec3x8 edge1x8 = {Float8(edge1.x), Float8(edge1.y), Float8(edge1.z)};
+  Vec3x8 edge2x8 = {Float8(edge2.x), Float8(edge2.y), Float8(edge2.z)};
+  Vec3x8 vertex0 = {Float8(vertices[0].x), Float8(vertices[0].y),
+                    Float8(vertices[0].z)};
+
+  Vec3x8 h = cross(packet.mDirection, edge2x8);
+  Float8 a = dot(edge1x8, h);
+  Float8 valid = mask & ((a <= Float8(-EPSILON)) | (a >= Float8(EPSILON)));
+  Float8 f = Float8(1.0f) / a;
+  Vec3x8 s = packet.mOrigin - vertex0;
+  Float8 u = f * dot(s, h);
+  valid = valid & (u >= Float8(0.0f)) & (u <= Float8(1.0f));
+  Vec3x8 q = cross(s, edge1x8);
+  Float8 v = f * dot(packet.mDirection, q);
+  valid = valid & (v >= Float8(0.0f)) & (u + v <= Float8(1.0f));
+  Float8 t = f * dot(edge2x8, q);
+  valid = valid & (t > Float8(EPSILON)) & (t < closest);
+
+  int lanes = movemask(valid);
+  if (lanes == 0)
+    return;
+  closest = select(valid, t, closest);
+
+  float tValues[PACKET_SIZE];
+  t.store(tValues);
+  for (int lane = 0; lane < PACKET_SIZE; lane++) {
+    if (!(lanes & (1 << lane)))
+      continue;
+    Hit &hit = hits[lane];
+    hit.mHit = true;
+    hit.mT = tValues[lane];
+    hit.mModelIndex = modelIndex;
+    hit.mMeshIndex = meshIndex;
+    for (int k = 0; k < 3; k++) {
+      hit.mIndices[k] = indices[k];
+      hit.mVertices[k] = vertices[k];
+    }
+    hit.mNormal = normal;
+  }
+}
+
+void CPURenderer::pushChildren(int *stack, int &stackPointer, int leftIndex,
+                               int rightIndex, float direction) const {
+  // Left holds the lower half, push the near child last
+  if (mOrderedMode && direction > 0.0f) {
+    stack[stackPointer++] = rightIndex;
+    stack[stackPointer++] = leftIndex;
+  } else {
+    stack[stackPointer++] = leftIndex;
+    stack[stackPointer++] = rightIndex;
+  }
+}
+
+glm::vec3 CPURenderer::getVec3(int &offset) const {
+  glm::vec3 vector(mData[offset], mData[offset + 1], mData[offset + 2]);
+  offset += 3;
+  return vector;
+}
+
+glm::mat3 CPURenderer::getMat3(int &offset) const {
+  glm::vec3 column0 = getVec3(offset);
+  glm::vec3 column1 = getVec3(offset);
+  glm::vec3 column2 = getVec3(offset);
+  return glm::mat3(column0, column1, column2);
+}
+
+bool CPURenderer::saveImage(const std::string &filename, int width,
+                            int height,
+                            const std::vector<unsigned char> &pixels) {
+  stbi_flip_vertically_on_write(1);
+  return stbi_write_png(filename.c_str(), width, height, 4, pixels.data(),
+                        0) != 0;
+}
+
+ImageDifference CPURenderer::compare(const std::vector<unsigned char> &a,
+                                     const std::vector<unsigned char> &b,
+                                     int tolerance) {
+  ImageDifference difference;
+  size_t pixelCount = std::min(a.size(), b.size()) / 4;
+  if (pixelCount == 0)
+    return difference;
+  double errorSum = 0.0;
+  size_t overTolerance = 0;
+  for (size_t i = 0; i < pixelCount; i++) {
+    int pixelError = 0;
+    for (int c = 0; c < 3; c++) {
+      int error = std::abs((int)a[i * 4 + c] - (int)b[i * 4 + c]);
+      errorSum += error;
+      pixelError = std::max(pixelError, error);
+    }
+    difference.mMaxError = std::max(difference.mMaxError, pixelError);
+    if (pixelError > tolerance)
+      overTolerance++;
+  }
+  difference.mMeanError = errorSum / (pixelCount * 3.0);
+  difference.mPixelsOverTolerance = (float)overTolerance / pixelCount;
+  return difference;
+}
+
+bool CPUIntersect::rayAABB(const CPURenderer::Ray &ray,
+                           const glm::vec3 &maxVert,
+                           const glm::vec3 &minVert, float &outTNear) {
+  glm::vec3 invDir = 1.0f / ray.mDirection;
+  glm::vec3 t1 = (minVert - ray.mOrigin) * invDir;
+  glm::vec3 t2 = (maxVert - ray.mOrigin) * invDir;
+  glm::vec3 tMin = glm::min(t1, t2);
+  glm::vec3 tMax = glm::max(t1, t2);
+  float tNear = std::max(std::max(tMin.x, tMin.y), tMin.z);
+  float tFar = std::min(std::min(tMax.x, tMax.y), tMax.z);
+  outTNear = tNear;
+  return tNear <= tFar && tFar >= 0;
+}
+
+bool CPUIntersect::rayTriangle(const CPURenderer::Ray &ray,
+                               const glm::vec3 &v0, const glm::vec3 &v1,
+                               const glm::vec3 &v2, float &outT) {
+  glm::vec3 edge1 = v1 - v0;
+  glm::vec3 edge2 = v2 - v0;
+  glm::vec3 h = glm::cross(ray.mDirection, edge2);
+  float a = glm::dot(edge1, h);
+  if (a > -EPSILON && a < EPSILON)
+    return false;
+
+  float f = 1.0f / a;
+  glm::vec3 s = ray.mOrigin - v0;
+  float u = f * glm::dot(s, h);
+  if (u < 0.0f || u > 1.0f)
+    return false;
+
+  glm::vec3 q = glm::cross(s, edge1);
+  float v = f * glm::dot(ray.mDirection, q);
+  if (v < 0.0f || u + v > 1.0f)
+    return false;
+
+  outT = f * glm::dot(edge2, q);
+  return outT > EPSILON;
+}
+
+int CPUIntersect::rayTriangleGroup(const CPURenderer::Ray &ray,
+                                   const TriangleGroup &group, float maxT,
+                                   float &outT) {
+  // Moller-Trumbore, one ray against every triangle of the group
+  Vec3x8 direction = {Float8(ray.mDirection.x), Float8(ray.mDirection.y),
+                      Float8(ray.mDirection.z)};
+  Vec3x8 origin = {Float8(ray.mOrigin.x), Float8(ray.mOrigin.y),
+                   Float8(ray.mOrigin.z)};
+  Vec3x8 vertex0 = {Float8::load(group.mVertex0[0]),
+                    Float8::load(group.mVertex0[1]),
+                    Float8::load(group.mVertex0[2])};
+  Vec3x8 edge1 = {Float8::load(group.mEdge1[0]), Float8::load(group.mEdge1[1]),
+                  Float8::load(group.mEdge1[2])};
+  Vec3x8 edge2 = {Float8::load(group.mEdge2[0]), Float8::load(group.mEdge2[1]),
+                  Float8::load(group.mEdge2[2])};
+
+  Vec3x8 h = cross(direction, edge2);
+  Float8 a = dot(edge1, h);
+  Float8 valid = (a <= Float8(-EPSILON)) | (a >= Float8(EPSILON));
+  Float8 f = Float8(1.0f) / a;
+  Vec3x8 s = origin - vertex0;
+  Float8 u = f * dot(s, h);
+  valid = valid & (u >= Float8(0.0f)) & (u <= Float8(1.0f));
+  Vec3x8 q = cross(s, edge1);
+  Float8 v = f * dot(direction, q);
+  valid = valid & (v >= Float8(0.0f)) & (u + v <= Float8(1.0f));
+  Float8 t = f * dot(edge2, q);
+  valid = valid & (t > Float8(EPSILON)) & (t < Float8(maxT));
+
+  int lanes = movemask(valid);
+  if (lanes == 0)
+    return -1;
+
+  // First lane wins ties, like testing the records in order
+  float tValues[TRIANGLE_GROUP_SIZE];
+  t.store(tValues);
+  int closestLane = -1;
+  for (int lane = 0; lane < TRIANGLE_GROUP_SIZE; lane++) {
+    if ((lanes & (1 << lane)) &&
+        (closestLane < 0 || tValues[lane] < tValues[closestLane]))
+      closestLane = lane;
+  }
+  outT = tValues[closestLane];
+  return closestLane;
+}
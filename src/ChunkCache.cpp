@@ -0,0 +1,312 @@
+#include "ChunkCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+
+ChunkCache::ChunkCache(const std::string &path) : mPath(path) {}
+
+ChunkCache::~ChunkCache() {
+  clear();
+  std::remove(mPath.c_str());
+}
+
+bool ChunkCache::build(const std::vector<Model> &models, int chunkSize) {
+  chunkSize = std::max(chunkSize, 1);
+  std::vector<glm::ivec3> builtModels;
+  for (const Model &model : models) {
+    int triangleCount = 0;
+    for (const Mesh &mesh : model.getMeshes()) {
+      triangleCount += mesh.getTriangles().size();
+    }
+    builtModels.push_back(
+        glm::ivec3(model.getIndex(), model.getLODLevel(), triangleCount));
+  }
+  if (builtModels == mBuiltModels && chunkSize == mBuiltChunkSize &&
+      !mChunks.empty())
+    return false;
+
+  clear();
+  mChunks.clear();
+  mBuiltModels.clear();
+  resetStats();
+
+  std::ofstream file(mPath, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    std::cerr << "Failed to open chunk file: " << mPath << std::endl;
+    return true;
+  }
+  std::vector<const Triangle *> triangles;
+  for (int modelIndex = 0; modelIndex < models.size(); modelIndex++) {
+    triangles.clear();
+    for (const Mesh &mesh : models[modelIndex].getMeshes()) {
+      for (const Triangle &triangle : mesh.getTriangles()) {
+        triangles.push_back(&triangle);
+      }
+    }
+    split(triangles, 0, triangles.size(), modelIndex, chunkSize, file);
+  }
+  mBuiltModels = builtModels;
+  mBuiltChunkSize = chunkSize;
+  place(models);
+  return true;
+}
+
+void ChunkCache::place(const std::vector<Model> &models) {
+  float max = std::numeric_limits<float>::max();
+  for (Chunk &chunk : mChunks) {
+    chunk.mMinVert = glm::vec3(max, max, max);
+    chunk.mMaxVert = glm::vec3(-max, -max, -max);
+    for (int corner = 0; corner < 8; corner++) {
+      glm::vec3 point(
+          corner & 1 ? chunk.mLocalMaxVert.x : chunk.mLocalMinVert.x,
+          corner & 2 ? chunk.mLocalMaxVert.y : chunk.mLocalMinVert.y,
+          corner & 4 ? chunk.mLocalMaxVert.z : chunk.mLocalMinVert.z);
+      point = models[chunk.mModelIndex].transform(point);
+      chunk.mMinVert = glm::min(chunk.mMinVert, point);
+      chunk.mMaxVert = glm::max(chunk.mMaxVert, point);
+    }
+  }
+}
+
+void ChunkCache::split(std::vector<const Triangle *> &triangles, int begin,
+                       int end, int modelIndex, int chunkSize,
+                       std::ofstream &file) {
+  if (begin >= end)
+    return;
+
+  auto center = [](const Triangle *triangle) {
+    return (triangle->mVertices[0].mPosition +
+            triangle->mVertices[1].mPosition +
+            triangle->mVertices[2].mPosition) /
+           3.0f;
+  };
+  float max = std::numeric_limits<float>::max();
+  glm::vec3 minVert = glm::vec3(max, max, max);
+  glm::vec3 maxVert = glm::vec3(-max, -max, -max);
+  glm::vec3 minCenter = minVert;
+  glm::vec3 maxCenter = maxVert;
+  for (int j = begin; j < end; j++) {
+    const Triangle *triangle = triangles[j];
+    for (int k = 0; k < 3; k++) {
+      minVert = glm::min(minVert, triangle->mVertices[k].mPosition);
+      maxVert = glm::max(maxVert, triangle->mVertices[k].mPosition);
+    }
+    minCenter = glm::min(minCenter, center(triangle));
+    maxCenter = glm::max(maxCenter, center(triangle));
+  }
+
+  // Leaf chunk
+  if (end - begin <= chunkSize) {
+    Chunk chunk;
+    chunk.mIndex = mChunks.size();
+    chunk.mModelIndex = modelIndex;
+    chunk.mTriangleCount = end - begin;
+    chunk.mFileOffset = file.tellp();
+    chunk.mLocalMaxVert = maxVert;
+    chunk.mLocalMinVert = minVert;
+    for (int j = begin; j < end; j++) {
+      file.write(reinterpret_cast<const char *>(triangles[j]),
+                 sizeof(Triangle));
+    }
+    mChunks.push_back(chunk);
+    return;
+  }
+
+  // Median split along the longest centroid axis
+  glm::vec3 size = maxCenter - minCenter;
+  int splitCoord = 0;
+  if (size.y > size.x && size.y >= size.z)
+    splitCoord = 1;
+  else if (size.z > size.x && size.z > size.y)
+    splitCoord = 2;
+
+  int mid = begin + (end - begin) / 2;
+  std::nth_element(triangles.begin() + begin, triangles.begin() + mid,
+                   triangles.begin() + end,
+                   [&center, splitCoord](const Triangle *a, const Triangle *b) {
+                     return center(a)[splitCoord] < center(b)[splitCoord];
+                   });
+
+  split(triangles, begin, mid, modelIndex, chunkSize, file);
+  split(triangles, mid, end, modelIndex, chunkSize, file);
+}
+
+const std::vector<Triangle> &ChunkCache::acquire(int chunkIndex) {
+  auto it = mResident.find(chunkIndex);
+  if (it != mResident.end()) {
+    mHits++;
+    mLRU.splice(mLRU.begin(), mLRU, it->second.mLRUPosition);
+    return it->second.mTriangles;
+  }
+
+  mMisses++;
+  const Chunk &chunk = mChunks[chunkIndex];
+  Resident resident;
+  resident.mTriangles.resize(chunk.mTriangleCount);
+
+  std::ifstream file(mPath, std::ios::binary);
+  file.seekg(chunk.mFileOffset);
+  file.read(reinterpret_cast<char *>(resident.mTriangles.data()),
+            chunk.mTriangleCount * sizeof(Triangle));
+  if (!file) {
+    std::cerr << "Failed to read chunk " << chunkIndex << " from " << mPath
+              << std::endl;
+  }
+
+  mLRU.push_front(chunkIndex);
+  resident.mLRUPosition = mLRU.begin();
+  mResidentBytes += chunk.mTriangleCount * sizeof(Triangle);
+  Resident &inserted = mResident[chunkIndex] = std::move(resident);
+
+  evict();
+  return inserted.mTriangles;
+}
+
+std::vector<int> ChunkCache::visibleChunks(const Camera &camera) const {
+  const glm::mat3 &matrix = camera.getMatrix();
+  const glm::vec3 &position = camera.getPosition();
+  float tanY = glm::tan(0.5f * glm::radians(camera.getFOV()));
+  float tanX = tanY * camera.getAspectRatio();
+  float normX = glm::sqrt(1.0f + tanX * tanX);
+  float normY = glm::sqrt(1.0f + tanY * tanY);
+
+  std::vector<std::pair<float, int>> visible;
+  for (const Chunk &chunk : mChunks) {
+    glm::vec3 center = (chunk.mMaxVert + chunk.mMinVert) * 0.5f;
+    float radius = glm::length(chunk.mMaxVert - center);
+    glm::vec3 offset = center - position;
+    // View space, camera looks down -z
+    glm::vec3 view(glm::dot(matrix[0], offset), glm::dot(matrix[1], offset),
+                   glm::dot(matrix[2], offset));
+
+    if (view.z > radius)
+      continue;
+    if ((view.x + view.z * tanX) / normX > radius ||
+        (-view.x + view.z * tanX) / normX > radius)
+      continue;
+    if ((view.y + view.z * tanY) / normY > radius ||
+        (-view.y + view.z * tanY) / normY > radius)
+      continue;
+    visible.push_back({glm::length(offset) - radius, chunk.mIndex});
+  }
+
+  std::sort(visible.begin(), visible.end());
+  std::vector<int> chunks;
+  for (const auto &entry : visible) {
+    chunks.push_back(entry.second);
+  }
+  return chunks;
+}
+
+std::vector<int>
+ChunkCache::shadowCasters(const std::vector<int> &visible,
+                          const std::vector<Light> &lights,
+                          const Camera &camera) const {
+  if (visible.empty())
+    return {};
+  float max = std::numeric_limits<float>::max();
+  glm::vec3 visibleMin = glm::vec3(max, max, max);
+  glm::vec3 visibleMax = glm::vec3(-max, -max, -max);
+  for (int chunk : visible) {
+    visibleMin = glm::min(visibleMin, mChunks[chunk].mMinVert);
+    visibleMax = glm::max(visibleMax, mChunks[chunk].mMaxVert);
+  }
+  glm::vec3 sceneMin = visibleMin;
+  glm::vec3 sceneMax = visibleMax;
+  for (const Chunk &chunk : mChunks) {
+    sceneMin = glm::min(sceneMin, chunk.mMinVert);
+    sceneMax = glm::max(sceneMax, chunk.mMaxVert);
+  }
+
+  // Shadow rays leave the visible bounds toward each light, a directional
+  // light is swept across the whole scene
+  std::vector<std::pair<glm::vec3, glm::vec3>> regions;
+  for (const Light &light : lights) {
+    glm::vec3 minVert = visibleMin;
+    glm::vec3 maxVert = visibleMax;
+    if (light.mType == LightType::Point) {
+      minVert = glm::min(minVert, light.mPosition);
+      maxVert = glm::max(maxVert, light.mPosition);
+    } else {
+      float pitch = glm::radians(light.mPitch);
+      float yaw = glm::radians(light.mYaw);
+      glm::vec3 toLight = -glm::vec3(std::cos(pitch) * std::sin(yaw),
+                                     std::sin(pitch),
+                                     std::cos(pitch) * std::cos(yaw));
+      glm::vec3 sweep = toLight * glm::length(sceneMax - sceneMin);
+      minVert = glm::min(minVert, visibleMin + sweep);
+      maxVert = glm::max(maxVert, visibleMax + sweep);
+    }
+    regions.push_back(
+        {glm::max(minVert, sceneMin), glm::min(maxVert, sceneMax)});
+  }
+
+  auto overlaps = [](const glm::vec3 &minA, const glm::vec3 &maxA,
+                     const glm::vec3 &minB, const glm::vec3 &maxB) {
+    for (int axis = 0; axis < 3; axis++) {
+      if (minA[axis] > maxB[axis] || minB[axis] > maxA[axis])
+        return false;
+    }
+    return true;
+  };
+  std::vector<bool> isVisible(mChunks.size(), false);
+  for (int chunk : visible) {
+    isVisible[chunk] = true;
+  }
+  std::vector<std::pair<float, int>> casters;
+  for (const Chunk &chunk : mChunks) {
+    if (isVisible[chunk.mIndex])
+      continue;
+    for (const auto &[minVert, maxVert] : regions) {
+      if (overlaps(chunk.mMinVert, chunk.mMaxVert, minVert, maxVert)) {
+        glm::vec3 center = (chunk.mMaxVert + chunk.mMinVert) * 0.5f;
+        casters.push_back(
+            {glm::length(center - camera.getPosition()), chunk.mIndex});
+        break;
+      }
+    }
+  }
+
+  std::sort(casters.begin(), casters.end());
+  std::vector<int> chunks;
+  for (const auto &entry : casters) {
+    chunks.push_back(entry.second);
+  }
+  return chunks;
+}
+
+void ChunkCache::setBudget(size_t bytes) {
+  mBudget = bytes;
+  evict();
+}
+
+const float ChunkCache::getHitRate() const {
+  long long total = mHits + mMisses;
+  if (total == 0)
+    return 0.0f;
+  return (float)mHits / (float)total;
+}
+
+void ChunkCache::resetStats() {
+  mHits = 0;
+  mMisses = 0;
+}
+
+void ChunkCache::evict() {
+  // Never evict the most recently used chunk, the caller still holds it
+  while (mResidentBytes > mBudget && mLRU.size() > 1) {
+    int chunkIndex = mLRU.back();
+    mLRU.pop_back();
+    mResidentBytes -= mChunks[chunkIndex].mTriangleCount * sizeof(Triangle);
+    mResident.erase(chunkIndex);
+  }
+}
+
+void ChunkCache::clear() {
+  mResident.clear();
+  mLRU.clear();
+  mResidentBytes = 0;
+}
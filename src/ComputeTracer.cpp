@@ -0,0 +1,79 @@
+#include <glad/glad.h>
+
+#include "ComputeTracer.h"
+#include "ShaderConstants.h"
+
+#include <algorithm>
+#include <iostream>
+
+// Shorter stacks overflow on deep hierarchies, smaller groups are picked
+// instead
+#define MIN_STACK_SIZE 32
+
+bool ComputeTracer::init() {
+  std::string vendor = (const char *)glGetString(GL_VENDOR);
+  std::string renderer = (const char *)glGetString(GL_RENDERER);
+
+  // One warp of 32 on NVIDIA and Intel, one wave of 64 on AMD. llvmpipe
+  // runs a group per CPU thread with invocations across SIMD lanes, 8x8
+  // fills the lanes and leaves enough groups for every core.
+  if (renderer.find("llvmpipe") != std::string::npos)
+    mLocalSize = glm::ivec2(8, 8);
+  else if (vendor.find("NVIDIA") != std::string::npos ||
+           vendor.find("Intel") != std::string::npos)
+    mLocalSize = glm::ivec2(8, 4);
+  else
+    mLocalSize = glm::ivec2(8, 8);
+
+  int maxInvocations, maxSharedMemory;
+  glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+  glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &maxSharedMemory);
+  while (mLocalSize.x * mLocalSize.y > maxInvocations)
+    mLocalSize.y = std::max(mLocalSize.y / 2, 1);
+  auto stackSize = [&]() {
+    int invocations = mLocalSize.x * mLocalSize.y;
+    return std::min(TRACE_STACK_SIZE,
+                    maxSharedMemory / (int)(sizeof(int) * invocations));
+  };
+  while (stackSize() < MIN_STACK_SIZE && mLocalSize.x * mLocalSize.y > 1) {
+    if (mLocalSize.y >= mLocalSize.x)
+      mLocalSize.y /= 2;
+    else
+      mLocalSize.x /= 2;
+  }
+  mStackSize = stackSize();
+  if (mStackSize < MIN_STACK_SIZE) {
+    std::cout << "Compute backend unavailable, " << maxSharedMemory
+              << " bytes of shared memory hold a stack of " << mStackSize
+              << " entries" << std::endl;
+    return false;
+  }
+  std::cout << "Compute backend: " << mLocalSize.x << "x" << mLocalSize.y
+            << " groups, stack of " << mStackSize << " on " << renderer
+            << std::endl;
+  return true;
+}
+
+void ComputeTracer::load(const char *shaderPath,
+                         const std::vector<std::string> &defines) {
+  std::vector<std::string> computeDefines = defines;
+  computeDefines.push_back("COMPUTE");
+  computeDefines.push_back("LOCAL_SIZE_X " + std::to_string(mLocalSize.x));
+  computeDefines.push_back("LOCAL_SIZE_Y " + std::to_string(mLocalSize.y));
+  computeDefines.push_back("STACK_SIZE " + std::to_string(mStackSize));
+  mShader = std::make_unique<Shader>(shaderPath, computeDefines);
+}
+
+void ComputeTracer::dispatch(RenderTarget &target, const glm::ivec4 &rect) {
+  target.bindImage(0, 0);
+  target.bindImage(1, 1);
+  target.bindImage(2, 2);
+  mShader->setIVec2("uRectOffset", glm::ivec2(rect.x, rect.y));
+  mShader->setIVec2("uRectSize", glm::ivec2(rect.z, rect.w));
+  glDispatchCompute((rect.z + mLocalSize.x - 1) / mLocalSize.x,
+                    (rect.w + mLocalSize.y - 1) / mLocalSize.y, 1);
+  // Presenting, reconstruction and counter readbacks see the stores
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT |
+                  GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+                  GL_BUFFER_UPDATE_BARRIER_BIT);
+}
@@ -1,13 +1,14 @@
 #include "Data.h"
-#include <iostream>
+#include "StreamedBVH.h"
 
-#define BVH_OFFSET 0
-#define MATERIAL_OFFSET 1
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <iostream>
+#include <numeric>
 
-#define REAL_SETTINGS_OFFSET 10
-#define REAL_CAMERA_OFFSET 20
-#define REAL_LIGHTS_OFFSET 40
-#define REAL_VERTICES_OFFSET 140
+// Floats per streamed triangle: 3 vertices + triangle record
+#define STREAMED_TRIANGLE_SIZE 17
 
 void Data::updateCamera(const Camera &camera) {
   mOffset = REAL_CAMERA_OFFSET;
@@ -27,21 +28,272 @@ void Data::updateBVH(const Scene &scene, const Settings &settings) {
   }
 
   // Add bvh nodes and triangles
-  BVHNode::mIdCounter = -1;
-  BVHNode *node = BVHNode::buildBVH(scene.getTriangles(), settings.mMaxDepth,
-                                    settings.mMaxTrianglesInLeaf, 0);
-  std::vector<int> sizes = BVHNode::calculateNodeSizes(node);
-  int numberOfNodes = sizes.size();
+  updateNodes(scene.getTriangles(), settings);
+}
+
+void Data::updateBVH(ChunkCache &cache, const std::vector<int> &chunks,
+                     const Scene &scene, const Settings &settings) {
+  // Primitive stand-ins are kept by the scene, then nearest chunks are
+  // gathered until half of the buffer is used, the rest is left for bvh
+  // nodes and materials
+  int floatBudget = (DATA_SIZE - REAL_VERTICES_OFFSET) / 2;
+  int floatCount = 0;
+  std::vector<Triangle> triangles = scene.getTriangles();
+  const std::vector<Model> &models = scene.getModels();
+  int vertexIndex = 0;
+  mDroppedChunks = 0;
+  for (int chunk : chunks) {
+    // Checked before the chunk is read, dropped chunks are not loaded
+    int chunkFloats =
+        cache.getChunks()[chunk].mTriangleCount * STREAMED_TRIANGLE_SIZE;
+    if (floatCount + chunkFloats > floatBudget) {
+      mDroppedChunks++;
+      continue;
+    }
+    floatCount += chunkFloats;
+    const std::vector<Triangle> &chunkTriangles = cache.acquire(chunk);
+    // Chunks hold object space triangles, placed like the model's meshes
+    const Model &model = models[cache.getChunks()[chunk].mModelIndex];
+    for (Triangle triangle : chunkTriangles) {
+      for (int i = 0; i < 3; i++) {
+        Vertex &vertex = triangle.mVertices[i];
+        vertex.mModedPosition = model.transform(vertex.mPosition);
+        triangle.mModedIndices[i] = vertexIndex + i;
+      }
+      vertexIndex += 3;
+      triangle.recalculateCenter();
+      triangles.push_back(triangle);
+    }
+  }
+
+  // Add vertices, streamed triangles are not indexed
+  mOffset = REAL_VERTICES_OFFSET;
+  for (const Triangle &triangle : triangles) {
+    if (triangle.isPrimitive())
+      continue;
+    for (int i = 0; i < 3; i++) {
+      add(triangle.mVertices[i]);
+    }
+  }
+
+  // Add bvh nodes and triangles
+  updateNodes(triangles, settings);
+}
+
+bool Data::loadBVH(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  BVHFileHeader header;
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!file || header.mMagic != BVH_FILE_MAGIC) {
+    std::cerr << "Invalid BVH file: " << path << std::endl;
+    return false;
+  }
+  // Offsets in the buffer are floats, exact as it is far below 2^24
+  long long floatCount =
+      header.mVertexFloatCount + header.mNodeCount + header.mNodeSlotCount;
+  if (REAL_VERTICES_OFFSET + floatCount > DATA_SIZE) {
+    std::cerr << "BVH file needs " << floatCount << " floats, the data buffer "
+              << "holds " << DATA_SIZE - REAL_VERTICES_OFFSET << ": " << path
+              << std::endl;
+    return false;
+  }
+
+  int bvhOffset = REAL_VERTICES_OFFSET + header.mVertexFloatCount;
+  int nodesOffset = bvhOffset + header.mNodeCount;
+  std::vector<long long> table(header.mNodeCount);
+  file.read(reinterpret_cast<char *>(&mData[REAL_VERTICES_OFFSET]),
+            header.mVertexFloatCount * sizeof(float));
+  file.read(reinterpret_cast<char *>(table.data()),
+            table.size() * sizeof(long long));
+  file.read(reinterpret_cast<char *>(&mData[nodesOffset]),
+            header.mNodeSlotCount * sizeof(float));
+  if (!file) {
+    std::cerr << "Failed to read BVH file: " << path << std::endl;
+    return false;
+  }
+  for (int i = 0; i < table.size(); i++) {
+    mData[bvhOffset + i] = nodesOffset + table[i];
+  }
+
+  // Integer fields as the floats the shader reads
+  auto unpack = [&](int offset) {
+    mData[offset] = unpackBVHInt(mData[offset]);
+  };
+  int offset = nodesOffset;
+  int end = nodesOffset + header.mNodeSlotCount;
+  while (offset < end) {
+    offset += 6; // bounds
+    if (mData[offset++] == 0.0f) {
+      for (int i = 0; i < 3; i++) {
+        unpack(offset++);
+      }
+      continue;
+    }
+    unpack(offset);
+    int triangleCount = mData[offset++];
+    for (int i = 0; i < triangleCount; i++) {
+      for (int k = 0; k < 5; k++) {
+        unpack(offset + k);
+      }
+      offset += 8;
+    }
+  }
+
+  mData[BVH_OFFSET] = bvhOffset;
+  mOffset = REAL_VERTICES_OFFSET + floatCount;
+  mNodeCount = header.mNodeCount;
+  mUnbuiltCount = 0;
+  mTableSize = mNodeCount;
+  mNodeEnd = mOffset;
+  mLazyRoot.reset();
+  mLazyNodes.clear();
+  writeSkipLinks();
+  return true;
+}
 
+void Data::updateNodes(const std::vector<Triangle> &triangles,
+                       const Settings &settings) {
+  BVHNode::mIdCounter = -1;
+  mLazyRoot.reset();
+  mLazyNodes.clear();
+  mLazyTriangles.clear();
+  mLazyIndices.clear();
   mData[BVH_OFFSET] = mOffset;
-  int bvhNodesSum = 0;
+  if (!settings.mLazyBVH) {
+    BVHNode *node = BVHNode::buildBVH(triangles, settings.mMaxDepth,
+                                      settings.getLeafSize(), 0);
+    writeNodes(node, 0);
+    delete node;
+    return;
+  }
+
+  // Lazy hierarchies are kept for expanding, unbuilt nodes index the kept
+  // triangles. The table is sized for the full tree so expanding appends
+  mLazyTriangles = triangles;
+  mLazyIndices.resize(triangles.size());
+  std::iota(mLazyIndices.begin(), mLazyIndices.end(), 0);
+  BVHNode *node = BVHNode::buildBVH(
+      mLazyTriangles, mLazyIndices, 0, mLazyIndices.size(), settings.mMaxDepth,
+      settings.getLeafSize(), 0, settings.mLazyDepth);
+  mLazyRoot.reset(node);
+  long long depthNodes = (2LL << std::min(settings.mMaxDepth, 30)) - 1;
+  int tableSize =
+      std::min<long long>(2LL * triangles.size() + 1, depthNodes);
+  writeNodes(node, tableSize);
+}
+
+bool Data::expandBVH(const std::vector<int> &nodeIDs,
+                     const Settings &settings) {
+  if (!mLazyRoot)
+    return false;
+  mChangedRanges.clear();
+  std::vector<BVHNode *> expanded;
+  int nextID = mNodeCount;
+  for (int id : nodeIDs) {
+    if (id < 0 || id >= mLazyNodes.size() || mLazyNodes[id]->isBuilt())
+      continue;
+    BVHNode *node = mLazyNodes[id];
+    node->expand(mLazyTriangles, mLazyIndices, settings.mMaxDepth,
+                 settings.getLeafSize(), settings.mLazyDepth);
+    // Ids of the rest of the tree stay, the feedback and table keep them
+    BVHNode::assignChildIDs(node, nextID);
+    expanded.push_back(node);
+  }
+  if (expanded.empty())
+    return false;
+
+  int bvhOffset = mData[BVH_OFFSET];
+  if (nextID > mTableSize) {
+    // Out of table entries, everything from the bvh offset is rewritten
+    mOffset = bvhOffset;
+    writeNodes(mLazyRoot.get(), std::max(2 * mTableSize, nextID));
+    mChangedRanges.push_back({0, SKIP_OFFSET + 1});
+    mChangedTail = bvhOffset;
+    return true;
+  }
+
+  // Expanded nodes keep their record size and are rewritten in place, new
+  // nodes are appended after the last record
+  mLazyNodes.resize(nextID);
+  mChangedRanges.push_back({0, SKIP_OFFSET + 1});
+  mChangedRanges.push_back({bvhOffset + mNodeCount, nextID - mNodeCount});
+  mChangedTail = mNodeEnd;
+  mUnbuiltCount -= expanded.size();
+  for (BVHNode *node : expanded) {
+    mOffset = mData[bvhOffset + node->getID()];
+    updateNode(node);
+    mChangedRanges.push_back({(int)mData[bvhOffset + node->getID()],
+                              BVHNode::calculateNodeSize(node)});
+  }
+  mOffset = mNodeEnd;
+  for (BVHNode *node : expanded) {
+    std::vector<BVHNode *> children;
+    BVHNode::collectNodes(node->getLeft(), children);
+    BVHNode::collectNodes(node->getRight(), children);
+    for (BVHNode *child : children) {
+      mLazyNodes[child->getID()] = child;
+      mData[bvhOffset + child->getID()] = mOffset;
+      updateNode(child);
+    }
+  }
+  mNodeCount = nextID;
+  mNodeEnd = mOffset;
+  writeSkipLinks();
+  return true;
+}
+
+void Data::writeNodes(BVHNode *root, int tableSize) {
+  std::vector<BVHNode *> nodes;
+  BVHNode::collectNodes(root, nodes);
+  std::vector<BVHNode *> byID(nodes.size());
+  for (BVHNode *node : nodes) {
+    byID[node->getID()] = node;
+  }
+  mNodeCount = nodes.size();
+  mTableSize = std::max(tableSize, mNodeCount);
+
+  // Offset table by node id, then node records in id order
   int bvhOffset = mOffset;
-  for (int size : sizes) {
-    add(bvhOffset + bvhNodesSum + numberOfNodes);
-    bvhNodesSum += size;
+  mOffset = bvhOffset + mTableSize;
+  mUnbuiltCount = 0;
+  for (BVHNode *node : byID) {
+    mData[bvhOffset + node->getID()] = mOffset;
+    updateNode(node);
+  }
+  mNodeEnd = mOffset;
+  if (mLazyRoot)
+    mLazyNodes = byID;
+  writeSkipLinks();
+}
+
+void Data::writeSkipLinks() {
+  // Where stackless traversal goes after missing a node or finishing a
+  // leaf, the right sibling of the nearest ancestor with one, or -1
+  int bvhOffset = mData[BVH_OFFSET];
+  std::vector<int> skipLinks;
+  std::vector<std::array<int, 3>> stack = {{0, -1, 0}};
+  mTreeDepth = 0;
+  while (!stack.empty()) {
+    auto [nodeIndex, skipIndex, depth] = stack.back();
+    stack.pop_back();
+    mTreeDepth = std::max(mTreeDepth, depth);
+    if (nodeIndex >= skipLinks.size())
+      skipLinks.resize(nodeIndex + 1, -1);
+    skipLinks[nodeIndex] = skipIndex;
+
+    int offset = (int)mData[bvhOffset + nodeIndex] + 6;
+    if (mData[offset] != 0.0f)
+      continue;
+    int leftIndex = (int)mData[offset + 1];
+    int rightIndex = (int)mData[offset + 2];
+    stack.push_back({leftIndex, rightIndex, depth + 1});
+    stack.push_back({rightIndex, skipIndex, depth + 1});
+  }
+
+  mData[SKIP_OFFSET] = mOffset;
+  for (int skipIndex : skipLinks) {
+    add(skipIndex);
   }
-  updateNode(node);
-  node->clean();
 }
 
 void Data::updateLights(const Scene &scene) {
@@ -56,6 +308,11 @@ void Data::updateSettings(const Settings &settings) {
   mOffset = REAL_SETTINGS_OFFSET;
   add(settings.mDownsampleFactor);
   add(settings.mViewportMode);
+  add(settings.mShadows);
+}
+
+void Data::updateDownsampleFactor(float factor) {
+  mData[REAL_SETTINGS_OFFSET] = factor;
 }
 
 void Data::updateMaterial(const Scene &scene, bool alone) {
@@ -76,9 +333,39 @@ void Data::updateMaterial(const Scene &scene, bool alone) {
   mDataFloatSize = mOffset;
 }
 
+void Data::updatePrimitives(const Scene &scene) {
+  mData[PRIMITIVE_OFFSET] = mOffset;
+  const std::vector<Primitive> &primitives = scene.getPrimitives();
+  std::vector<int> global;
+  for (int i = 0; i < primitives.size(); i++) {
+    if (primitives[i].isGlobal())
+      global.push_back(i);
+  }
+  add((int)primitives.size());
+  add((int)global.size());
+  for (int index : global) {
+    add(index);
+  }
+  int modelIndex = scene.getModelCount();
+  for (const Primitive &primitive : primitives) {
+    add(primitive, modelIndex);
+    modelIndex++;
+  }
+}
+
 void Data::updateNode(BVHNode *node) {
   add(node->getMaxVert());
   add(node->getMinVert());
+  if (!node->isBuilt()) {
+    // No triangles until expanded, the record keeps the size of an inner
+    // node so it can be rewritten in place
+    add(UNBUILT_LEAF);
+    add(0);
+    add(0);
+    add(0);
+    mUnbuiltCount++;
+    return;
+  }
   add(node->isLeaf());
   if (node->isLeaf()) {
     updateLeafNode(node);
@@ -86,9 +373,7 @@ void Data::updateNode(BVHNode *node) {
   }
   add(node->getLeftID());
   add(node->getRightID());
-
-  updateNode(node->getLeft());
-  updateNode(node->getRight());
+  add(node->getSplitAxis());
 }
 
 void Data::updateLeafNode(BVHNode *node) {
@@ -162,6 +447,14 @@ void Data::add(const Material &material) {
   // add(material.getAmbient());
 }
 
+void Data::add(const Primitive &primitive, int modelIndex) {
+  add((int)primitive.mType);
+  add(modelIndex);
+  add(primitive.mPosition);
+  add(primitive.mSize);
+  add(primitive.getRotationMatrix());
+}
+
 void Data::add(const Light &light) {
   add(light.mType);
   add(light.mIntensity);
@@ -0,0 +1,141 @@
+#include "Denoiser.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+// Albedo below this is not divided out, e.g. background and black materials
+#define ALBEDO_EPSILON 0.01f
+
+namespace {
+
+// B3 spline, the 5 taps of every pass
+const float KERNEL[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+float squaredDistance(const float *a, const float *b) {
+  float x = a[0] - b[0];
+  float y = a[1] - b[1];
+  float z = a[2] - b[2];
+  return x * x + y * y + z * z;
+}
+
+} // namespace
+
+Denoiser::Denoiser(int threads) {
+  mThreads = threads > 0 ? threads : std::thread::hardware_concurrency();
+  mThreads = std::max(mThreads, 1);
+}
+
+void Denoiser::denoise(const std::vector<float> &color,
+                       const std::vector<float> &normalDepth,
+                       const std::vector<float> &albedo, int width,
+                       int height, const Settings &settings,
+                       std::vector<float> &result) {
+  auto start = std::chrono::high_resolution_clock::now();
+  size_t pixels = (size_t)width * height;
+
+  // Filter lighting only, the albedo goes back on at the end
+  std::vector<float> lighting(pixels * 4);
+  for (size_t i = 0; i < pixels; i++) {
+    for (int c = 0; c < 3; c++) {
+      float a = albedo[i * 4 + c];
+      lighting[i * 4 + c] =
+          a > ALBEDO_EPSILON ? color[i * 4 + c] / a : color[i * 4 + c];
+    }
+    lighting[i * 4 + 3] = 1.0f;
+  }
+
+  // Every pass doubles the tap distance and halves the color sigma
+  std::vector<float> filtered(pixels * 4);
+  float colorSigma = settings.mDenoiseColorSigma;
+  for (int pass = 0; pass < settings.mDenoiseIterations; pass++) {
+    filterPass(lighting, filtered, normalDepth, width, height, 1 << pass,
+               colorSigma, settings);
+    lighting.swap(filtered);
+    colorSigma *= 0.5f;
+  }
+
+  result.resize(pixels * 4);
+  for (size_t i = 0; i < pixels; i++) {
+    for (int c = 0; c < 3; c++) {
+      float a = albedo[i * 4 + c];
+      result[i * 4 + c] =
+          a > ALBEDO_EPSILON ? lighting[i * 4 + c] * a : lighting[i * 4 + c];
+    }
+    result[i * 4 + 3] = 1.0f;
+  }
+
+  std::chrono::duration<double, std::milli> time =
+      std::chrono::high_resolution_clock::now() - start;
+  mTime = time.count();
+}
+
+void Denoiser::filterPass(const std::vector<float> &input,
+                          std::vector<float> &output,
+                          const std::vector<float> &normalDepth, int width,
+                          int height, int step, float colorSigma,
+                          const Settings &settings) const {
+  float colorFactor = 1.0f / std::max(colorSigma * colorSigma, 1e-8f);
+  float normalFactor = 1.0f / std::max(settings.mDenoiseNormalSigma *
+                                           settings.mDenoiseNormalSigma,
+                                       1e-8f);
+  float depthSigma = settings.mDenoiseDepthSigma;
+  std::atomic<int> nextRow(0);
+
+  auto worker = [&]() {
+    for (int y = nextRow++; y < height; y = nextRow++) {
+      for (int x = 0; x < width; x++) {
+        int index = (y * width + x) * 4;
+        const float *centerColor = &input[index];
+        const float *centerNormal = &normalDepth[index];
+        float centerDepth = normalDepth[index + 3];
+        // Depth is compared relative to the distance
+        float depthFactor =
+            1.0f / std::max(depthSigma * centerDepth * depthSigma *
+                                centerDepth,
+                            1e-8f);
+
+        float sum[3] = {0.0f, 0.0f, 0.0f};
+        float weightSum = 0.0f;
+        for (int dy = -2; dy <= 2; dy++) {
+          int sy = std::clamp(y + dy * step, 0, height - 1);
+          for (int dx = -2; dx <= 2; dx++) {
+            int sx = std::clamp(x + dx * step, 0, width - 1);
+            int sampleIndex = (sy * width + sx) * 4;
+            const float *sampleColor = &input[sampleIndex];
+            const float *sampleNormal = &normalDepth[sampleIndex];
+            float depthDelta = normalDepth[sampleIndex + 3] - centerDepth;
+
+            float weight =
+                KERNEL[std::abs(dx)] * KERNEL[std::abs(dy)] *
+                std::exp(-squaredDistance(centerColor, sampleColor) *
+                             colorFactor -
+                         squaredDistance(centerNormal, sampleNormal) *
+                             normalFactor -
+                         depthDelta * depthDelta * depthFactor);
+            for (int c = 0; c < 3; c++) {
+              sum[c] += sampleColor[c] * weight;
+            }
+            weightSum += weight;
+          }
+        }
+
+        // The center tap always weighs in, weightSum is never zero
+        for (int c = 0; c < 3; c++) {
+          output[index + c] = sum[c] / weightSum;
+        }
+        output[index + 3] = 1.0f;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < mThreads; i++) {
+    threads.emplace_back(worker);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
@@ -0,0 +1,101 @@
+#include <glad/glad.h>
+
+#include "FeedbackBuffer.h"
+
+#include <algorithm>
+
+void FeedbackBuffer::init(int size, int bindingIndex) {
+  mSize = size;
+  mBindingIndex = bindingIndex;
+  std::vector<int> zeros(size, 0);
+  glGenBuffers(1, &mID);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, mID);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, size * sizeof(int), zeros.data(),
+               GL_DYNAMIC_READ);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void FeedbackBuffer::read(std::vector<int> &counts, int count) {
+  count = std::min(count, mSize);
+  counts.resize(count);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, mID);
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(int),
+                     counts.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void FeedbackBuffer::requestRead(int count) {
+  int slot = mNextSlot;
+  if (mFences[slot])
+    return;
+  if (!mStaging[slot]) {
+    glGenBuffers(1, &mStaging[slot]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mStaging[slot]);
+    glBufferData(GL_COPY_WRITE_BUFFER, mSize * sizeof(int), nullptr,
+                 GL_STREAM_READ);
+  }
+  mCounts[slot] = std::min(count, mSize);
+  // Shader writes land before the copy
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindBuffer(GL_COPY_READ_BUFFER, mID);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, mStaging[slot]);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                      mCounts[slot] * sizeof(int));
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  clear();
+  mFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  mNextSlot = 1 - slot;
+}
+
+bool FeedbackBuffer::readRequested(std::vector<int> &counts) {
+  // The slot written next holds the older copy
+  for (int i = 0; i < 2; i++) {
+    int slot = (mNextSlot + i) % 2;
+    if (!mFences[slot])
+      continue;
+    GLenum status = glClientWaitSync((GLsync)mFences[slot], 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+      return false;
+    glDeleteSync((GLsync)mFences[slot]);
+    mFences[slot] = nullptr;
+    counts.resize(mCounts[slot]);
+    glBindBuffer(GL_COPY_READ_BUFFER, mStaging[slot]);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, mCounts[slot] * sizeof(int),
+                       counts.data());
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    return true;
+  }
+  return false;
+}
+
+void FeedbackBuffer::dropRequests() {
+  for (void *&fence : mFences) {
+    if (fence)
+      glDeleteSync((GLsync)fence);
+    fence = nullptr;
+  }
+}
+
+void FeedbackBuffer::clear() {
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, mID);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32I, GL_RED_INTEGER, GL_INT,
+                    nullptr);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void FeedbackBuffer::bind() {
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, mBindingIndex, mID);
+}
+
+void FeedbackBuffer::unbind() { glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); }
+
+void FeedbackBuffer::clean() {
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  glDeleteBuffers(1, &mID);
+  dropRequests();
+  for (unsigned int staging : mStaging) {
+    if (staging)
+      glDeleteBuffers(1, &staging);
+  }
+}
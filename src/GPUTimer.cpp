@@ -0,0 +1,35 @@
+#include <glad/glad.h>
+
+#include "GPUTimer.h"
+
+void GPUTimer::init() { glGenQueries(2, mQueries); }
+
+void GPUTimer::begin(int tag) {
+  mTags[mCurrent] = tag;
+  glBeginQuery(GL_TIME_ELAPSED, mQueries[mCurrent]);
+}
+
+void GPUTimer::end() {
+  glEndQuery(GL_TIME_ELAPSED);
+  mPending[mCurrent] = true;
+  mCurrent = 1 - mCurrent;
+}
+
+bool GPUTimer::getResult(double &milliseconds, int &tag) {
+  // The query begun next is the older one
+  if (!mPending[mCurrent])
+    return false;
+  GLint available = 0;
+  glGetQueryObjectiv(mQueries[mCurrent], GL_QUERY_RESULT_AVAILABLE,
+                     &available);
+  if (!available)
+    return false;
+  GLuint64 nanoseconds = 0;
+  glGetQueryObjectui64v(mQueries[mCurrent], GL_QUERY_RESULT, &nanoseconds);
+  mPending[mCurrent] = false;
+  milliseconds = nanoseconds / 1000000.0;
+  tag = mTags[mCurrent];
+  return true;
+}
+
+void GPUTimer::clean() { glDeleteQueries(2, mQueries); }
@@ -0,0 +1,52 @@
+#include <glad/glad.h>
+
+#include "Interleaver.h"
+
+// Quarter phases alternate diagonally so two frames cover both axes
+static const int QUARTER_PHASES[4] = {0, 3, 1, 2};
+
+void Interleaver::init(int width, int height) {
+  mReconstructed.init(width, height, true);
+}
+
+void Interleaver::begin(RenderTarget &target, const Settings &settings,
+                        bool changed) {
+  int pattern = settings.mInterleave == 4 ? 4 : 2;
+  bool sized = mReconstructed.getWidth() == target.getWidth() &&
+               mReconstructed.getHeight() == target.getHeight();
+  if (!mValid || !sized) {
+    mReconstructed.resize(target.getWidth(), target.getHeight());
+    mPattern = 1;
+    mPhase = 0;
+    mRemaining = 0;
+    mSettled = false;
+    mValid = true;
+    return;
+  }
+
+  mPattern = pattern;
+  mFrame++;
+  mPhase = pattern == 4 ? QUARTER_PHASES[mFrame % 4] : mFrame % 2;
+  if (changed)
+    mRemaining = pattern - 1;
+  else if (mRemaining > 0)
+    mRemaining--;
+  mSettled = !changed && mRemaining == 0;
+}
+
+void Interleaver::reconstruct(Shader &reconstructShader, Quad &quad,
+                              UBO &data, RenderTarget &target) {
+  mReconstructed.bind();
+  reconstructShader.use();
+  reconstructShader.setInt("uColor", 0);
+  reconstructShader.setInt("uVis", 1);
+  // Settled samples all lie on the current rays, none is replaced
+  reconstructShader.setInt("uInterleave", mSettled ? 1 : mPattern);
+  reconstructShader.setInt("uPhase", mPhase);
+  target.bindTexture(0, 0);
+  target.bindTexture(1, 1);
+  data.bind();
+  quad.draw();
+  data.unbind();
+  mReconstructed.unbind();
+}
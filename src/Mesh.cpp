@@ -1,9 +1,18 @@
 #include "Mesh.h"
+#include "Simplifier.h"
 
 #include <glm/gtx/euler_angles.hpp>
 
+#define LOD_MIN_TRIANGLES 16
+
 Mesh::Mesh(std::vector<Vertex> vertices, std::vector<int> indices) {
-  mVertices = vertices;
+  mLODs[0].mVertices = vertices;
+  buildTriangles(mLODs[0], indices);
+  createBoundingBox();
+}
+
+void Mesh::buildTriangles(LOD &lod, const std::vector<int> &indices) {
+  const std::vector<Vertex> &vertices = lod.mVertices;
   for (int i = 0; i < indices.size(); i += 3) {
     Triangle triangle;
     triangle.mVertices[0] = vertices[indices[i]];
@@ -15,41 +24,115 @@ Mesh::Mesh(std::vector<Vertex> vertices, std::vector<int> indices) {
     triangle.mIndices[2] = indices[i + 2];
 
     triangle.recalculateCenter();
-    mTriangles.push_back(triangle);
+    lod.mTriangles.push_back(triangle);
   }
-  createBoundingBox();
+}
+
+void Mesh::generateLODs(int levels) {
+  mLODs.resize(1);
+  mLODLevel = 0;
+
+  std::vector<glm::vec3> positions;
+  for (const Vertex &vertex : mLODs[0].mVertices) {
+    positions.push_back(vertex.mPosition);
+  }
+  std::vector<int> indices;
+  for (const Triangle &triangle : mLODs[0].mTriangles) {
+    for (int i = 0; i < 3; i++) {
+      indices.push_back(triangle.mIndices[i]);
+    }
+  }
+
+  // Every level halves the triangle count of the original
+  int originalCount = mLODs[0].mTriangles.size();
+  for (int level = 1; level < levels; level++) {
+    int target = originalCount >> level;
+    if (target < LOD_MIN_TRIANGLES)
+      break;
+    SimplifiedMesh simplified = Simplifier::simplify(positions, indices, target);
+    int previousCount = mLODs.back().mTriangles.size();
+    if (simplified.mIndices.size() / 3 >= previousCount)
+      break;
+
+    // Flat normals averaged per welded vertex
+    LOD lod;
+    lod.mError = simplified.mError;
+    lod.mVertices.resize(simplified.mPositions.size());
+    for (int i = 0; i < simplified.mPositions.size(); i++) {
+      lod.mVertices[i].mPosition = simplified.mPositions[i];
+      lod.mVertices[i].mModedPosition = simplified.mPositions[i];
+      lod.mVertices[i].mNormal = glm::vec3(0.0f);
+    }
+    for (int i = 0; i < simplified.mIndices.size(); i += 3) {
+      const glm::vec3 &a = simplified.mPositions[simplified.mIndices[i]];
+      const glm::vec3 &b = simplified.mPositions[simplified.mIndices[i + 1]];
+      const glm::vec3 &c = simplified.mPositions[simplified.mIndices[i + 2]];
+      glm::vec3 normal = glm::cross(b - a, c - a);
+      for (int k = 0; k < 3; k++) {
+        lod.mVertices[simplified.mIndices[i + k]].mNormal += normal;
+      }
+    }
+    for (Vertex &vertex : lod.mVertices) {
+      if (glm::length(vertex.mNormal) > 0.0f)
+        vertex.mNormal = glm::normalize(vertex.mNormal);
+    }
+    buildTriangles(lod, simplified.mIndices);
+    mLODs.push_back(lod);
+  }
+}
+
+void Mesh::setLODLevel(int level) {
+  mLODLevel = glm::clamp(level, 0, (int)mLODs.size() - 1);
 }
 
 void Mesh::createBoundingBox() {
   float max = std::numeric_limits<float>::max();
   glm::vec3 minVert = glm::vec3(max, max, max);
   glm::vec3 maxVert = glm::vec3(-max, -max, -max);
-  for (const Vertex &vertex : mVertices) {
+  glm::vec3 localMinVert = minVert;
+  glm::vec3 localMaxVert = maxVert;
+  for (const Vertex &vertex : mLODs[0].mVertices) {
     for (int i = 0; i < 3; i++) {
       minVert[i] = glm::min(minVert[i], vertex.mModedPosition[i]);
       maxVert[i] = glm::max(maxVert[i], vertex.mModedPosition[i]);
+      localMinVert[i] = glm::min(localMinVert[i], vertex.mPosition[i]);
+      localMaxVert[i] = glm::max(localMaxVert[i], vertex.mPosition[i]);
     }
   }
   mMaxVert = maxVert;
   mMinVert = minVert;
+  mLocalMaxVert = localMaxVert;
+  mLocalMinVert = localMinVert;
 }
 
 void Mesh::setIndex(const int id) {
   mIndex = id;
-  for (Triangle &triangle : mTriangles) {
-    triangle.mMeshIndex = mIndex;
+  for (LOD &lod : mLODs) {
+    for (Triangle &triangle : lod.mTriangles) {
+      triangle.mMeshIndex = mIndex;
+    }
   }
 }
 
-void Mesh::update() {
-  for (Vertex &vertex : mVertices) {
-    recalculateVertex(vertex);
+void Mesh::setModelIndex(const int id) {
+  for (LOD &lod : mLODs) {
+    for (Triangle &triangle : lod.mTriangles) {
+      triangle.mModelIndex = id;
+    }
   }
-  for (Triangle &triangle : mTriangles) {
-    for (int i = 0; i < 3; i++) {
-      recalculateVertex(triangle.mVertices[i]);
+}
+
+void Mesh::update() {
+  for (LOD &lod : mLODs) {
+    for (Vertex &vertex : lod.mVertices) {
+      recalculateVertex(vertex);
+    }
+    for (Triangle &triangle : lod.mTriangles) {
+      for (int i = 0; i < 3; i++) {
+        recalculateVertex(triangle.mVertices[i]);
+      }
+      triangle.recalculateCenter();
     }
-    triangle.recalculateCenter();
   }
   createBoundingBox();
 }
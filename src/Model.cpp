@@ -1,9 +1,13 @@
 #include "Model.h"
 #include <glm/glm.hpp>
+#include <glm/gtx/euler_angles.hpp>
+#include <algorithm>
 #include <iostream>
 
 #include "Utilities.h"
 
+#define LOD_LEVELS 4
+
 Model::Model(const std::string objPath) {
   mPath = objPath;
   mName = Utils::extractFilename(objPath);
@@ -113,17 +117,21 @@ void Model::createBoundingBox() {
   float max = std::numeric_limits<float>::max();
   glm::vec3 minVert = glm::vec3(max, max, max);
   glm::vec3 maxVert = glm::vec3(-max, -max, -max);
+  glm::vec3 localMinVert = minVert;
+  glm::vec3 localMaxVert = maxVert;
   for (int i = 0; i < mMeshes.size(); i++) {
     const Mesh &mesh = mMeshes[i];
-    const glm::vec3 &meshMaxVert = mesh.getMaxVert();
-    const glm::vec3 &meshMinVert = mesh.getMinVert();
     for (int j = 0; j < 3; j++) {
-      minVert[j] = glm::min(minVert[j], meshMinVert[j]);
-      maxVert[j] = glm::max(maxVert[j], meshMaxVert[j]);
+      minVert[j] = glm::min(minVert[j], mesh.getMinVert()[j]);
+      maxVert[j] = glm::max(maxVert[j], mesh.getMaxVert()[j]);
+      localMinVert[j] = glm::min(localMinVert[j], mesh.getLocalMinVert()[j]);
+      localMaxVert[j] = glm::max(localMaxVert[j], mesh.getLocalMaxVert()[j]);
     }
   }
   mMaxVert = maxVert;
   mMinVert = minVert;
+  mLocalMaxVert = localMaxVert;
+  mLocalMinVert = localMinVert;
 }
 
 void Model::update() {
@@ -136,11 +144,39 @@ void Model::update() {
   createBoundingBox();
 }
 
+glm::vec3 Model::transform(const glm::vec3 &point) const {
+  glm::mat3 rotationMatrix =
+      glm::eulerAngleXYZ(glm::radians(mRotation.x), glm::radians(mRotation.y),
+                         glm::radians(mRotation.z));
+  return mPosition + rotationMatrix * (point * mScale);
+}
+
 void Model::setSceneIndex(int id){
   mSceneIndex = id;
   for(Mesh& mesh : mMeshes){
-    for(Triangle& triangle : mesh.modTriangles()){
-      triangle.mModelIndex = id;
-    }
+    mesh.setModelIndex(id);
+  }
+}
+
+void Model::generateLODs() {
+  for (Mesh &mesh : mMeshes) {
+    mesh.generateLODs(LOD_LEVELS);
+  }
+  mLODsGenerated = true;
+  update();
+}
+
+void Model::setLODLevel(int level) {
+  mLODLevel = level;
+  for (Mesh &mesh : mMeshes) {
+    mesh.setLODLevel(level);
+  }
+}
+
+const int Model::getLODCount() const {
+  int count = 1;
+  for (const Mesh &mesh : mMeshes) {
+    count = std::max(count, mesh.getLODCount());
   }
+  return count;
 }
@@ -0,0 +1,154 @@
+#include "RegionTracker.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Corners closer than this to the camera plane fall back to the whole target
+#define REGION_NEAR 1e-3f
+
+void RegionTracker::snapshot(const Scene &scene) {
+  mMinVerts.clear();
+  mMaxVerts.clear();
+  for (const Model &model : scene.getModels()) {
+    mMinVerts.push_back(model.getMinVert());
+    mMaxVerts.push_back(model.getMaxVert());
+  }
+  mPrimitives = scene.getPrimitives();
+}
+
+bool RegionTracker::changedRegion(const Scene &scene, const Camera &camera,
+                                  float downsampleFactor, int width,
+                                  int height, bool shadows,
+                                  glm::ivec4 &region) const {
+  const std::vector<Model> &models = scene.getModels();
+  const std::vector<Primitive> &primitives = scene.getPrimitives();
+  if (models.size() != mMinVerts.size() ||
+      primitives.size() != mPrimitives.size())
+    return false;
+  for (int i = 0; i < primitives.size(); i++) {
+    const Primitive &primitive = primitives[i];
+    const Primitive &traced = mPrimitives[i];
+    if (primitive.mType != traced.mType ||
+        primitive.mPosition != traced.mPosition ||
+        primitive.mSize != traced.mSize ||
+        primitive.mRotation != traced.mRotation)
+      return false;
+  }
+
+  int changed = -1;
+  for (int i = 0; i < models.size(); i++) {
+    if (models[i].getMinVert() == mMinVerts[i] &&
+        models[i].getMaxVert() == mMaxVerts[i])
+      continue;
+    if (changed != -1)
+      return false;
+    changed = i;
+  }
+  if (changed == -1)
+    return false;
+
+  glm::vec4 before = project(mMinVerts[changed], mMaxVerts[changed], camera,
+                             downsampleFactor, width, height);
+  glm::vec4 after = project(models[changed].getMinVert(),
+                            models[changed].getMaxVert(), camera,
+                            downsampleFactor, width, height);
+  // Shadows the model cast before and after, both change
+  auto unite = [](const glm::vec4 &a, const glm::vec4 &b) {
+    return glm::vec4(std::min(a.x, b.x), std::min(a.y, b.y),
+                     std::max(a.z, b.z), std::max(a.w, b.w));
+  };
+  if (shadows) {
+    for (const Light &light : scene.getLights()) {
+      before = unite(before, projectShadow(mMinVerts[changed],
+                                           mMaxVerts[changed], light, camera,
+                                           downsampleFactor, width, height));
+      after = unite(after, projectShadow(models[changed].getMinVert(),
+                                         models[changed].getMaxVert(), light,
+                                         camera, downsampleFactor, width,
+                                         height));
+    }
+  }
+  // A texel of margin for texel centers on the edge
+  int minX = std::max((int)std::floor(std::min(before.x, after.x)) - 1, 0);
+  int minY = std::max((int)std::floor(std::min(before.y, after.y)) - 1, 0);
+  int maxX = std::min((int)std::ceil(std::max(before.z, after.z)) + 1, width);
+  int maxY = std::min((int)std::ceil(std::max(before.w, after.w)) + 1, height);
+  region = glm::ivec4(minX, minY, std::max(maxX - minX, 0),
+                      std::max(maxY - minY, 0));
+  return true;
+}
+
+glm::vec4 RegionTracker::project(const glm::vec3 &minVert,
+                                 const glm::vec3 &maxVert,
+                                 const Camera &camera, float downsampleFactor,
+                                 int width, int height) const {
+  // The camera matrix is orthonormal with right, up and back as columns
+  glm::mat3 view = glm::transpose(camera.getMatrix());
+  glm::vec4 rect(1e30f, 1e30f, -1e30f, -1e30f);
+  for (int corner = 0; corner < 8; corner++) {
+    glm::vec3 point(corner & 1 ? maxVert.x : minVert.x,
+                    corner & 2 ? maxVert.y : minVert.y,
+                    corner & 4 ? maxVert.z : minVert.z);
+    glm::vec3 local = view * (point - camera.getPosition());
+    if (-local.z < REGION_NEAR)
+      return glm::vec4(0.0f, 0.0f, width, height);
+    glm::vec2 texel = toTexel(local, camera, downsampleFactor);
+    rect.x = std::min(rect.x, texel.x);
+    rect.y = std::min(rect.y, texel.y);
+    rect.z = std::max(rect.z, texel.x);
+    rect.w = std::max(rect.w, texel.y);
+  }
+  return rect;
+}
+
+glm::vec4 RegionTracker::projectShadow(const glm::vec3 &minVert,
+                                       const glm::vec3 &maxVert,
+                                       const Light &light,
+                                       const Camera &camera,
+                                       float downsampleFactor, int width,
+                                       int height) const {
+  glm::vec4 full(0.0f, 0.0f, width, height);
+  // Directional light travels along its direction, as in the trace shader
+  float pitch = glm::radians(light.mPitch);
+  float yaw = glm::radians(light.mYaw);
+  glm::vec3 lightDirection(std::cos(pitch) * std::sin(yaw), std::sin(pitch),
+                           std::cos(pitch) * std::cos(yaw));
+  bool pointLight = light.mType == LightType::Point;
+  if (pointLight &&
+      glm::clamp(light.mPosition, minVert, maxVert) == light.mPosition)
+    return full;
+
+  // Every shadowed point lies on a ray from the box away from the light, the
+  // rays of the corners bound them. Rays moving away from the camera end at
+  // their vanishing point on screen.
+  glm::mat3 view = glm::transpose(camera.getMatrix());
+  glm::vec4 rect = project(minVert, maxVert, camera, downsampleFactor, width,
+                           height);
+  for (int corner = 0; corner < 8; corner++) {
+    glm::vec3 point(corner & 1 ? maxVert.x : minVert.x,
+                    corner & 2 ? maxVert.y : minVert.y,
+                    corner & 4 ? maxVert.z : minVert.z);
+    glm::vec3 direction = lightDirection;
+    if (pointLight)
+      direction = glm::normalize(point - light.mPosition);
+    glm::vec3 local = view * direction;
+    if (-local.z < REGION_NEAR)
+      return full;
+    glm::vec2 texel = toTexel(local, camera, downsampleFactor);
+    rect.x = std::min(rect.x, texel.x);
+    rect.y = std::min(rect.y, texel.y);
+    rect.z = std::max(rect.z, texel.x);
+    rect.w = std::max(rect.w, texel.y);
+  }
+  return rect;
+}
+
+glm::vec2 RegionTracker::toTexel(const glm::vec3 &local, const Camera &camera,
+                                 float downsampleFactor) const {
+  // Inverse of the ray direction in the trace shader
+  float focal = 1.0f / std::tan(0.5f * glm::radians(camera.getFOV()));
+  glm::vec2 resolution = glm::vec2(camera.getResolution()) / downsampleFactor;
+  glm::vec2 ndc(local.x / -local.z * focal / camera.getAspectRatio(),
+                local.y / -local.z * focal);
+  return (ndc * 0.5f + 0.5f) * resolution;
+}
@@ -0,0 +1,128 @@
+#include <glad/glad.h>
+
+#include "RenderTarget.h"
+
+#include <algorithm>
+#include <iostream>
+
+void RenderTarget::init(int width, int height, bool floatingPoint,
+                        const std::vector<int> &outputs, bool depth) {
+  mFloatingPoint = floatingPoint;
+  glGenFramebuffers(1, &mFBO);
+  mTextures.resize(outputs.size());
+  glGenTextures(mTextures.size(), mTextures.data());
+  if (depth)
+    glGenRenderbuffers(1, &mDepthBuffer);
+  setFilter(UpscaleFilter::Nearest);
+  resize(width, height);
+
+  // Draw buffers are indexed by fragment output, unused outputs go nowhere
+  int outputCount = *std::max_element(outputs.begin(), outputs.end()) + 1;
+  std::vector<GLenum> drawBuffers(outputCount, GL_NONE);
+  for (int i = 0; i < outputs.size(); i++) {
+    drawBuffers[outputs[i]] = GL_COLOR_ATTACHMENT0 + i;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+  glDrawBuffers(drawBuffers.size(), drawBuffers.data());
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void RenderTarget::resize(int width, int height) {
+  if (width == mWidth && height == mHeight)
+    return;
+  mWidth = width;
+  mHeight = height;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+  for (int i = 0; i < mTextures.size(); i++) {
+    glBindTexture(GL_TEXTURE_2D, mTextures[i]);
+    if (mFloatingPoint)
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA,
+                   GL_FLOAT, nullptr);
+    else
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+                   GL_UNSIGNED_BYTE, nullptr);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+                           GL_TEXTURE_2D, mTextures[i], 0);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  if (mDepthBuffer) {
+    glBindRenderbuffer(GL_RENDERBUFFER, mDepthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width,
+                          height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, mDepthBuffer);
+  }
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    std::cout << "Render target " << width << "x" << height
+              << " is incomplete" << std::endl;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void RenderTarget::setFilter(UpscaleFilter filter) {
+  GLint glFilter = filter == UpscaleFilter::Bilinear ? GL_LINEAR : GL_NEAREST;
+  for (unsigned int texture : mTextures) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, glFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, glFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void RenderTarget::bind() {
+  glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+  glViewport(0, 0, mWidth, mHeight);
+}
+
+void RenderTarget::unbind() { glBindFramebuffer(GL_FRAMEBUFFER, 0); }
+
+void RenderTarget::bindTexture(int unit, int attachment) {
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(GL_TEXTURE_2D, mTextures[attachment]);
+}
+
+void RenderTarget::bindImage(int unit, int attachment) {
+  glBindImageTexture(unit, mTextures[attachment], 0, GL_FALSE, 0,
+                     GL_WRITE_ONLY, GL_RGBA32F);
+}
+
+void RenderTarget::clear() {
+  glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  glClearDepth(1.0);
+  glClear(GL_COLOR_BUFFER_BIT | (mDepthBuffer ? GL_DEPTH_BUFFER_BIT : 0));
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void RenderTarget::generateMipmaps() {
+  glBindTexture(GL_TEXTURE_2D, mTextures[0]);
+  glGenerateMipmap(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void RenderTarget::readLevel(int level, std::vector<float> &pixels,
+                             int &width, int &height, int attachment) {
+  width = std::max(mWidth >> level, 1);
+  height = std::max(mHeight >> level, 1);
+  pixels.resize(width * height * 4);
+  glBindTexture(GL_TEXTURE_2D, mTextures[attachment]);
+  glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_FLOAT, pixels.data());
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void RenderTarget::upload(const std::vector<float> &pixels) {
+  glBindTexture(GL_TEXTURE_2D, mTextures[0]);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, mWidth, mHeight, GL_RGBA, GL_FLOAT,
+                  pixels.data());
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void RenderTarget::clean() {
+  glDeleteFramebuffers(1, &mFBO);
+  glDeleteTextures(mTextures.size(), mTextures.data());
+  if (mDepthBuffer)
+    glDeleteRenderbuffers(1, &mDepthBuffer);
+}
@@ -0,0 +1,97 @@
+#include <glad/glad.h>
+
+#include "Reprojector.h"
+#include "ShaderConstants.h"
+
+void Reprojector::init(int width, int height) {
+  // Color, vis and shadow mask, written by the trace to outputs 3 and 4
+  for (RenderTarget &history : mHistory) {
+    history.init(width, height, true, {0, 3, 4});
+  }
+  mReprojected.init(width, height, true, {0, 1, 2}, true);
+  for (FeedbackBuffer &counter : mCounters) {
+    counter.init(1, COUNTER_BINDING);
+  }
+  glGenVertexArrays(1, &mPointsVAO);
+}
+
+bool Reprojector::begin(Shader &reprojectShader, Shader &traceShader,
+                        UBO &data, const Settings &settings, int width,
+                        int height) {
+  readCounter();
+
+  // History of another size does not line up with the new frame
+  RenderTarget &previous = mHistory[mCurrent];
+  bool reproject = mValid && previous.getWidth() == width &&
+                   previous.getHeight() == height;
+  mReprojected.resize(width, height);
+  mReprojected.clear();
+  if (reproject) {
+    mReprojected.bind();
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    reprojectShader.use();
+    reprojectShader.setInt("uColor", 0);
+    reprojectShader.setInt("uVis", 1);
+    reprojectShader.setInt("uShadowMask", 2);
+    previous.bindTexture(0, 0);
+    previous.bindTexture(1, 1);
+    previous.bindTexture(2, 2);
+    data.bind();
+    glBindVertexArray(mPointsVAO);
+    glDrawArrays(GL_POINTS, 0, width * height);
+    glBindVertexArray(0);
+    glDisable(GL_DEPTH_TEST);
+    mReprojected.unbind();
+  }
+
+  mCurrent = 1 - mCurrent;
+  mHistory[mCurrent].resize(width, height);
+  mHistory[mCurrent].bind();
+  mCounters[mCurrent].clear();
+  mCounters[mCurrent].bind();
+  mCounterPixels[mCurrent] = reproject ? width * height : 0;
+
+  traceShader.use();
+  traceShader.setInt("uReprojectedColor", 1);
+  traceShader.setInt("uReprojectedVis", 2);
+  traceShader.setInt("uReprojectedShadowMask", 3);
+  traceShader.setFloat("uRefreshFraction", settings.mRefreshFraction);
+  traceShader.setInt("uFrame", mFrame++);
+  mReprojected.bindTexture(1, 0);
+  mReprojected.bindTexture(2, 1);
+  mReprojected.bindTexture(3, 2);
+  return reproject;
+}
+
+void Reprojector::end() {
+  mHistory[mCurrent].unbind();
+  mValid = true;
+}
+
+void Reprojector::readCounter() {
+  // The other counter belongs to the frame before, read a frame late
+  int older = 1 - mCurrent;
+  if (mCounterPixels[older] == 0) {
+    mTracedFraction = 1.0f;
+    return;
+  }
+  std::vector<int> traced;
+  mCounters[older].read(traced, 1);
+  mTracedFraction = (float)traced[0] / mCounterPixels[older];
+  mCounterPixels[older] = 0;
+}
+
+void Reprojector::setFilter(UpscaleFilter filter) {
+  mHistory[0].setFilter(filter);
+  mHistory[1].setFilter(filter);
+}
+
+void Reprojector::clean() {
+  for (int i = 0; i < 2; i++) {
+    mHistory[i].clean();
+    mCounters[i].clean();
+  }
+  mReprojected.clean();
+  glDeleteVertexArrays(1, &mPointsVAO);
+}
@@ -0,0 +1,31 @@
+#include "ResolutionController.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Fraction of the way to the ideal scale taken per measurement
+#define RESOLUTION_DAMPING 0.3f
+
+// Scale steps per unit
+#define RESOLUTION_STEPS 20.0f
+
+void ResolutionController::update(double traceTime, int tracedPixels,
+                                  int windowPixels,
+                                  const Settings &settings) {
+  mMinScale = settings.mMinRenderScale;
+  if (traceTime <= 0.0 || tracedPixels <= 0 || windowPixels <= 0)
+    return;
+
+  // Pixels the budget affords at the measured cost per pixel
+  double timePerPixel = traceTime / tracedPixels;
+  double budgetPixels = settings.mFrameBudget / timePerPixel;
+  float idealScale = (float)std::sqrt(budgetPixels / windowPixels);
+
+  mScale += (idealScale - mScale) * RESOLUTION_DAMPING;
+  mScale = std::clamp(mScale, mMinScale, 1.0f);
+}
+
+const float ResolutionController::getScale() const {
+  float scale = std::round(mScale * RESOLUTION_STEPS) / RESOLUTION_STEPS;
+  return std::clamp(scale, mMinScale, 1.0f);
+}
@@ -1,7 +1,11 @@
 #include "Scene.h"
 
+#include <fstream>
+#include <limits>
+
 int Scene::sModelsIndex = 0;
 int Scene::sLightsIndex = 0;
+int Scene::sPrimitivesIndex = 0;
 
 void Scene::addModel(const std::string &modelName) {
   Model model(modelName);
@@ -20,6 +24,14 @@ void Scene::addLight(LightType type) {
   mLights.push_back(light);
   sLightsIndex++;
 }
+void Scene::addPrimitive(PrimitiveType type) {
+  Primitive primitive(type);
+  primitive.mIndex = sPrimitivesIndex;
+  primitive.setName();
+  mPrimitives.push_back(primitive);
+  sPrimitivesIndex++;
+  recalculate();
+}
 bool Scene::removeModel(const int modelIndex) {
   bool found = false;
   int index;
@@ -54,6 +66,17 @@ bool Scene::removeLight(const int lightIndex) {
   return true;
 }
 
+bool Scene::removePrimitive(const int primitiveIndex) {
+  for (int i = 0; i < mPrimitives.size(); i++) {
+    if (mPrimitives[i].mIndex == primitiveIndex) {
+      mPrimitives.erase(mPrimitives.begin() + i);
+      recalculate();
+      return true;
+    }
+  }
+  return false;
+}
+
 Model *Scene::getModel(int modelIndex) {
   for (Model &model : mModels) {
     if (model.getIndex() == modelIndex)
@@ -72,12 +95,26 @@ Light *Scene::getLight(int lightIndex) {
   return nullptr;
 }
 
+void Scene::setKeepTriangles(bool keep) {
+  if (keep == mKeepTriangles)
+    return;
+  mKeepTriangles = keep;
+  recalculate();
+}
+
 void Scene::recalculate() {
   int modelIndex = 0;
   mTriangles.clear();
   mVertices.clear();
+  if (!mKeepTriangles) {
+    mTriangles.shrink_to_fit();
+    mVertices.shrink_to_fit();
+  }
+  mTriangleCount = 0;
   mMaterials.clear();
   mMaterialIndexes.clear();
+  mOriginalTriangles = 0;
+  mLODError = 0.0f;
   int indicesOffset = 0;
   for (Model &model : mModels) {
     model.setSceneIndex(modelIndex);
@@ -86,16 +123,112 @@ void Scene::recalculate() {
     for (Mesh &mesh : model.modMeshes()) {
       const Material material = mesh.getMaterial();
       mMaterials.push_back(material);
+      mOriginalTriangles += mesh.getOriginalTriangleCount();
+      const glm::vec3 &scale = model.getScale();
+      float maxScale = glm::max(glm::abs(scale.x),
+                                glm::max(glm::abs(scale.y), glm::abs(scale.z)));
+      mLODError = glm::max(mLODError, mesh.getLOD().mError * maxScale);
       for (Triangle &triangle : mesh.modTriangles()) {
         triangle.mModedIndices[0] = triangle.mIndices[0] + indicesOffset;
         triangle.mModedIndices[1] = triangle.mIndices[1] + indicesOffset;
         triangle.mModedIndices[2] = triangle.mIndices[2] + indicesOffset;
-        mTriangles.push_back(triangle);
+        if (mKeepTriangles)
+          mTriangles.push_back(triangle);
       }
-      for (const Vertex &vertex : mesh.getVertices()) {
-        mVertices.push_back(vertex);
+      mTriangleCount += mesh.getTriangles().size();
+      if (mKeepTriangles) {
+        for (const Vertex &vertex : mesh.getVertices()) {
+          mVertices.push_back(vertex);
+        }
       }
       indicesOffset += mesh.getVerticesCount();
     }
   }
+
+  // Bounded primitives enter the BVH as a triangle spanning their bounds
+  for (int i = 0; i < mPrimitives.size(); i++) {
+    const Primitive &primitive = mPrimitives[i];
+    mMaterialIndexes.push_back(1);
+    mMaterials.push_back(primitive.mMaterial);
+    if (primitive.isGlobal())
+      continue;
+
+    Triangle triangle;
+    glm::vec3 minVert, maxVert;
+    primitive.getBounds(minVert, maxVert);
+    triangle.mVertices[0].mModedPosition = minVert;
+    triangle.mVertices[1].mModedPosition = maxVert;
+    triangle.mVertices[2].mModedPosition = (minVert + maxVert) * 0.5f;
+    for (int k = 0; k < 3; k++) {
+      triangle.mVertices[k].mPosition = triangle.mVertices[k].mModedPosition;
+      triangle.mVertices[k].mNormal = glm::vec3(0.0f);
+    }
+    triangle.mIndices[0] = -1;
+    triangle.mIndices[1] = i;
+    triangle.mIndices[2] = 0;
+    for (int k = 0; k < 3; k++) {
+      triangle.mModedIndices[k] = triangle.mIndices[k];
+    }
+    triangle.mModelIndex = modelIndex + i;
+    triangle.mMeshIndex = 0;
+    triangle.recalculateCenter();
+    mTriangles.push_back(triangle);
+    mTriangleCount++;
+  }
+}
+
+Primitive *Scene::getPrimitive(int primitiveIndex) {
+  for (Primitive &primitive : mPrimitives) {
+    if (primitive.mIndex == primitiveIndex)
+      return &primitive;
+  }
+  std::cout << "primitive not found id: " << primitiveIndex << std::endl;
+  return nullptr;
+}
+
+bool Scene::updateLOD(const Camera &camera, const Settings &settings) {
+  float tanHalfFOV = glm::tan(0.5f * glm::radians(camera.getFOV()));
+  float height = camera.getResolution().y;
+  bool changed = false;
+  for (Model &model : mModels) {
+    int level = 0;
+    if (settings.mLOD) {
+      if (!model.hasLODs())
+        model.generateLODs();
+      // Projected bounding sphere diameter in pixels, every level down
+      // halves the size it is good for
+      glm::vec3 center = (model.getMaxVert() + model.getMinVert()) * 0.5f;
+      float radius = glm::length(model.getMaxVert() - center);
+      float distance = glm::length(center - camera.getPosition());
+      float pixels = std::numeric_limits<float>::max();
+      if (distance > radius)
+        pixels = radius * height / (distance * tanHalfFOV);
+      float threshold = settings.mLODThreshold;
+      while (level + 1 < model.getLODCount() && pixels < threshold) {
+        threshold *= 0.5f;
+        level++;
+      }
+    }
+    if (level != model.getLODLevel()) {
+      model.setLODLevel(level);
+      changed = true;
+    }
+  }
+  if (changed)
+    recalculate();
+  return changed;
+}
+
+bool Scene::exportTriangles(const std::string &path) const {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    std::cout << "Failed to open triangle file: " << path << std::endl;
+    return false;
+  }
+  // Primitives need the primitive table, which raw files do not carry
+  for (const Triangle &triangle : mTriangles) {
+    if (!triangle.isPrimitive())
+      file.write(reinterpret_cast<const char *>(&triangle), sizeof(Triangle));
+  }
+  return file.good();
 }
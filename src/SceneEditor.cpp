@@ -19,9 +19,10 @@ namespace fs = std::filesystem;
 SceneEditor::SceneEditor(const std::string &modelsFolder,
                          std::shared_ptr<Scene> scene,
                          std::shared_ptr<Camera> camera,
-                         std::shared_ptr<Settings> settings)
+                         std::shared_ptr<Settings> settings,
+                         std::shared_ptr<Stats> stats)
     : mModelsFolder(modelsFolder), mScene(scene), mCamera(camera),
-      mSettings(settings) {
+      mSettings(settings), mStats(stats) {
 
   refreshAvailableModels();
   refreshDefaultModels();
@@ -65,6 +66,8 @@ ChangeType SceneEditor::render(float fps, int dataSize) {
       overlayChange == ChangeType::LightType ||
       propertiesChange == ChangeType::LightType)
     return ChangeType::LightType;
+  if (overlayChange == ChangeType::ProxyType)
+    return ChangeType::ProxyType;
   if (cameraChange == ChangeType::CameraType)
     return ChangeType::CameraType;
   return ChangeType::NoneType;
@@ -76,9 +79,11 @@ ChangeType SceneEditor::selectorWindow() {
   bool modelChange = modelSelector();
   ImGui::Text("Lights");
   bool lightChange = lightSelector();
+  ImGui::Text("Primitives");
+  bool primitiveChange = primitiveSelector();
   ImGui::End();
 
-  if (modelChange)
+  if (modelChange || primitiveChange)
     return ChangeType::BVHType;
   else if (lightChange)
     return ChangeType::LightType;
@@ -88,11 +93,73 @@ ChangeType SceneEditor::selectorWindow() {
 void SceneEditor::debugWindow(float fps, int dataSize) {
   ImGui::Begin("DEBUG");
   ImGui::Text("FPS: %f", fps);
+  for (const auto &[factor, traceTime] : mStats->mTraceTimes) {
+    ImGui::Text("Trace 1/%i: %.2f ms", factor, traceTime);
+  }
+  ImGui::Text("Render scale: %.2f (%i x %i)%s", mStats->mRenderScale,
+              mStats->mRenderWidth, mStats->mRenderHeight,
+              mSettings->mDynamicResolution ? " dynamic" : "");
+  ImGui::Text("Trace: %.2f ms, frame: %.2f ms", mStats->mTraceTime,
+              mStats->mFrameTime);
+  if (mStats->mComputeGroupSize.x > 0)
+    ImGui::Text("Compute %ix%i: %.2f ms, fragment: %.2f ms, B compares",
+                mStats->mComputeGroupSize.x, mStats->mComputeGroupSize.y,
+                mStats->mComputeTraceTime, mStats->mFragmentTraceTime);
+  if (mSettings->mTimeSlicing)
+    ImGui::Text("Tiles: %i per frame, %i / %i, budget used %.0f%%",
+                mStats->mTilesPerFrame, mStats->mTilesDone,
+                mStats->mTileCount, mStats->mBudgetUsed * 100.0f);
+  if (mSettings->mReprojection)
+    ImGui::Text("Re-traced: %.1f%%", mStats->mTracedFraction * 100.0f);
+  if (mSettings->mInterleave > 1)
+    ImGui::Text("Interleaved: 1/%i pixels per frame%s", mSettings->mInterleave,
+                mStats->mInterleaveSettling ? ", settling" : "");
+  if (mSettings->mCornerSampling)
+    ImGui::Text("Corners: %.1f%% skipped, error %.2f (%.1f%% px), V compares",
+                mStats->mCornerSkipped * 100.0f, mStats->mCornerError,
+                mStats->mCornerErrorPixels * 100.0f);
+  if (mSettings->mRegionTrace)
+    ImGui::Text("Last edit re-traced: %i px (%.1f%%)", mStats->mRegionPixels,
+                mStats->mRegionPixels * 100.0f /
+                    std::max(mStats->mRenderWidth * mStats->mRenderHeight, 1));
+  if (mSettings->mProgressive) {
+    ImGui::Text("Samples: %.1f, %.2f Msamples/s", mStats->mSamples,
+                mStats->mSamplesPerSecond / 1e6);
+    ImGui::Text("Active tiles: %i", mStats->mActiveTiles);
+    ImGui::Text("Noise: %.2f / %.2f", mStats->mNoise,
+                mSettings->mNoiseThreshold);
+    if (mSettings->mDenoise)
+      ImGui::Text("Denoise: %.2f ms (filter %.2f ms)",
+                  mStats->mDenoiseTotalTime, mStats->mDenoiseTime);
+    if (mStats->mConverged)
+      ImGui::Text("Converged in %.2f s", mStats->mAccumulationTime);
+    else
+      ImGui::Text("Accumulating %.2f s", mStats->mAccumulationTime);
+  }
   ImGui::Text("Models: %i", mScene->getModelCount());
-  ImGui::Text("Triangles: %i", mScene->getTrianglesCount());
+  ImGui::Text("Triangles: %i / %i", mScene->getTrianglesCount(),
+              mScene->getOriginalTrianglesCount());
+  if (mSettings->mLOD)
+    ImGui::Text("LOD error: %f", mScene->getLODError());
   ImGui::Text("Vertices: %i", mScene->getVerticesCount());
   ImGui::Text("Materials: %i", mScene->getMaterialsCount());
   ImGui::Text("Data: %i", dataSize);
+  ImGui::Text("BVH: %i nodes, %.2f ms", mStats->mBVHNodes,
+              mStats->mBVHBuildTime);
+  if (mSettings->mLazyBVH)
+    ImGui::Text("Unbuilt nodes: %i", mStats->mUnbuiltNodes);
+  if (mSettings->mStreamGeometry) {
+    ImGui::Text("Chunks: %i visible, %i resident / %i",
+                mStats->mVisibleChunks, mStats->mResidentChunks,
+                mStats->mChunkCount);
+    // Only chunks in view and those between them and a light are gathered,
+    // the farthest are left out once the buffer budget is used
+    ImGui::Text("Shadow casters: %i, over budget: %i", mStats->mCasterChunks,
+                mStats->mDroppedChunks);
+    ImGui::Text("Resident: %.1f MB",
+                mStats->mResidentBytes / (1024.0f * 1024.0f));
+    ImGui::Text("Cache hit rate: %.1f%%", mStats->mCacheHitRate * 100.0f);
+  }
   viewSelected();
   ImGui::End();
 }
@@ -102,16 +169,41 @@ ChangeType SceneEditor::settingsWindow() {
   bool depthChange = Edit::slider("BVH depth", mSettings->mMaxDepth, 0, 30);
   bool triangleChange =
       Edit::slider("BVH triangles", mSettings->mMaxTrianglesInLeaf, 0, 100);
+  bool padChange = ImGui::Checkbox("Pad leaves", &mSettings->mPadLeaves);
   bool viewportModeChange = viewportTypeEdit();
+  bool traversalChange =
+      ImGui::Checkbox("Stackless traversal", &mSettings->mStacklessTraversal);
   bool coordinateModeChange = coordinateSystemModeEdit();
   bool downsampleChange =
       Edit::slider("Downsample", mSettings->mDownsampleFactor, 1, 20);
+  bool filterChange = upscaleFilterEdit();
+  dynamicResolutionEdit();
+  bool slicingChange = timeSlicingEdit();
+  ImGui::Checkbox("Render on demand", &mSettings->mRenderOnDemand);
+  if (mSettings->mRenderOnDemand)
+    ImGui::Checkbox("Region re-trace", &mSettings->mRegionTrace);
+  bool cornerChange = cornerSamplingEdit();
+  bool interleaveChange = interleaveEdit();
+  ImGui::Checkbox("Proxy while dragging", &mSettings->mDragProxy);
+  if (mSettings->mDragProxy)
+    Edit::slider("Drag downsample", mSettings->mDragDownsample, 1, 8);
+  bool reprojectionChange = reprojectionEdit();
+  bool progressiveChange = progressiveEdit();
+  bool shadowsChange = ImGui::Checkbox("Shadows", &mSettings->mShadows);
+  bool lazyChange = lazyEdit();
+  bool streamingChange = streamingEdit();
+  bool lodChange = lodEdit();
 
   ImGui::End();
-  if (depthChange || triangleChange)
+  if (depthChange || triangleChange || padChange || lazyChange || streamingChange ||
+      lodChange)
     return ChangeType::BVHType;
-  if (downsampleChange || viewportModeChange)
+  if (downsampleChange || viewportModeChange || shadowsChange || filterChange ||
+      progressiveChange || reprojectionChange || cornerChange ||
+      interleaveChange || slicingChange)
     return ChangeType::SettingsType;
+  if (traversalChange)
+    return ChangeType::ShaderType;
   return ChangeType::NoneType;
 }
 
@@ -132,6 +224,147 @@ bool SceneEditor::viewportTypeEdit() {
   return viewportModeChange;
 }
 
+bool SceneEditor::upscaleFilterEdit() {
+  bool filterChange = false;
+  if (ImGui::RadioButton("Nearest", (int *)&mSettings->mUpscaleFilter,
+                         Nearest)) {
+    filterChange = true;
+  }
+  ImGui::SameLine();
+  if (ImGui::RadioButton("Bilinear", (int *)&mSettings->mUpscaleFilter,
+                         Bilinear)) {
+    filterChange = true;
+  }
+  return filterChange;
+}
+
+bool SceneEditor::streamingEdit() {
+  bool streamChange =
+      ImGui::Checkbox("Stream geometry", &mSettings->mStreamGeometry);
+  if (!mSettings->mStreamGeometry)
+    return streamChange;
+  bool chunkChange =
+      Edit::slider("Chunk size", mSettings->mChunkSize, 256, 65536);
+  bool budgetChange =
+      Edit::slider("Budget MB", mSettings->mResidencyBudget, 16, 4096);
+  return streamChange || chunkChange || budgetChange;
+}
+
+bool SceneEditor::lazyEdit() {
+  bool lazyChange = ImGui::Checkbox("Lazy BVH", &mSettings->mLazyBVH);
+  if (!mSettings->mLazyBVH)
+    return lazyChange;
+  bool depthChange = Edit::slider("Lazy depth", mSettings->mLazyDepth, 1, 20);
+  // Only affects later expansions, no rebuild needed
+  Edit::slider("Expand per frame", mSettings->mLazyExpandPerFrame, 1, 64);
+  return lazyChange || depthChange;
+}
+
+void SceneEditor::dynamicResolutionEdit() {
+  // Read every frame by the application, nothing to rebuild
+  ImGui::Checkbox("Dynamic resolution", &mSettings->mDynamicResolution);
+  if (!mSettings->mDynamicResolution)
+    return;
+  Edit::slider("Frame budget (ms)", mSettings->mFrameBudget, 1.0f, 100.0f);
+  Edit::slider("Min scale", mSettings->mMinRenderScale, 0.05f, 1.0f);
+}
+
+bool SceneEditor::timeSlicingEdit() {
+  bool slicingChange =
+      ImGui::Checkbox("Time slicing", &mSettings->mTimeSlicing);
+  if (!mSettings->mTimeSlicing)
+    return slicingChange;
+  bool tileChange = Edit::slider("Tile size", mSettings->mTileSize, 8, 512);
+  // Shared with dynamic resolution, read every frame
+  Edit::slider("Slice budget (ms)", mSettings->mFrameBudget, 1.0f, 100.0f);
+  return slicingChange || tileChange;
+}
+
+bool SceneEditor::reprojectionEdit() {
+  bool reprojectionChange =
+      ImGui::Checkbox("Reprojection", &mSettings->mReprojection);
+  if (!mSettings->mReprojection)
+    return reprojectionChange;
+  bool refreshChange = Edit::slider("Refresh fraction",
+                                    mSettings->mRefreshFraction, 0.0f, 1.0f);
+  return reprojectionChange || refreshChange;
+}
+
+bool SceneEditor::cornerSamplingEdit() {
+  bool cornerChange =
+      ImGui::Checkbox("Corner sampling", &mSettings->mCornerSampling);
+  if (!mSettings->mCornerSampling)
+    return cornerChange;
+  bool blockChange =
+      Edit::slider("Corner block", mSettings->mCornerBlock, 2, 16);
+  return cornerChange || blockChange;
+}
+
+bool SceneEditor::interleaveEdit() {
+  bool interleaveChange = false;
+  ImGui::Text("Interleave");
+  ImGui::SameLine();
+  if (ImGui::RadioButton("Off", &mSettings->mInterleave, 1))
+    interleaveChange = true;
+  ImGui::SameLine();
+  if (ImGui::RadioButton("Half", &mSettings->mInterleave, 2))
+    interleaveChange = true;
+  ImGui::SameLine();
+  if (ImGui::RadioButton("Quarter", &mSettings->mInterleave, 4))
+    interleaveChange = true;
+  return interleaveChange;
+}
+
+bool SceneEditor::progressiveEdit() {
+  bool progressiveChange =
+      ImGui::Checkbox("Progressive", &mSettings->mProgressive);
+  if (!mSettings->mProgressive)
+    return progressiveChange;
+  bool thresholdChange = Edit::slider("Noise threshold (1/255)",
+                                      mSettings->mNoiseThreshold, 0.05f, 8.0f);
+  bool samplesChange =
+      Edit::slider("Max samples", mSettings->mMaxSamples, 1, 4096);
+  bool adaptiveChange =
+      ImGui::Checkbox("Adaptive sampling", &mSettings->mAdaptiveSampling);
+  bool baseChange = false;
+  bool budgetChange = false;
+  if (mSettings->mAdaptiveSampling) {
+    baseChange = Edit::slider("Base samples", mSettings->mBaseSamples, 2, 64);
+    budgetChange = Edit::slider("Sample budget (frames)",
+                                mSettings->mSampleBudget, 0.1f, 4.0f);
+  }
+  bool denoiseChange = denoiseEdit();
+  return progressiveChange || thresholdChange || samplesChange ||
+         adaptiveChange || baseChange || budgetChange || denoiseChange;
+}
+
+bool SceneEditor::denoiseEdit() {
+  bool denoiseChange = ImGui::Checkbox("Denoise", &mSettings->mDenoise);
+  if (!mSettings->mDenoise)
+    return denoiseChange;
+  bool intervalChange = Edit::slider("Denoise every (samples)",
+                                     mSettings->mDenoiseInterval, 1, 64);
+  bool iterationsChange =
+      Edit::slider("Denoise passes", mSettings->mDenoiseIterations, 1, 8);
+  bool colorChange = Edit::slider("Color sigma", mSettings->mDenoiseColorSigma,
+                                  0.01f, 4.0f);
+  bool normalChange = Edit::slider(
+      "Normal sigma", mSettings->mDenoiseNormalSigma, 0.01f, 2.0f);
+  bool depthChange = Edit::slider("Depth sigma", mSettings->mDenoiseDepthSigma,
+                                  0.001f, 1.0f);
+  return denoiseChange || intervalChange || iterationsChange || colorChange ||
+         normalChange || depthChange;
+}
+
+bool SceneEditor::lodEdit() {
+  bool lodChange = ImGui::Checkbox("LOD", &mSettings->mLOD);
+  if (!mSettings->mLOD)
+    return lodChange;
+  bool thresholdChange =
+      Edit::slider("LOD pixels", mSettings->mLODThreshold, 16, 2048);
+  return lodChange || thresholdChange;
+}
+
 void SceneEditor::viewSelected() {
   ImGui::Text("Selected model:");
   if (mSelectedModel != nullptr)
@@ -431,11 +664,114 @@ void SceneEditor::loadLight() {
   refreshLoadedLights();
 }
 
+bool SceneEditor::primitiveSelector() {
+  bool primitiveRemoved = false;
+  bool primitiveAdded = false;
+
+  ImVec2 size(-1, 5 * ImGui::GetTextLineHeightWithSpacing());
+
+  if (ImGui::BeginListBox("LoadedPrimitives", size)) {
+    for (const Primitive &primitive : mScene->getPrimitives()) {
+      if (ImGui::Selectable(primitive.mName.c_str(),
+                            mSelectedPrimitiveIndex == primitive.mIndex)) {
+        deselectAll();
+        mSelectedPrimitiveIndex = primitive.mIndex;
+        mSelectedPrimitive = mScene->getPrimitive(mSelectedPrimitiveIndex);
+      }
+      handleRemovingPrimitive(primitive.mIndex);
+    }
+    if (removePrimitive())
+      primitiveRemoved = true;
+
+    if (handleLoadingPrimitive())
+      primitiveAdded = true;
+
+    ImGui::EndListBox();
+  }
+  if (primitiveAdded) {
+    deselectAll();
+    mSelectedPrimitiveIndex = mScene->getPrimitives().back().mIndex;
+    mSelectedPrimitive = mScene->getPrimitive(mSelectedPrimitiveIndex);
+  }
+  return primitiveAdded || primitiveRemoved;
+}
+
+void SceneEditor::handleRemovingPrimitive(int index) {
+  if (ImGui::IsItemClicked(ImGuiMouseButton_Right)) {
+    mSelectedPrimitiveIndex = index;
+    mSelectedPrimitive = mScene->getPrimitive(mSelectedPrimitiveIndex);
+    if (!ImGui::IsPopupOpen("RemovePrimitiveMenu")) {
+      ImGui::OpenPopup("RemovePrimitiveMenu");
+    }
+  }
+}
+
+bool SceneEditor::removePrimitive() {
+  bool primitiveRemoved = false;
+  if (ImGui::BeginPopup("RemovePrimitiveMenu")) {
+    if (ImGui::MenuItem("RemovePrimitive")) {
+      mScene->removePrimitive(mSelectedPrimitiveIndex);
+      primitiveRemoved = true;
+      deselectAll();
+      ImGui::CloseCurrentPopup();
+    }
+    ImGui::EndPopup();
+  }
+  return primitiveRemoved;
+}
+
+bool SceneEditor::handleLoadingPrimitive() {
+  bool primitiveAdded = false;
+  if (ImGui::IsWindowHovered(ImGuiHoveredFlags_ChildWindows)) {
+    if (ImGui::IsMouseReleased(ImGuiMouseButton_Right)) {
+      ImGui::OpenPopup("AddPrimitiveMenu");
+    }
+  }
+  if (ImGui::BeginPopup("AddPrimitiveMenu")) {
+    if (ImGui::MenuItem("Sphere")) {
+      mScene->addPrimitive(PrimitiveType::Sphere);
+      primitiveAdded = true;
+    }
+    if (ImGui::MenuItem("Plane")) {
+      mScene->addPrimitive(PrimitiveType::Plane);
+      primitiveAdded = true;
+    }
+    if (ImGui::MenuItem("Box")) {
+      mScene->addPrimitive(PrimitiveType::Box);
+      primitiveAdded = true;
+    }
+    ImGui::EndPopup();
+  }
+  return primitiveAdded;
+}
+
+ChangeType SceneEditor::editPrimitive() {
+  ImGui::Text("TRANSFORM");
+  bool positionChange = Edit::vec3("Position", mSelectedPrimitive->mPosition);
+  bool sizeChange = Edit::vec3("Size", mSelectedPrimitive->mSize);
+  bool rotateChange = Edit::vec3("Rotate", mSelectedPrimitive->mRotation);
+  if (mSelectedPrimitive->mType == PrimitiveType::Plane)
+    ImGui::Text("Zero size x or z makes the plane infinite");
+  ImGui::Text("MATERIAL");
+  bool materialChange = Edit::colorEdit3(
+      "Diffuse", mSelectedPrimitive->mMaterial.modDiffuse());
+
+  if (positionChange || sizeChange || rotateChange || materialChange)
+    mScene->recalculate();
+  if (positionChange || sizeChange || rotateChange)
+    return ChangeType::BVHType;
+  else if (materialChange)
+    return ChangeType::MaterialType;
+  return ChangeType::NoneType;
+}
+
 void SceneEditor::deselectAll() {
   mSelectedModel = nullptr;
   mSelectedModelIndex = -1;
   mSelectedLight = nullptr;
   mSelectedLightIndex = -1;
+  mSelectedPrimitive = nullptr;
+  mSelectedPrimitiveIndex = -1;
 }
 
 bool SceneEditor::lightEdit() {
@@ -485,6 +821,10 @@ ChangeType SceneEditor::propertiesWindow() {
     ImGui::Separator();
     if (lightEdit())
       lightChange = true;
+  } else if (mSelectedPrimitive != nullptr) {
+    ImGui::Text("%s", mSelectedPrimitive->mName.c_str());
+    ImGui::Separator();
+    modelChange = editPrimitive();
   }
   ImGui::End();
 
@@ -514,6 +854,7 @@ ChangeType SceneEditor::editModel() {
 ChangeType SceneEditor::overlayWindow() {
   bool modelChanged = false;
   bool lightChanged = false;
+  bool proxyChanged = false;
   ImGui::SetNextWindowPos(ImVec2(0, 0));
   ImGui::SetNextWindowSize(ImGui::GetIO().DisplaySize);
   ImGui::Begin("Transparent Window", NULL,
@@ -526,8 +867,29 @@ ChangeType SceneEditor::overlayWindow() {
     if (drawCoordinateSystem(mSelectedModel->modPosition(),
                              mSelectedModel->modRotation(),
                              mSelectedModel->modScale())) {
+      // Only the transform follows the drag, vertices and the BVH wait for
+      // the release
+      if (mSettings->mDragProxy && isDragging()) {
+        mProxyModel = mSelectedModel;
+        proxyChanged = true;
+      } else if (mProxyModel != mSelectedModel) {
+        modelChanged = true;
+        mSelectedModel->update();
+        mScene->recalculate();
+      }
+    }
+  }
+  if (mProxyModel != nullptr && !isDragging()) {
+    mProxyModel->update();
+    mScene->recalculate();
+    mProxyModel = nullptr;
+    modelChanged = true;
+  }
+  if (mSelectedPrimitive != nullptr) {
+    if (drawCoordinateSystem(mSelectedPrimitive->mPosition,
+                             mSelectedPrimitive->mRotation,
+                             mSelectedPrimitive->mSize)) {
       modelChanged = true;
-      mSelectedModel->update();
       mScene->recalculate();
     }
   }
@@ -544,6 +906,8 @@ ChangeType SceneEditor::overlayWindow() {
     return ChangeType::BVHType;
   if (lightChanged)
     return ChangeType::LightType;
+  if (proxyChanged)
+    return ChangeType::ProxyType;
   return ChangeType::NoneType;
 }
 
@@ -552,6 +916,11 @@ float Distance(const ImVec2 &p1, const ImVec2 &p2) {
                    (p1.y - p2.y) * (p1.y - p2.y));
 }
 
+bool SceneEditor::isDragging() const {
+  return mDraggingX || mDraggingY || mDraggingZ || mRotatingX || mRotatingY ||
+         mRotatingZ;
+}
+
 bool SceneEditor::coordinateSystemModeEdit() {
   bool modeChange = false;
   if (ImGui::RadioButton("Pos", (int *)&mCoordSystem->mMode, Position)) {
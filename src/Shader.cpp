@@ -5,10 +5,13 @@
 #include <iostream>
 #include <sstream>
 
-Shader::Shader(const char *vertexShaderPath, const char *fragmentShaderPath) {
-  std::string vertexShaderCode = readShaderFile(vertexShaderPath);
+Shader::Shader(const char *vertexShaderPath, const char *fragmentShaderPath,
+               const std::vector<std::string> &defines) {
+  std::string vertexShaderCode =
+      addDefines(readShaderFile(vertexShaderPath), defines);
   const char *vertexShaderSource = vertexShaderCode.c_str();
-  std::string fragmentShaderCode = readShaderFile(fragmentShaderPath);
+  std::string fragmentShaderCode =
+      addDefines(readShaderFile(fragmentShaderPath), defines);
   const char *fragmentShaderSource = fragmentShaderCode.c_str();
 
   // Compile Vertex Shader
@@ -57,6 +60,37 @@ Shader::Shader(const char *vertexShaderPath, const char *fragmentShaderPath) {
   glDeleteShader(fragmentShader);
 }
 
+Shader::Shader(const char *computeShaderPath,
+               const std::vector<std::string> &defines) {
+  std::string computeShaderCode =
+      addDefines(readShaderFile(computeShaderPath), defines);
+  const char *computeShaderSource = computeShaderCode.c_str();
+
+  GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+  glShaderSource(computeShader, 1, &computeShaderSource, NULL);
+  glCompileShader(computeShader);
+
+  GLint success;
+  GLchar infoLog[512];
+  glGetShaderiv(computeShader, GL_COMPILE_STATUS, &success);
+  if (!success) {
+    glGetShaderInfoLog(computeShader, 512, NULL, infoLog);
+    std::cout << "Compute Shader Compilation Failed:\n"
+              << infoLog << std::endl;
+  }
+
+  mID = glCreateProgram();
+  glAttachShader(mID, computeShader);
+  glLinkProgram(mID);
+
+  glGetProgramiv(mID, GL_LINK_STATUS, &success);
+  if (!success) {
+    glGetProgramInfoLog(mID, 512, NULL, infoLog);
+    std::cout << "Shader Program Linking Failed:\n" << infoLog << std::endl;
+  }
+  glDeleteShader(computeShader);
+}
+
 std::string Shader::readShaderFile(const char *filePath) {
   std::cout << "Reading file: " << filePath << std::endl;
   std::ifstream file(filePath);
@@ -72,4 +106,39 @@ std::string Shader::readShaderFile(const char *filePath) {
   return buffer.str();
 }
 
+std::string Shader::addDefines(const std::string &code,
+                               const std::vector<std::string> &defines) {
+  if (defines.empty())
+    return code;
+  size_t lineEnd = code.find('\n');
+  if (lineEnd == std::string::npos)
+    return code;
+  std::string defineLines;
+  for (const std::string &define : defines) {
+    defineLines += "#define " + define + "\n";
+  }
+  return code.substr(0, lineEnd + 1) + defineLines + code.substr(lineEnd + 1);
+}
+
 void Shader::use() { glUseProgram(mID); }
+
+void Shader::setInt(const char *name, int value) {
+  glUniform1i(glGetUniformLocation(mID, name), value);
+}
+
+void Shader::setFloat(const char *name, float value) {
+  glUniform1f(glGetUniformLocation(mID, name), value);
+}
+
+void Shader::setIVec2(const char *name, const glm::ivec2 &value) {
+  glUniform2i(glGetUniformLocation(mID, name), value.x, value.y);
+}
+
+void Shader::setVec3(const char *name, const glm::vec3 &value) {
+  glUniform3f(glGetUniformLocation(mID, name), value.x, value.y, value.z);
+}
+
+void Shader::setMat3(const char *name, const glm::mat3 &value) {
+  glUniformMatrix3fv(glGetUniformLocation(mID, name), 1, GL_FALSE,
+                     &value[0][0]);
+}
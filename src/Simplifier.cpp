@@ -0,0 +1,326 @@
+#include "Simplifier.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <map>
+#include <queue>
+
+#define BOUNDARY_WEIGHT 1000.0
+#define SINGULAR_EPSILON 1e-12
+
+namespace {
+
+// Symmetric 4x4 error quadric: a2 ab ac ad b2 bc bd c2 cd d2
+struct Quadric {
+  double m[10] = {};
+
+  static Quadric plane(const glm::vec3 &normal, float d, double weight) {
+    Quadric q;
+    double a = normal.x, b = normal.y, c = normal.z;
+    q.m[0] = a * a * weight;
+    q.m[1] = a * b * weight;
+    q.m[2] = a * c * weight;
+    q.m[3] = a * d * weight;
+    q.m[4] = b * b * weight;
+    q.m[5] = b * c * weight;
+    q.m[6] = b * d * weight;
+    q.m[7] = c * c * weight;
+    q.m[8] = c * d * weight;
+    q.m[9] = (double)d * d * weight;
+    return q;
+  }
+
+  Quadric &operator+=(const Quadric &other) {
+    for (int i = 0; i < 10; i++) {
+      m[i] += other.m[i];
+    }
+    return *this;
+  }
+
+  double error(const glm::vec3 &v) const {
+    double x = v.x, y = v.y, z = v.z;
+    return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z +
+           2 * m[3] * x + m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y +
+           m[7] * z * z + 2 * m[8] * z + m[9];
+  }
+
+  // Position minimizing the error, false when the system is singular
+  bool optimal(glm::vec3 &out) const {
+    double det = m[0] * (m[4] * m[7] - m[5] * m[5]) -
+                 m[1] * (m[1] * m[7] - m[5] * m[2]) +
+                 m[2] * (m[1] * m[5] - m[4] * m[2]);
+    if (std::abs(det) < SINGULAR_EPSILON)
+      return false;
+    double invDet = 1.0 / det;
+    double bx = -m[3], by = -m[6], bz = -m[8];
+    out.x = (bx * (m[4] * m[7] - m[5] * m[5]) -
+             m[1] * (by * m[7] - m[5] * bz) + m[2] * (by * m[5] - m[4] * bz)) *
+            invDet;
+    out.y = (m[0] * (by * m[7] - bz * m[5]) -
+             bx * (m[1] * m[7] - m[5] * m[2]) + m[2] * (m[1] * bz - by * m[2])) *
+            invDet;
+    out.z = (m[0] * (m[4] * bz - m[5] * by) -
+             m[1] * (m[1] * bz - by * m[2]) + bx * (m[1] * m[5] - m[4] * m[2])) *
+            invDet;
+    return true;
+  }
+};
+
+struct Collapse {
+  double mCost;
+  int mKeep;
+  int mRemove;
+  int mKeepStamp;
+  int mRemoveStamp;
+  glm::vec3 mTarget;
+
+  bool operator>(const Collapse &other) const { return mCost > other.mCost; }
+};
+
+glm::vec3 faceNormal(const glm::vec3 &a, const glm::vec3 &b,
+                     const glm::vec3 &c) {
+  return glm::cross(b - a, c - a);
+}
+
+} // namespace
+
+SimplifiedMesh Simplifier::simplify(const std::vector<glm::vec3> &positions,
+                                    const std::vector<int> &indices,
+                                    int targetTriangles) {
+  // Weld vertices by position
+  std::map<std::array<float, 3>, int> welded;
+  std::vector<int> remap(positions.size());
+  std::vector<glm::vec3> vertices;
+  for (int i = 0; i < positions.size(); i++) {
+    std::array<float, 3> key = {positions[i].x, positions[i].y,
+                                positions[i].z};
+    auto it = welded.find(key);
+    if (it == welded.end()) {
+      it = welded.insert({key, (int)vertices.size()}).first;
+      vertices.push_back(positions[i]);
+    }
+    remap[i] = it->second;
+  }
+
+  std::vector<std::array<int, 3>> triangles;
+  for (int i = 0; i + 2 < indices.size(); i += 3) {
+    std::array<int, 3> triangle = {remap[indices[i]], remap[indices[i + 1]],
+                                   remap[indices[i + 2]]};
+    if (triangle[0] == triangle[1] || triangle[1] == triangle[2] ||
+        triangle[0] == triangle[2])
+      continue;
+    triangles.push_back(triangle);
+  }
+
+  // Plane quadrics, boundary edges get a heavy perpendicular plane so open
+  // borders keep their shape
+  std::vector<Quadric> quadrics(vertices.size());
+  std::vector<std::vector<int>> vertexTriangles(vertices.size());
+  std::map<std::pair<int, int>, int> edgeUse;
+  for (int t = 0; t < triangles.size(); t++) {
+    const std::array<int, 3> &triangle = triangles[t];
+    glm::vec3 normal = faceNormal(vertices[triangle[0]], vertices[triangle[1]],
+                                  vertices[triangle[2]]);
+    float area = glm::length(normal);
+    if (area > 0.0f)
+      normal /= area;
+    float d = -glm::dot(normal, vertices[triangle[0]]);
+    Quadric quadric = Quadric::plane(normal, d, area);
+    for (int k = 0; k < 3; k++) {
+      quadrics[triangle[k]] += quadric;
+      vertexTriangles[triangle[k]].push_back(t);
+      int a = triangle[k], b = triangle[(k + 1) % 3];
+      edgeUse[{std::min(a, b), std::max(a, b)}]++;
+    }
+  }
+  for (const std::array<int, 3> &triangle : triangles) {
+    glm::vec3 normal = glm::normalize(faceNormal(
+        vertices[triangle[0]], vertices[triangle[1]], vertices[triangle[2]]));
+    for (int k = 0; k < 3; k++) {
+      int a = triangle[k], b = triangle[(k + 1) % 3];
+      if (edgeUse[{std::min(a, b), std::max(a, b)}] != 1)
+        continue;
+      glm::vec3 edge = vertices[b] - vertices[a];
+      glm::vec3 sideNormal = glm::cross(edge, normal);
+      float length = glm::length(sideNormal);
+      if (length == 0.0f)
+        continue;
+      sideNormal /= length;
+      float d = -glm::dot(sideNormal, vertices[a]);
+      Quadric quadric = Quadric::plane(sideNormal, d, BOUNDARY_WEIGHT);
+      quadrics[a] += quadric;
+      quadrics[b] += quadric;
+    }
+  }
+
+  std::vector<int> stamps(vertices.size(), 0);
+  // How far the surface around a vertex may have moved from the original
+  std::vector<float> deviations(vertices.size(), 0.0f);
+  std::vector<bool> removedVertices(vertices.size(), false);
+  std::vector<bool> removedTriangles(triangles.size(), false);
+
+  auto makeCollapse = [&](int keep, int remove) {
+    Quadric quadric = quadrics[keep];
+    quadric += quadrics[remove];
+    Collapse collapse;
+    collapse.mKeep = keep;
+    collapse.mRemove = remove;
+    collapse.mKeepStamp = stamps[keep];
+    collapse.mRemoveStamp = stamps[remove];
+    if (!quadric.optimal(collapse.mTarget)) {
+      glm::vec3 mid = (vertices[keep] + vertices[remove]) * 0.5f;
+      collapse.mTarget = mid;
+      for (const glm::vec3 &candidate : {vertices[keep], vertices[remove]}) {
+        if (quadric.error(candidate) < quadric.error(collapse.mTarget))
+          collapse.mTarget = candidate;
+      }
+    }
+    collapse.mCost = quadric.error(collapse.mTarget);
+    return collapse;
+  };
+
+  std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>>
+      heap;
+  for (const auto &edge : edgeUse) {
+    heap.push(makeCollapse(edge.first.first, edge.first.second));
+  }
+
+  // Largest distance of the target from the planes of the triangles around
+  // the collapsed edge
+  auto planeDistance = [&](const Collapse &collapse) {
+    float distance = 0.0f;
+    for (int vertex : {collapse.mKeep, collapse.mRemove}) {
+      for (int t : vertexTriangles[vertex]) {
+        if (removedTriangles[t])
+          continue;
+        const std::array<int, 3> &triangle = triangles[t];
+        glm::vec3 normal = faceNormal(vertices[triangle[0]],
+                                      vertices[triangle[1]],
+                                      vertices[triangle[2]]);
+        float length = glm::length(normal);
+        if (length == 0.0f)
+          continue;
+        distance = std::max(
+            distance, std::abs(glm::dot(normal / length,
+                                        collapse.mTarget -
+                                            vertices[triangle[0]])));
+      }
+    }
+    return distance;
+  };
+
+  // Rejects collapses that would flip a surviving triangle
+  auto flips = [&](const Collapse &collapse, int vertex) {
+    for (int t : vertexTriangles[vertex]) {
+      if (removedTriangles[t])
+        continue;
+      const std::array<int, 3> &triangle = triangles[t];
+      bool shared = false;
+      glm::vec3 moved[3];
+      for (int k = 0; k < 3; k++) {
+        int v = triangle[k];
+        if (v == collapse.mKeep || v == collapse.mRemove) {
+          if (v != vertex)
+            shared = true;
+          moved[k] = collapse.mTarget;
+        } else {
+          moved[k] = vertices[v];
+        }
+      }
+      if (shared)
+        continue;
+      glm::vec3 before = faceNormal(vertices[triangle[0]],
+                                    vertices[triangle[1]],
+                                    vertices[triangle[2]]);
+      glm::vec3 after = faceNormal(moved[0], moved[1], moved[2]);
+      if (glm::dot(before, after) <= 0.0f)
+        return true;
+    }
+    return false;
+  };
+
+  SimplifiedMesh result;
+  int liveTriangles = triangles.size();
+  while (liveTriangles > targetTriangles && !heap.empty()) {
+    Collapse collapse = heap.top();
+    heap.pop();
+    int keep = collapse.mKeep;
+    int remove = collapse.mRemove;
+    if (removedVertices[keep] || removedVertices[remove] ||
+        stamps[keep] != collapse.mKeepStamp ||
+        stamps[remove] != collapse.mRemoveStamp)
+      continue;
+    if (flips(collapse, keep) || flips(collapse, remove))
+      continue;
+    deviations[keep] = std::max(deviations[keep], deviations[remove]) +
+                       planeDistance(collapse);
+
+    for (int t : vertexTriangles[remove]) {
+      if (removedTriangles[t])
+        continue;
+      std::array<int, 3> &triangle = triangles[t];
+      bool hasKeep = false;
+      for (int k = 0; k < 3; k++) {
+        if (triangle[k] == keep)
+          hasKeep = true;
+      }
+      if (hasKeep) {
+        removedTriangles[t] = true;
+        liveTriangles--;
+        continue;
+      }
+      for (int k = 0; k < 3; k++) {
+        if (triangle[k] == remove)
+          triangle[k] = keep;
+      }
+      vertexTriangles[keep].push_back(t);
+    }
+    vertexTriangles[remove].clear();
+    removedVertices[remove] = true;
+    stamps[remove]++;
+
+    vertices[keep] = collapse.mTarget;
+    quadrics[keep] += quadrics[remove];
+    stamps[keep]++;
+
+    // Refresh collapses around the kept vertex
+    std::vector<int> &keepTriangles = vertexTriangles[keep];
+    keepTriangles.erase(std::remove_if(keepTriangles.begin(),
+                                       keepTriangles.end(),
+                                       [&](int t) { return removedTriangles[t]; }),
+                        keepTriangles.end());
+    std::sort(keepTriangles.begin(), keepTriangles.end());
+    keepTriangles.erase(std::unique(keepTriangles.begin(), keepTriangles.end()),
+                        keepTriangles.end());
+    std::vector<int> neighbours;
+    for (int t : keepTriangles) {
+      for (int v : triangles[t]) {
+        if (v != keep)
+          neighbours.push_back(v);
+      }
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()),
+                     neighbours.end());
+    for (int neighbour : neighbours) {
+      heap.push(makeCollapse(keep, neighbour));
+    }
+  }
+
+  // Compact surviving vertices and triangles
+  std::vector<int> compact(vertices.size(), -1);
+  for (int t = 0; t < triangles.size(); t++) {
+    if (removedTriangles[t])
+      continue;
+    for (int v : triangles[t]) {
+      if (compact[v] < 0) {
+        compact[v] = result.mPositions.size();
+        result.mPositions.push_back(vertices[v]);
+        result.mError = std::max(result.mError, deviations[v]);
+      }
+      result.mIndices.push_back(compact[v]);
+    }
+  }
+  return result;
+}
@@ -0,0 +1,479 @@
+#include "StreamedBVH.h"
+#include "Data.h"
+#include "Utilities.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+#define MAX_BUCKETS_PER_AXIS 8
+#define COPY_BLOCK_SIZE (1 << 20)
+// Midpoint splits are not balanced, bucket subtrees get a few levels more
+// than a full tree over their leaves
+#define BUCKET_DEPTH_SLACK 4
+
+StreamedBVH::StreamedBVH(const std::string &workFolder, size_t memoryBudget)
+    : mWorkFolder(workFolder), mMemoryBudget(memoryBudget) {
+  mBatchSize =
+      std::max<long long>(1024, mMemoryBudget / 4 / sizeof(Triangle));
+}
+
+bool StreamedBVH::build(const std::string &trianglePath,
+                        const std::string &outputPath,
+                        const Settings &settings) {
+  auto start = std::chrono::high_resolution_clock::now();
+  mStats = StreamedBVHStats();
+
+  std::ifstream input(trianglePath, std::ios::binary);
+  if (!input.is_open()) {
+    std::cerr << "Failed to open triangle file: " << trianglePath << std::endl;
+    return false;
+  }
+
+  // Pass 1: centroid bounds and bucket grid
+  if (!computeBounds(input, settings.getLeafSize()))
+    return false;
+
+  // Pass 2: vertices and triangles binned to bucket files, then the
+  // oversized buckets split
+  input.clear();
+  input.seekg(0);
+  if (!distribute(input) || !splitBuckets())
+    return false;
+
+  // Pass 3: subtree per bucket, pass 4: top tree over bucket roots
+  if (!buildBuckets(settings))
+    return false;
+  buildTopTree();
+
+  if (!writeOutput(outputPath))
+    return false;
+
+  std::chrono::duration<double> duration =
+      std::chrono::high_resolution_clock::now() - start;
+  mStats.mBuildTime = duration.count();
+  mStats.mPeakMemory = Utils::peakMemoryUsage();
+  return true;
+}
+
+bool StreamedBVH::computeBounds(std::ifstream &input, int leafSize) {
+  float max = std::numeric_limits<float>::max();
+  mMinCenter = glm::vec3(max, max, max);
+  mMaxCenter = glm::vec3(-max, -max, -max);
+
+  std::vector<Triangle> batch(mBatchSize);
+  while (input) {
+    input.read(reinterpret_cast<char *>(batch.data()),
+               mBatchSize * sizeof(Triangle));
+    long long count = input.gcount() / sizeof(Triangle);
+    for (long long i = 0; i < count; i++) {
+      mMinCenter = glm::min(mMinCenter, batch[i].mCenter);
+      mMaxCenter = glm::max(mMaxCenter, batch[i].mCenter);
+    }
+    mStats.mTriangleCount += count;
+  }
+  if (mStats.mTriangleCount == 0) {
+    std::cerr << "Triangle file is empty" << std::endl;
+    return false;
+  }
+
+  // Largest bucket whose subtree build fits the budget at its own depth
+  mBucketLimit = mMemoryBudget / (2 * sizeof(Triangle) + sizeof(int));
+  while (mBucketLimit > 1 &&
+         bucketMemory(mBucketLimit, leafSize) > mMemoryBudget) {
+    mBucketLimit -= std::max<long long>(1, mBucketLimit / 16);
+  }
+  mBucketLimit = std::max<long long>(1, mBucketLimit);
+  double ratio = (double)mStats.mTriangleCount / (double)mBucketLimit;
+  mBucketsPerAxis = (int)std::ceil(std::cbrt(ratio));
+  mBucketsPerAxis = std::clamp(mBucketsPerAxis, 1, MAX_BUCKETS_PER_AXIS);
+  return true;
+}
+
+bool StreamedBVH::distribute(std::ifstream &input) {
+  int bucketCount = mBucketsPerAxis * mBucketsPerAxis * mBucketsPerAxis;
+  mBuckets.assign(bucketCount, Bucket());
+
+  std::vector<std::ofstream> bucketFiles(bucketCount);
+  for (int i = 0; i < bucketCount; i++) {
+    bucketFiles[i].open(bucketPath(i), std::ios::binary | std::ios::trunc);
+    if (!bucketFiles[i].is_open()) {
+      std::cerr << "Failed to open bucket file: " << bucketPath(i)
+                << std::endl;
+      return false;
+    }
+  }
+  std::ofstream vertexFile(mWorkFolder + "/vertices.tmp",
+                           std::ios::binary | std::ios::trunc);
+
+  // Triangles are not indexed, vertex index is 3 * triangle index
+  long long triangleIndex = 0;
+  std::vector<Triangle> batch(mBatchSize);
+  std::vector<float> vertices;
+  while (input) {
+    input.read(reinterpret_cast<char *>(batch.data()),
+               mBatchSize * sizeof(Triangle));
+    long long count = input.gcount() / sizeof(Triangle);
+    vertices.clear();
+    for (long long i = 0; i < count; i++) {
+      Triangle &triangle = batch[i];
+      for (int k = 0; k < 3; k++) {
+        triangle.mModedIndices[k] = triangleIndex * 3 + k;
+        const glm::vec3 &position = triangle.mVertices[k].mModedPosition;
+        vertices.insert(vertices.end(), {position.x, position.y, position.z});
+      }
+      triangleIndex++;
+
+      int index = bucketIndex(triangle.mCenter);
+      addTriangle(mBuckets[index], triangle);
+      bucketFiles[index].write(reinterpret_cast<const char *>(&triangle),
+                               sizeof(Triangle));
+    }
+    vertexFile.write(reinterpret_cast<const char *>(vertices.data()),
+                     vertices.size() * sizeof(float));
+  }
+  return true;
+}
+
+bool StreamedBVH::splitBuckets() {
+  // The grid is coarse, clustered geometry like a dense plant in a large
+  // scene leaves most triangles in one bucket. Halves are appended and
+  // split again until each fits.
+  for (int i = 0; i < mBuckets.size(); i++) {
+    if (mBuckets[i].mTriangleCount > mBucketLimit && !splitBucket(i))
+      return false;
+  }
+  return true;
+}
+
+bool StreamedBVH::splitBucket(int index) {
+  Bucket bucket = mBuckets[index];
+  glm::vec3 size = bucket.mMaxCenter - bucket.mMinCenter;
+  int axis = 0;
+  if (size.y > size.x && size.y >= size.z)
+    axis = 1;
+  else if (size.z > size.x && size.z > size.y)
+    axis = 2;
+  float split = (bucket.mMinCenter[axis] + bucket.mMaxCenter[axis]) * 0.5f;
+  bool byCount = size[axis] <= 0.0f;
+  long long half = bucket.mTriangleCount / 2;
+
+  std::ifstream input(bucketPath(index), std::ios::binary);
+  if (!input.is_open()) {
+    std::cerr << "Failed to open bucket file: " << bucketPath(index)
+              << std::endl;
+    return false;
+  }
+  int first = mBuckets.size();
+  mBuckets.resize(first + 2);
+  std::ofstream outputs[2];
+  for (int side = 0; side < 2; side++) {
+    outputs[side].open(bucketPath(first + side),
+                       std::ios::binary | std::ios::trunc);
+    if (!outputs[side].is_open()) {
+      std::cerr << "Failed to open bucket file: "
+                << bucketPath(first + side) << std::endl;
+      return false;
+    }
+  }
+
+  long long seen = 0;
+  std::vector<Triangle> batch(mBatchSize);
+  while (input) {
+    input.read(reinterpret_cast<char *>(batch.data()),
+               mBatchSize * sizeof(Triangle));
+    long long count = input.gcount() / sizeof(Triangle);
+    for (long long i = 0; i < count; i++) {
+      const Triangle &triangle = batch[i];
+      int side = byCount ? seen++ >= half : triangle.mCenter[axis] > split;
+      addTriangle(mBuckets[first + side], triangle);
+      outputs[side].write(reinterpret_cast<const char *>(&triangle),
+                          sizeof(Triangle));
+    }
+  }
+  input.close();
+  std::remove(bucketPath(index).c_str());
+  mBuckets[index].mTriangleCount = 0;
+  return outputs[0].good() && outputs[1].good();
+}
+
+void StreamedBVH::addTriangle(Bucket &bucket, const Triangle &triangle) {
+  for (int k = 0; k < 3; k++) {
+    bucket.mMinVert =
+        glm::min(bucket.mMinVert, triangle.mVertices[k].mModedPosition);
+    bucket.mMaxVert =
+        glm::max(bucket.mMaxVert, triangle.mVertices[k].mModedPosition);
+  }
+  bucket.mMinCenter = glm::min(bucket.mMinCenter, triangle.mCenter);
+  bucket.mMaxCenter = glm::max(bucket.mMaxCenter, triangle.mCenter);
+  bucket.mTriangleCount++;
+}
+
+int StreamedBVH::bucketDepth(long long triangleCount, int leafSize) {
+  long long leaves = (triangleCount + leafSize - 1) / leafSize;
+  int depth = 0;
+  while ((1LL << depth) < leaves) {
+    depth++;
+  }
+  return depth + BUCKET_DEPTH_SLACK;
+}
+
+size_t StreamedBVH::bucketMemory(long long triangleCount, int leafSize) {
+  // Bucket triangles, the index array the build partitions and the leaf
+  // copies, plus the nodes of a tree of the bucket's depth
+  long long nodes = std::min(2LL << std::min(bucketDepth(triangleCount,
+                                                         leafSize), 40),
+                             2 * triangleCount);
+  return triangleCount * (2 * sizeof(Triangle) + sizeof(int)) +
+         nodes * sizeof(BVHNode);
+}
+
+bool StreamedBVH::buildBuckets(const Settings &settings) {
+  int nonEmpty = 0;
+  for (const Bucket &bucket : mBuckets) {
+    if (bucket.mTriangleCount > 0)
+      nonEmpty++;
+  }
+  mStats.mBucketCount = nonEmpty;
+
+  // Top tree over n bucket roots has n - 1 inner nodes, they take the first
+  // ids so the root stays at id 0
+  int nextID = nonEmpty - 1;
+  std::ofstream nodeFile(mWorkFolder + "/nodes.tmp",
+                         std::ios::binary | std::ios::trunc);
+  std::ofstream sizeFile(mWorkFolder + "/sizes.tmp",
+                         std::ios::binary | std::ios::trunc);
+
+  std::vector<Triangle> triangles;
+  std::vector<float> floats;
+  for (int i = 0; i < mBuckets.size(); i++) {
+    Bucket &bucket = mBuckets[i];
+    if (bucket.mTriangleCount == 0) {
+      std::remove(bucketPath(i).c_str());
+      continue;
+    }
+
+    triangles.resize(bucket.mTriangleCount);
+    std::ifstream bucketFile(bucketPath(i), std::ios::binary);
+    bucketFile.read(reinterpret_cast<char *>(triangles.data()),
+                    bucket.mTriangleCount * sizeof(Triangle));
+    if (!bucketFile) {
+      std::cerr << "Failed to read bucket file: " << bucketPath(i)
+                << std::endl;
+      return false;
+    }
+    bucketFile.close();
+    std::remove(bucketPath(i).c_str());
+
+    BVHNode::mIdCounter = nextID - 1;
+    // Depth follows the bucket size, the editor depth is for the in memory
+    // build and would leave huge leaves in big buckets
+    int depth = bucketDepth(bucket.mTriangleCount, settings.getLeafSize());
+    BVHNode *node =
+        BVHNode::buildBVH(triangles, depth, settings.getLeafSize(), 0);
+    std::vector<int> sizes = BVHNode::calculateNodeSizes(node);
+    bucket.mRootID = node->getID();
+    nextID += sizes.size();
+
+    floats.clear();
+    writeNode(node, floats);
+    nodeFile.write(reinterpret_cast<const char *>(floats.data()),
+                   floats.size() * sizeof(float));
+    sizeFile.write(reinterpret_cast<const char *>(sizes.data()),
+                   sizes.size() * sizeof(int));
+    delete node;
+  }
+  mStats.mNodeCount = nextID;
+  return true;
+}
+
+void StreamedBVH::buildTopTree() {
+  std::vector<int> buckets;
+  for (int i = 0; i < mBuckets.size(); i++) {
+    if (mBuckets[i].mTriangleCount > 0)
+      buckets.push_back(i);
+  }
+  mTopNodes.clear();
+  mRootID = buildTopNode(buckets, 0, buckets.size());
+}
+
+int StreamedBVH::buildTopNode(std::vector<int> &buckets, int begin, int end) {
+  if (end - begin == 1)
+    return mBuckets[buckets[begin]].mRootID;
+
+  int id = mTopNodes.size();
+  mTopNodes.push_back(TopNode());
+
+  float max = std::numeric_limits<float>::max();
+  glm::vec3 minCenter = glm::vec3(max, max, max);
+  glm::vec3 maxCenter = glm::vec3(-max, -max, -max);
+  glm::vec3 minVert = minCenter;
+  glm::vec3 maxVert = maxCenter;
+  for (int i = begin; i < end; i++) {
+    const Bucket &bucket = mBuckets[buckets[i]];
+    glm::vec3 center = (bucket.mMaxVert + bucket.mMinVert) * 0.5f;
+    minCenter = glm::min(minCenter, center);
+    maxCenter = glm::max(maxCenter, center);
+    minVert = glm::min(minVert, bucket.mMinVert);
+    maxVert = glm::max(maxVert, bucket.mMaxVert);
+  }
+
+  glm::vec3 size = maxCenter - minCenter;
+  int splitCoord = 0;
+  if (size.y > size.x && size.y >= size.z)
+    splitCoord = 1;
+  else if (size.z > size.x && size.z > size.y)
+    splitCoord = 2;
+
+  int mid = begin + (end - begin) / 2;
+  std::nth_element(buckets.begin() + begin, buckets.begin() + mid,
+                   buckets.begin() + end, [&](int a, int b) {
+                     const Bucket &bucketA = mBuckets[a];
+                     const Bucket &bucketB = mBuckets[b];
+                     return bucketA.mMaxVert[splitCoord] +
+                                bucketA.mMinVert[splitCoord] <
+                            bucketB.mMaxVert[splitCoord] +
+                                bucketB.mMinVert[splitCoord];
+                   });
+
+  int leftID = buildTopNode(buckets, begin, mid);
+  int rightID = buildTopNode(buckets, mid, end);
+
+  TopNode &node = mTopNodes[id];
+  node.mLeftID = leftID;
+  node.mRightID = rightID;
+  node.mSplitAxis = splitCoord;
+  node.mMaxVert = maxVert;
+  node.mMinVert = minVert;
+  return id;
+}
+
+bool StreamedBVH::writeOutput(const std::string &outputPath) {
+  std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+  if (!output.is_open()) {
+    std::cerr << "Failed to open output file: " << outputPath << std::endl;
+    return false;
+  }
+
+  std::vector<float> topFloats;
+  for (const TopNode &node : mTopNodes) {
+    topFloats.insert(topFloats.end(),
+                     {node.mMaxVert.x, node.mMaxVert.y, node.mMaxVert.z,
+                      node.mMinVert.x, node.mMinVert.y, node.mMinVert.z, 0.0f,
+                      packBVHInt(node.mLeftID), packBVHInt(node.mRightID),
+                      packBVHInt(node.mSplitAxis)});
+  }
+
+  long long nodeSlots = topFloats.size();
+  std::ifstream sizeFile(mWorkFolder + "/sizes.tmp", std::ios::binary);
+  std::vector<int> sizes(COPY_BLOCK_SIZE);
+  while (sizeFile) {
+    sizeFile.read(reinterpret_cast<char *>(sizes.data()),
+                  COPY_BLOCK_SIZE * sizeof(int));
+    long long count = sizeFile.gcount() / sizeof(int);
+    for (long long i = 0; i < count; i++) {
+      nodeSlots += sizes[i];
+    }
+  }
+
+  BVHFileHeader header;
+  header.mMagic = BVH_FILE_MAGIC;
+  header.mVertexFloatCount = mStats.mTriangleCount * 9;
+  header.mNodeCount = mStats.mNodeCount;
+  header.mNodeSlotCount = nodeSlots;
+  long long floatCount =
+      header.mVertexFloatCount + header.mNodeCount + header.mNodeSlotCount;
+  if (REAL_VERTICES_OFFSET + floatCount > DATA_SIZE) {
+    std::cout << "Warning: BVH needs " << floatCount
+              << " floats, it is written but will not fit the data buffer"
+              << std::endl;
+  }
+  output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  // Vertices
+  std::vector<char> block(COPY_BLOCK_SIZE);
+  std::ifstream vertexFile(mWorkFolder + "/vertices.tmp", std::ios::binary);
+  while (vertexFile) {
+    vertexFile.read(block.data(), block.size());
+    output.write(block.data(), vertexFile.gcount());
+  }
+  vertexFile.close();
+  std::remove((mWorkFolder + "/vertices.tmp").c_str());
+
+  // Node offset table, same order as the node ids
+  std::vector<long long> table;
+  long long nodeSum = 0;
+  for (int i = 0; i < mTopNodes.size(); i++) {
+    table.push_back(nodeSum);
+    nodeSum += 10; // inner node
+  }
+  sizeFile.clear();
+  sizeFile.seekg(0);
+  while (sizeFile) {
+    sizeFile.read(reinterpret_cast<char *>(sizes.data()),
+                  COPY_BLOCK_SIZE * sizeof(int));
+    long long count = sizeFile.gcount() / sizeof(int);
+    for (long long i = 0; i < count; i++) {
+      table.push_back(nodeSum);
+      nodeSum += sizes[i];
+    }
+    output.write(reinterpret_cast<const char *>(table.data()),
+                 table.size() * sizeof(long long));
+    table.clear();
+  }
+  sizeFile.close();
+  std::remove((mWorkFolder + "/sizes.tmp").c_str());
+
+  // Nodes
+  output.write(reinterpret_cast<const char *>(topFloats.data()),
+               topFloats.size() * sizeof(float));
+  std::ifstream nodeFile(mWorkFolder + "/nodes.tmp", std::ios::binary);
+  while (nodeFile) {
+    nodeFile.read(block.data(), block.size());
+    output.write(block.data(), nodeFile.gcount());
+  }
+  nodeFile.close();
+  std::remove((mWorkFolder + "/nodes.tmp").c_str());
+  return output.good();
+}
+
+void StreamedBVH::writeNode(BVHNode *node, std::vector<float> &floats) {
+  const glm::vec3 &maxVert = node->getMaxVert();
+  const glm::vec3 &minVert = node->getMinVert();
+  floats.insert(floats.end(), {maxVert.x, maxVert.y, maxVert.z, minVert.x,
+                               minVert.y, minVert.z, (float)node->isLeaf()});
+  if (node->isLeaf()) {
+    floats.push_back(packBVHInt(node->getTriangleCount()));
+    for (const Triangle &triangle : node->getTriangles()) {
+      const glm::vec3 &normal = triangle.mVertices[0].mNormal;
+      floats.insert(floats.end(),
+                    {packBVHInt(triangle.mModelIndex),
+                     packBVHInt(triangle.mMeshIndex),
+                     packBVHInt(triangle.mModedIndices[0]),
+                     packBVHInt(triangle.mModedIndices[1]),
+                     packBVHInt(triangle.mModedIndices[2]), normal.x,
+                     normal.y, normal.z});
+    }
+    return;
+  }
+  floats.insert(floats.end(),
+                {packBVHInt(node->getLeftID()), packBVHInt(node->getRightID()),
+                 packBVHInt(node->getSplitAxis())});
+  writeNode(node->getLeft(), floats);
+  writeNode(node->getRight(), floats);
+}
+
+std::string StreamedBVH::bucketPath(int bucket) const {
+  return mWorkFolder + "/bucket_" + std::to_string(bucket) + ".tmp";
+}
+
+int StreamedBVH::bucketIndex(const glm::vec3 &center) const {
+  glm::vec3 size = mMaxCenter - mMinCenter;
+  int index[3];
+  for (int i = 0; i < 3; i++) {
+    float t = size[i] > 0.0f ? (center[i] - mMinCenter[i]) / size[i] : 0.0f;
+    index[i] = std::clamp((int)(t * mBucketsPerAxis), 0, mBucketsPerAxis - 1);
+  }
+  return (index[2] * mBucketsPerAxis + index[1]) * mBucketsPerAxis + index[0];
+}
@@ -0,0 +1,58 @@
+#include "TileScheduler.h"
+
+#include <algorithm>
+
+// Weight of a new measurement in the cost per pixel
+#define TIME_SMOOTHING 0.3
+
+void TileScheduler::reset(int width, int height, int tileSize) {
+  tileSize = std::max(tileSize, 1);
+  mTiles.clear();
+  mNext = 0;
+  for (int y = 0; y < height; y += tileSize) {
+    for (int x = 0; x < width; x += tileSize) {
+      mTiles.push_back(glm::ivec4(x, y, std::min(tileSize, width - x),
+                                  std::min(tileSize, height - y)));
+    }
+  }
+
+  // The center of the view is what is looked at
+  auto distance = [width, height](const glm::ivec4 &tile) {
+    float dx = tile.x + tile.z * 0.5f - width * 0.5f;
+    float dy = tile.y + tile.w * 0.5f - height * 0.5f;
+    return dx * dx + dy * dy;
+  };
+  std::stable_sort(mTiles.begin(), mTiles.end(),
+                   [&distance](const glm::ivec4 &a, const glm::ivec4 &b) {
+                     return distance(a) < distance(b);
+                   });
+}
+
+void TileScheduler::update(double traceTime, int tracedPixels) {
+  if (traceTime <= 0.0 || tracedPixels <= 0)
+    return;
+  double timePerPixel = traceTime / tracedPixels;
+  mTimePerPixel = mTimePerPixel == 0.0
+                      ? timePerPixel
+                      : mTimePerPixel * (1.0 - TIME_SMOOTHING) +
+                            timePerPixel * TIME_SMOOTHING;
+}
+
+void TileScheduler::next(const Settings &settings,
+                         std::vector<glm::ivec4> &tiles) {
+  tiles.clear();
+  // Unmeasured scenes start with a single tile
+  double budgetPixels = mTimePerPixel > 0.0
+                            ? settings.mFrameBudget / mTimePerPixel
+                            : 0.0;
+  double pixels = 0.0;
+  while (!isDone()) {
+    const glm::ivec4 &tile = mTiles[mNext];
+    double tilePixels = (double)tile.z * tile.w;
+    if (!tiles.empty() && pixels + tilePixels > budgetPixels)
+      break;
+    tiles.push_back(tile);
+    pixels += tilePixels;
+    mNext++;
+  }
+}
@@ -10,8 +10,14 @@ void UBO::init(const Data &data) {
 }
 
 void UBO::update(const Data &newData) {
+  // Nothing past the float data size is read
+  update(newData, 0, newData.getFloatDataSize());
+}
+
+void UBO::update(const Data &newData, int offset, int count) {
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, mID);
-  glBufferSubData(GL_SHADER_STORAGE_BUFFER, mBindingIndex, sizeof(Data), &newData);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset * sizeof(float),
+                  count * sizeof(float), newData.getData() + offset);
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
@@ -1,9 +1,250 @@
 #include "Application.h"
+#include "CPURenderer.h"
+#include "StreamedBVH.h"
 
+#include <chrono>
+#include <filesystem>
 #include <iostream>
+#include <random>
+#include <string>
+#include <vector>
 
-int main() {
-  Application application(1200, 800);
+#define DEFAULT_MODEL "../models/Default/Monkey.obj"
+
+int exportTriangles(const std::string &path,
+                    const std::vector<std::string> &models) {
+  Scene scene;
+  for (const std::string &model : models) {
+    scene.addModel(model);
+  }
+  if (!scene.exportTriangles(path))
+    return 1;
+  std::cout << "Exported " << scene.getTrianglesCount() << " triangles to "
+            << path << std::endl;
+  return 0;
+}
+
+int buildBVH(const std::string &input, const std::string &output,
+             size_t budgetMB) {
+  Settings settings;
+  std::string workFolder = std::filesystem::temp_directory_path().string();
+  StreamedBVH builder(workFolder, budgetMB << 20);
+  if (!builder.build(input, output, settings))
+    return 1;
+
+  const StreamedBVHStats &stats = builder.getStats();
+  std::cout << "Triangles: " << stats.mTriangleCount << std::endl;
+  std::cout << "Buckets: " << stats.mBucketCount << std::endl;
+  std::cout << "Nodes: " << stats.mNodeCount << std::endl;
+  std::cout << "Build time: " << stats.mBuildTime << " s" << std::endl;
+  std::cout << "Peak RSS: " << stats.mPeakMemory / (1024.0 * 1024.0) << " MB"
+            << std::endl;
+  return 0;
+}
+
+int benchTriangleKernels(int triangleCount, int rayCount) {
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> position(-1.0f, 1.0f);
+  auto randomVec3 = [&]() {
+    return glm::vec3(position(random), position(random), position(random));
+  };
+
+  // Small triangles around the origin, rays from a sphere around it
+  std::vector<glm::vec3> vertices;
+  std::vector<TriangleGroup> groups(
+      (triangleCount + TRIANGLE_GROUP_SIZE - 1) / TRIANGLE_GROUP_SIZE);
+  for (int i = 0; i < triangleCount; i++) {
+    glm::vec3 center = randomVec3();
+    glm::vec3 v[3] = {center + randomVec3() * 0.2f,
+                      center + randomVec3() * 0.2f,
+                      center + randomVec3() * 0.2f};
+    TriangleGroup &group = groups[i / TRIANGLE_GROUP_SIZE];
+    int lane = i % TRIANGLE_GROUP_SIZE;
+    for (int axis = 0; axis < 3; axis++) {
+      group.mVertex0[axis][lane] = v[0][axis];
+      group.mEdge1[axis][lane] = v[1][axis] - v[0][axis];
+      group.mEdge2[axis][lane] = v[2][axis] - v[0][axis];
+    }
+    group.mRecords[lane] = i;
+    vertices.insert(vertices.end(), v, v + 3);
+  }
+  std::vector<CPURenderer::Ray> rays(rayCount);
+  for (CPURenderer::Ray &ray : rays) {
+    ray.mOrigin = glm::normalize(randomVec3()) * 5.0f;
+    ray.mDirection = glm::normalize(randomVec3() * 0.5f - ray.mOrigin);
+  }
+
+  using Clock = std::chrono::high_resolution_clock;
+  int scalarHits = 0;
+  auto start = Clock::now();
+  for (const CPURenderer::Ray &ray : rays) {
+    float closestT = 1e30f;
+    for (int i = 0; i < triangleCount; i++) {
+      float t;
+      if (CPUIntersect::rayTriangle(ray, vertices[i * 3], vertices[i * 3 + 1],
+                                    vertices[i * 3 + 2], t) &&
+          t < closestT)
+        closestT = t;
+    }
+    scalarHits += closestT < 1e30f;
+  }
+  std::chrono::duration<double> scalarTime = Clock::now() - start;
+
+  int groupHits = 0;
+  start = Clock::now();
+  for (const CPURenderer::Ray &ray : rays) {
+    float closestT = 1e30f;
+    for (const TriangleGroup &group : groups) {
+      float t;
+      if (CPUIntersect::rayTriangleGroup(ray, group, closestT, t) >= 0)
+        closestT = t;
+    }
+    groupHits += closestT < 1e30f;
+  }
+  std::chrono::duration<double> groupTime = Clock::now() - start;
+
+  double tests = (double)triangleCount * rayCount / 1000000.0;
+  std::cout << "Scalar: " << tests / scalarTime.count() << " Mtests/s, "
+            << scalarHits << " hits" << std::endl;
+  std::cout << "Groups of " << TRIANGLE_GROUP_SIZE << ": "
+            << tests / groupTime.count() << " Mtests/s, " << groupHits
+            << " hits" << std::endl;
+  return scalarHits == groupHits ? 0 : 1;
+}
+
+int renderHeadless(const std::string &output, int width, int height,
+                   int threads, ViewportMode viewportMode, bool bench,
+                   const std::vector<std::string> &models) {
+  Scene scene;
+  for (const std::string &model : models) {
+    scene.addModel(model);
+  }
+  scene.addLight(LightType::Directional);
+  Camera camera(width, height, 45.0f);
+  Settings settings;
+  settings.mViewportMode = viewportMode;
+  scene.updateLOD(camera, settings);
+
+  auto data = std::make_unique<Data>();
+  data->updateSettings(settings);
+  data->updateCamera(camera);
+  data->updateLights(scene);
+  data->updateBVH(scene, settings);
+  data->updatePrimitives(scene);
+  data->updateMaterial(scene, false);
+
+  CPURenderer renderer(threads);
+  std::vector<unsigned char> pixels;
+
+  // Each optimisation on top of the previous one, all images should match
+  if (bench) {
+    std::vector<unsigned char> referencePixels;
+    auto benchRender = [&](const std::string &label, bool ordered,
+                           bool groups, bool packets) {
+      renderer.setOrderedMode(ordered);
+      renderer.setGroupMode(groups);
+      renderer.setPacketMode(packets);
+      renderer.render(*data, width, height, pixels);
+      const CPURenderStats &stats = renderer.getStats();
+      std::cout << label << ": " << stats.mRaysPerSecond / 1000000.0
+                << " Mrays/s, " << (double)stats.mNodeVisits / stats.mRays
+                << " nodes/ray";
+      if (referencePixels.empty())
+        referencePixels = pixels;
+      else
+        std::cout << ", max difference "
+                  << CPURenderer::compare(referencePixels, pixels, 0).mMaxError;
+      std::cout << std::endl;
+    };
+    benchRender("Single rays, unordered", false, false, false);
+    benchRender("Single rays", true, false, false);
+    benchRender("Single rays, triangle groups", true, true, false);
+    benchRender("Packets", true, true, true);
+  } else {
+    renderer.setPacketMode(true);
+    renderer.render(*data, width, height, pixels);
+  }
+  if (!CPURenderer::saveImage(output, width, height, pixels)) {
+    std::cout << "Failed to write image: " << output << std::endl;
+    return 1;
+  }
+
+  const CPURenderStats &stats = renderer.getStats();
+  std::cout << "Rendered " << width << "x" << height << " on "
+            << stats.mThreads << " threads in " << stats.mRenderTime * 1000.0
+            << " ms" << std::endl;
+  std::cout << "Rays/s: " << stats.mRaysPerSecond << std::endl;
+  std::cout << "Nodes per ray: " << (double)stats.mNodeVisits / stats.mRays
+            << std::endl;
+  return 0;
+}
+
+// Usage:
+//   RayTracer [--compute] [models...]
+//   RayTracer --load-bvh <file.bvh> [models...]
+//   RayTracer --export-triangles <file.tri> [models...]
+//   RayTracer --build-bvh <file.tri> <file.bvh> [budgetMB]
+//   RayTracer --bench-triangles [triangles] [rays]
+//   RayTracer --headless <image.png> [--size <w> <h>] [--threads <n>]
+//             [--viewport flat|shaded|wireframe] [--bench] [models...]
+int main(int argc, char **argv) {
+  std::vector<std::string> args(argv + 1, argv + argc);
+
+  if (args.size() >= 3 && args[0] == "--build-bvh") {
+    size_t budgetMB = args.size() >= 4 ? std::stoul(args[3]) : 512;
+    return buildBVH(args[1], args[2], budgetMB);
+  }
+  if (args.size() >= 1 && args[0] == "--bench-triangles") {
+    int triangleCount = args.size() >= 2 ? std::stoi(args[1]) : 256;
+    int rayCount = args.size() >= 3 ? std::stoi(args[2]) : 100000;
+    return benchTriangleKernels(triangleCount, rayCount);
+  }
+
+  std::string bvhFile;
+  std::string triangleFile;
+  std::string headlessImage;
+  int width = 1200;
+  int height = 800;
+  int threads = 0;
+  bool bench = false;
+  bool computeBackend = false;
+  ViewportMode viewportMode = ViewportMode::Shaded;
+  std::vector<std::string> models;
+  for (int i = 0; i < args.size(); i++) {
+    if (args[i] == "--load-bvh" && i + 1 < args.size())
+      bvhFile = args[++i];
+    else if (args[i] == "--export-triangles" && i + 1 < args.size())
+      triangleFile = args[++i];
+    else if (args[i] == "--headless" && i + 1 < args.size())
+      headlessImage = args[++i];
+    else if (args[i] == "--size" && i + 2 < args.size()) {
+      width = std::stoi(args[++i]);
+      height = std::stoi(args[++i]);
+    } else if (args[i] == "--threads" && i + 1 < args.size())
+      threads = std::stoi(args[++i]);
+    else if (args[i] == "--bench")
+      bench = true;
+    else if (args[i] == "--compute")
+      computeBackend = true;
+    else if (args[i] == "--viewport" && i + 1 < args.size()) {
+      std::string mode = args[++i];
+      if (mode == "flat")
+        viewportMode = ViewportMode::Flat;
+      else if (mode == "wireframe")
+        viewportMode = ViewportMode::Wireframe;
+    } else
+      models.push_back(args[i]);
+  }
+  if (models.empty())
+    models.push_back(DEFAULT_MODEL);
+
+  if (!triangleFile.empty())
+    return exportTriangles(triangleFile, models);
+  if (!headlessImage.empty())
+    return renderHeadless(headlessImage, width, height, threads, viewportMode,
+                          bench, models);
+
+  Application application(1200, 800, models, bvhFile, computeBackend);
   application.run();
   return 0;
 }